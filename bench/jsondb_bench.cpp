@@ -0,0 +1,260 @@
+/**
+ * Benchmarks of the jsondb operations on synthetic tables from 1k to 1M
+ * documents. Compare runs across commits with the JSON report:
+ *
+ *     ./jsondb_bench --benchmark_format=json --benchmark_out=bench.json
+ *
+ * Tables are generated once per process under ./bench_data and removed on
+ * exit; benchmarks that modify a table use their own copy.
+ */
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "jsondb.h"
+
+using namespace jsondb;
+
+namespace {
+const char BENCH_PATH[] = "./bench_data";
+
+// Deterministic document with a unique "id", a few low-cardinality fields
+// and some nesting, roughly the shape of a user record.
+nlohmann::json make_document(std::int64_t id) {
+    static const char *cities[] = {"paris", "london", "madrid", "berlin", "rome", "lisbon", "vienna", "oslo"};
+    return {{"id", id},
+            {"name", "user" + std::to_string(id)},
+            {"email", "user" + std::to_string(id) + "@example.com"},
+            {"age", 18 + id % 70},
+            {"city", cities[id % 8]},
+            {"active", id % 3 != 0},
+            {"score", (id % 1000) / 10.0},
+            {"tags", {"tag" + std::to_string(id % 5), "tag" + std::to_string(id % 7)}},
+            {"address", {{"street", std::to_string(id % 300) + " main st"}, {"zip", 10000 + id % 90000}}}};
+}
+
+struct Dataset {
+    std::unique_ptr<JsonDB> db;
+    std::unique_ptr<Table> table;
+};
+
+// Table of `size` generated documents, written straight to the table file
+// so that building a million documents does not go through the journal.
+Dataset &dataset(const std::string &name, std::int64_t size) {
+    static std::map<std::string, Dataset> datasets;
+    const std::string key = name + "_" + std::to_string(size);
+    auto found = datasets.find(key);
+    if (found != datasets.end()) {
+        return found->second;
+    }
+    Dataset &data = datasets[key];
+    data.db = std::make_unique<JsonDB>(key, BENCH_PATH);
+    if (data.db->Exists()) {
+        data.db->Drop();
+    }
+    data.db->Create();
+    data.table = std::make_unique<Table>(name, *data.db);
+    data.table->Create();
+    {
+        std::ofstream tableFile(data.db->GetTablesPath() + "/" + name + ".json", std::ios::trunc);
+        tableFile << '[';
+        for (std::int64_t i = 0; i < size; i++) {
+            tableFile << (i ? "," : "") << make_document(i);
+        }
+        tableFile << ']';
+    }
+    // first read loads the table outside of the measured loop
+    data.table->FindDocument({{"id", {{"$eq", -1}}}});
+    return data;
+}
+
+void sizes(benchmark::internal::Benchmark *benchmark) {
+    for (std::int64_t size : {1000, 10000, 100000, 1000000}) {
+        benchmark->Arg(size);
+    }
+    benchmark->Unit(benchmark::kMicrosecond);
+}
+
+void BM_InsertDocument(benchmark::State &state) {
+    Table &table = *dataset("insert", state.range(0)).table;
+    std::int64_t id = state.range(0) + 1000000000;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.InsertDocument(make_document(id++)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InsertDocument)->Apply(sizes);
+
+void BM_InsertBatch(benchmark::State &state) {
+    Dataset &data = dataset("batch", state.range(0));
+    std::int64_t id = state.range(0) + 1000000000;
+    const int batchSize = 1000;
+    for (auto _ : state) {
+        Transaction transaction = data.db->BeginTransaction();
+        for (int i = 0; i < batchSize; i++) {
+            transaction.InsertDocument("batch", make_document(id++));
+        }
+        benchmark::DoNotOptimize(transaction.Commit());
+    }
+    state.SetItemsProcessed(state.iterations() * batchSize);
+}
+BENCHMARK(BM_InsertBatch)->Apply(sizes);
+
+void BM_FindDocumentSelective(benchmark::State &state) {
+    Table &table = *dataset("read", state.range(0)).table;
+    std::int64_t id = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.FindDocument({{"id", {{"$eq", id++ % state.range(0)}}}}));
+    }
+}
+BENCHMARK(BM_FindDocumentSelective)->Apply(sizes);
+
+void BM_FindDocumentsSelective(benchmark::State &state) {
+    Table &table = *dataset("read", state.range(0)).table;
+    std::int64_t id = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.FindDocuments({{"name", {{"$eq", "user" + std::to_string(id++ % state.range(0))}}}}));
+    }
+}
+BENCHMARK(BM_FindDocumentsSelective)->Apply(sizes);
+
+void BM_FindDocumentsNonSelective(benchmark::State &state) {
+    Table &table = *dataset("read", state.range(0)).table;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.FindDocuments({{"age", {{"$gte", 18}}}}));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FindDocumentsNonSelective)->Apply(sizes);
+
+// serialized results, as forwarded by a network layer
+void BM_FindDocumentsNonSelectiveDump(benchmark::State &state) {
+    Table &table = *dataset("read", state.range(0)).table;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.FindDocuments({{"age", {{"$gte", 18}}}}).dump());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FindDocumentsNonSelectiveDump)->Apply(sizes);
+
+void BM_FindDocumentsNonSelectiveRaw(benchmark::State &state) {
+    Table &table = *dataset("read", state.range(0)).table;
+    RawDocuments results;
+    for (auto _ : state) {
+        table.FindDocuments({{"age", {{"$gte", 18}}}}, results);
+        benchmark::DoNotOptimize(results.Text().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FindDocumentsNonSelectiveRaw)->Apply(sizes);
+
+void BM_FindDocumentsContains(benchmark::State &state) {
+    Table &table = *dataset("read", state.range(0)).table;
+    std::int64_t id = 0;
+    for (auto _ : state) {
+        std::string text = "r" + std::to_string(id++ % state.range(0)) + "@";
+        benchmark::DoNotOptimize(table.FindDocuments({{"email", {{"$contains", text}}}}));
+    }
+}
+BENCHMARK(BM_FindDocumentsContains)->Apply(sizes);
+
+void BM_FindDocumentsContainsTextIndex(benchmark::State &state) {
+    Dataset &data = dataset("text", state.range(0));
+    data.table->CreateTextIndex("email");
+    data.table->FindDocument({{"id", {{"$eq", -1}}}});
+    std::int64_t id = 0;
+    for (auto _ : state) {
+        std::string text = "r" + std::to_string(id++ % state.range(0)) + "@";
+        benchmark::DoNotOptimize(data.table->FindDocuments({{"email", {{"$contains", text}}}}));
+    }
+}
+BENCHMARK(BM_FindDocumentsContainsTextIndex)->Apply(sizes);
+
+void BM_UpdateDocument(benchmark::State &state) {
+    Table &table = *dataset("update", state.range(0)).table;
+    std::int64_t id = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            table.UpdateDocument({{"$inc", {{"score", 1}}}}, {{"id", {{"$eq", id++ % state.range(0)}}}}));
+    }
+}
+BENCHMARK(BM_UpdateDocument)->Apply(sizes);
+
+void BM_UpdateDocumentsNonSelective(benchmark::State &state) {
+    Table &table = *dataset("update", state.range(0)).table;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.UpdateDocuments({{"$inc", {{"score", 1}}}}, {{"city", {{"$eq", "paris"}}}}));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) / 8);
+}
+BENCHMARK(BM_UpdateDocumentsNonSelective)->Apply(sizes);
+
+void BM_DeleteDocument(benchmark::State &state) {
+    Table &table = *dataset("delete", state.range(0)).table;
+    std::int64_t id = 0;
+    for (auto _ : state) {
+        // put back a document to delete, keeping the table size stable
+        state.PauseTiming();
+        table.InsertDocument(make_document(state.range(0) + id));
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(table.DeleteDocument({{"id", {{"$eq", state.range(0) + id++}}}}));
+    }
+}
+BENCHMARK(BM_DeleteDocument)->Apply(sizes);
+
+void BM_Tables(benchmark::State &state) {
+    JsonDB db("tables_" + std::to_string(state.range(0)), BENCH_PATH);
+    if (db.Exists()) {
+        db.Drop();
+    }
+    db.Create();
+    for (std::int64_t i = 0; i < state.range(0); i++) {
+        Table("table" + std::to_string(i), db).Create();
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.Tables());
+    }
+}
+BENCHMARK(BM_Tables)->Arg(10)->Arg(100)->Arg(1000)->Unit(benchmark::kMicrosecond);
+
+// Opening a database and running the first query, which parses the table.
+void BM_ColdStart(benchmark::State &state) {
+    Dataset &data = dataset("read", state.range(0));
+    for (auto _ : state) {
+        JsonDB db(data.db->GetName(), BENCH_PATH);
+        Table table("read", db);
+        benchmark::DoNotOptimize(table.FindDocument({{"id", {{"$eq", 0}}}}));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ColdStart)->Apply(sizes)->Unit(benchmark::kMillisecond);
+
+// with a text index, whose file is mapped rather than rebuilt
+void BM_ColdStartTextIndex(benchmark::State &state) {
+    Dataset &data = dataset("text", state.range(0));
+    data.table->CreateTextIndex("email");
+    data.table->FindDocument({{"id", {{"$eq", -1}}}});
+    for (auto _ : state) {
+        JsonDB db(data.db->GetName(), BENCH_PATH);
+        Table table("text", db);
+        benchmark::DoNotOptimize(table.FindDocument({{"id", {{"$eq", 0}}}}));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ColdStartTextIndex)->Apply(sizes)->Unit(benchmark::kMillisecond);
+}  // namespace
+
+int main(int argc, char **argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    std::filesystem::remove_all(BENCH_PATH);
+    return 0;
+}
@@ -19,7 +19,7 @@ pipeline {
                     mkdir build
                 '''
                 dir('build'){
-                    sh 'cmake ..'
+                    sh 'cmake -DJSONDB_COVERAGE=ON ..'
                 }
             }
         }
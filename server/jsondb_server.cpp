@@ -0,0 +1,86 @@
+/**
+ * Owns one database and serves its tables to the local processes using
+ * `jsondb::Client` over a Unix domain socket, so that they share its
+ * caches and indexes:
+ *
+ *     ./jsondb_server <database> [--path <dir>] [--socket <path>] [--max-frame <bytes>]
+ *
+ * The database is created if it does not exist, the socket defaults to
+ * <dir>/<database>.sock and requests are limited to 64 MiB. SIGINT and
+ * SIGTERM stop the server.
+ */
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "jsondb.h"
+
+int main(int argc, char **argv) {
+    using namespace jsondb;
+
+    auto usage = [argv] {
+        std::cerr << "Usage: " << argv[0] << " <database> [--path <dir>] [--socket <path>] [--max-frame <bytes>]"
+                  << std::endl;
+        return 2;
+    };
+    if (argc < 2 || argv[1][0] == '-') {
+        return usage();
+    }
+    std::string name = argv[1];
+    std::string path = DEFAULT_DBPATH;
+    std::string socketPath;
+    std::size_t maxFrame = 0;
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            std::cerr << "Missing value for " << argv[i] << std::endl;
+            return usage();
+        }
+        if (std::strcmp(argv[i], "--path") == 0) {
+            path = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--socket") == 0) {
+            socketPath = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--max-frame") == 0) {
+            char *end = nullptr;
+            maxFrame = std::strtoull(argv[i + 1], &end, 10);
+            if (*argv[i + 1] == '\0' || *end != '\0' || maxFrame == 0) {
+                std::cerr << "Invalid frame size: " << argv[i + 1] << std::endl;
+                return usage();
+            }
+        } else {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return usage();
+        }
+    }
+    if (socketPath.empty()) {
+        socketPath = path + "/" + name + ".sock";
+    }
+
+    // the signals are taken by sigwait, every thread started later
+    // inherits the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    JsonDB db(name, path);
+    if (!db.Exists() && !db.Create()) {
+        return 1;
+    }
+    Server server(db, socketPath);
+    if (maxFrame > 0) {
+        server.SetMaxFrameSize(maxFrame);
+    }
+    if (!server.Start()) {
+        return 1;
+    }
+    std::cout << "Serving " << db.GetFile() << " on " << socketPath << std::endl;
+
+    int received = 0;
+    sigwait(&signals, &received);
+    server.Stop();
+    return 0;
+}
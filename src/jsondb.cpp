@@ -27,112 +27,4513 @@
  */
 #include "jsondb.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <exception>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <regex>
 #include <set>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#ifdef JSONDB_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
 #include "nlohmann/json.hpp"
 #include "nlohmann/json_fwd.hpp"
 
 namespace jsondb {
 const char DEFAULT_DBPATH[] = "./data";
 
-//TODO: improve the comparison algorith
-bool generic_comparator(std::string op, nlohmann::json  documentValue, nlohmann::json queryValue){
-    bool result = false;
-    switch (documentValue.type()) {
-        case nlohmann::json::value_t::string:
-            if(queryValue.is_string()){
-                result = compare(op, (std::string) documentValue, (std::string) queryValue);
-            }else if(queryValue.is_array()){
-                result =compare(op, (std::string) documentValue, (std::vector<std::string>) queryValue);
+// Sizes and modification time of the files backing a table, used to detect
+// changes made behind the back of the resident snapshot.
+struct FileStamp {
+    std::uintmax_t tableSize = 0;
+    std::int64_t tableTime = 0;
+    std::uintmax_t journalSize = 0;
+
+    bool operator==(const FileStamp &other) const {
+        return tableSize == other.tableSize && tableTime == other.tableTime &&
+               journalSize == other.journalSize;
+    }
+};
+
+// Read-only view of a whole file, mapped where the platform allows it, or
+// of the content just written to one.
+class MappedFile {
+   public:
+    explicit MappedFile(std::string content)
+        : buffer(std::move(content)), data(buffer.data()), size(buffer.size()) {}
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapping != nullptr) {
+            ::munmap(mapping, size);
+        }
+#endif
+    }
+
+    // The file at `path`, null when it is missing or empty.
+    static std::shared_ptr<const MappedFile> Open(const std::string &path) {
+#ifdef _WIN32
+        std::ifstream fileIn(path, std::ios::binary);
+        std::string content(std::istreambuf_iterator<char>(fileIn), {});
+        return content.empty() ? nullptr : std::make_shared<const MappedFile>(std::move(content));
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat info;
+        void *address = MAP_FAILED;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            address = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            return nullptr;
+        }
+        auto file = std::make_shared<MappedFile>(std::string());
+        file->mapping = address;
+        file->data = static_cast<const char *>(address);
+        file->size = static_cast<std::size_t>(info.st_size);
+        return file;
+#endif
+    }
+
+    const char *Data() const { return data; }
+    std::size_t Size() const { return size; }
+
+   private:
+    std::string buffer;
+    void *mapping = nullptr;
+    const char *data;
+    std::size_t size;
+};
+
+// Index files start with this header. A primary key index continues with
+// `entries` (hash, position) pairs sorted by hash; a text index continues
+// with `entries` (trigram, count, first) triples sorted by trigram,
+// followed by the positions they refer to. Numbers are in host byte
+// order. A file of another format version, written for another table
+// file, or failing its checksum is rebuilt.
+struct IndexFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t type;
+    std::uint64_t tableSize;
+    std::int64_t tableTime;
+    std::uint64_t entries;
+    std::int64_t lastId;
+    std::uint64_t checksum;
+    std::uint64_t reserved;
+};
+static_assert(sizeof(IndexFileHeader) == 64, "index file header layout");
+
+const char INDEX_MAGIC[8] = {'J', 'S', 'O', 'N', 'D', 'B', 'I', 'X'};
+const std::uint32_t INDEX_VERSION = 1;
+
+enum class IndexType : std::uint32_t { Primary = 1, Text = 2 };
+
+struct KeyEntry {
+    std::uint64_t hash;
+    std::uint64_t position;
+};
+
+struct TrigramEntry {
+    std::uint32_t trigram;
+    std::uint32_t count;
+    std::uint64_t first;
+};
+
+std::uint64_t fnv1a(std::string_view text) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (char c : text) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// FNV-1a over 64-bit words with a final fold of each step, fast enough to
+// check large index files when they are opened.
+std::uint64_t checksum(const char *data, std::size_t size) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Header of an index file of `type` written for the table file of
+// `stamp`, null when the file is stale or corrupt.
+const IndexFileHeader *index_header(const MappedFile &file, IndexType type, const FileStamp &stamp) {
+    if (file.Size() < sizeof(IndexFileHeader)) {
+        return nullptr;
+    }
+    const auto *header = reinterpret_cast<const IndexFileHeader *>(file.Data());
+    if (std::memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->version != INDEX_VERSION ||
+        header->type != static_cast<std::uint32_t>(type) || header->tableSize != stamp.tableSize ||
+        header->tableTime != stamp.tableTime) {
+        return nullptr;
+    }
+    const char *payload = file.Data() + sizeof(IndexFileHeader);
+    const std::size_t size = file.Size() - sizeof(IndexFileHeader);
+    const std::size_t entrySize = type == IndexType::Primary ? sizeof(KeyEntry) : sizeof(TrigramEntry);
+    if (header->entries > size / entrySize || checksum(payload, size) != header->checksum) {
+        return nullptr;
+    }
+    if (type == IndexType::Text) {
+        const std::uint64_t positions = (size - header->entries * entrySize) / sizeof(std::uint32_t);
+        const auto *entries = reinterpret_cast<const TrigramEntry *>(payload);
+        for (std::uint64_t i = 0; i < header->entries; i++) {
+            if (entries[i].first > positions || entries[i].count > positions - entries[i].first) {
+                return nullptr;
             }
-            break;
-        case nlohmann::json::value_t::number_integer:
-        case nlohmann::json::value_t::number_unsigned:
-        case nlohmann::json::value_t::number_float:
-            if(queryValue.is_number()){
-                result = compare(op, (float) documentValue, (float) queryValue);
-            }else if(queryValue.is_array()){
-                result = compare(op, (float) documentValue, (std::vector<float>) queryValue);
+        }
+    } else if (size != header->entries * entrySize) {
+        return nullptr;
+    }
+    return header;
+}
+
+// Entries of a checked primary key index file.
+std::pair<const KeyEntry *, const KeyEntry *> key_entries(const MappedFile &file) {
+    const auto *header = reinterpret_cast<const IndexFileHeader *>(file.Data());
+    const auto *first = reinterpret_cast<const KeyEntry *>(file.Data() + sizeof(IndexFileHeader));
+    return {first, first + header->entries};
+}
+
+// Positions holding `trigram` in a checked text index file.
+std::pair<const std::uint32_t *, const std::uint32_t *> text_postings(const MappedFile &file,
+                                                                      std::uint32_t trigram) {
+    const auto *header = reinterpret_cast<const IndexFileHeader *>(file.Data());
+    const auto *entries = reinterpret_cast<const TrigramEntry *>(file.Data() + sizeof(IndexFileHeader));
+    const auto *positions = reinterpret_cast<const std::uint32_t *>(entries + header->entries);
+    const auto *found = std::lower_bound(
+        entries, entries + header->entries, trigram,
+        [](const TrigramEntry &entry, std::uint32_t value) { return entry.trigram < value; });
+    if (found == entries + header->entries || found->trigram != trigram) {
+        return {nullptr, nullptr};
+    }
+    return {positions + found->first, positions + found->first + found->count};
+}
+
+// Primary key index shared by the snapshots of one table file generation:
+// the index file of the table file, then the positions appended since.
+// Positions are only appended between compactions, so a snapshot ignores
+// the ones past its end and every hit is verified against the document.
+struct IdIndex {
+    std::shared_mutex mutex;
+    std::shared_ptr<const MappedFile> base;
+    std::unordered_map<std::string, std::vector<std::size_t>> positions;
+};
+
+// Trigram postings of the fields a table has text indexes on, shared like
+// `IdIndex`: the index file of the table file, then the positions
+// appended since. An update appends the position of the document again
+// under its new trigrams, so postings are a superset of the live
+// documents holding a trigram and every hit is verified against the query.
+struct TextIndex {
+    struct Postings {
+        std::shared_ptr<const MappedFile> base;
+        std::unordered_map<std::uint32_t, std::vector<std::size_t>> added;
+    };
+
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, Postings> fields;
+};
+
+// Object keys of the resident documents of a table, each stored once and
+// referred to by id. Ids are never reused, so the dictionary is shared by
+// every snapshot generation of the table.
+class KeyDictionary {
+   public:
+    static constexpr std::uint32_t npos = static_cast<std::uint32_t>(-1);
+
+    std::uint32_t Intern(const std::string &key) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            auto found = ids.find(key);
+            if (found != ids.end()) {
+                return found->second;
             }
-            break;
-        case nlohmann::json::value_t::boolean:
-            if(queryValue.is_boolean()){
-                result = compare(op, (bool) documentValue, (bool) queryValue);
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        auto found = ids.find(key);
+        if (found != ids.end()) {
+            return found->second;
+        }
+        // deque elements never move, so the views used as keys stay valid
+        keys.push_back(key);
+        std::uint32_t id = static_cast<std::uint32_t>(keys.size() - 1);
+        ids.emplace(keys.back(), id);
+        return id;
+    }
+
+    std::uint32_t Find(const std::string &key) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto found = ids.find(key);
+        return found == ids.end() ? npos : found->second;
+    }
+
+    const std::string &Key(std::uint32_t id) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return keys[id];
+    }
+
+   private:
+    mutable std::shared_mutex mutex;
+    std::deque<std::string> keys;
+    std::unordered_map<std::string_view, std::uint32_t> ids;
+};
+
+// Resident form of a document: a contiguous tape of 64-bit words in the
+// style of simdjson, so a scan walks memory linearly instead of chasing
+// map nodes. Every value starts with a word holding its type in the top
+// byte and a payload below:
+//   null, true, false       the word alone
+//   integer, unsigned, float the word, then the raw 64 bits
+//   string                  the byte length, then the bytes padded to words
+//   object, array           the index past the last word of the container,
+//                           then the values; object members are a key word
+//                           holding the dictionary id of the key, then the
+//                           value, sorted by key id
+// Values nlohmann can hold but JSON text cannot, such as binary, keep the
+// document as a plain nlohmann::json instead.
+class Document {
+   public:
+    enum Type : std::uint8_t { Null, True, False, Integer, Unsigned, Float, String, Object, Array, Key };
+
+    Document(const nlohmann::json &document, KeyDictionary &keys) {
+        if (!Encode(document, keys)) {
+            tape.clear();
+            other = document;
+        }
+        tape.shrink_to_fit();
+    }
+
+    bool IsObject() const { return !tape.empty() && TypeAt(0) == Object; }
+
+    // Index of the value of a top-level member, or 0 when there is none.
+    std::size_t Find(std::uint32_t key) const {
+        if (!IsObject()) {
+            return 0;
+        }
+        for (std::size_t i = 1, end = Payload(0); i < end; i = Next(i + 1)) {
+            std::uint32_t id = static_cast<std::uint32_t>(Payload(i));
+            if (id >= key) {
+                return id == key ? i + 1 : 0;
             }
-            break;
-        case nlohmann::json::value_t::null:
-            if(queryValue.is_null()){
-                result = compare(op, documentValue, queryValue);
+        }
+        return 0;
+    }
+
+    Type TypeAt(std::size_t i) const { return static_cast<Type>(tape[i] >> 56); }
+
+    std::string_view StringAt(std::size_t i) const {
+        return std::string_view(reinterpret_cast<const char *>(&tape[i + 1]), Payload(i));
+    }
+
+    // Numbers as `generic_comparator` sees them.
+    float FloatAt(std::size_t i) const {
+        switch (TypeAt(i)) {
+            case Integer:
+                return static_cast<float>(Bits<std::int64_t>(i + 1));
+            case Unsigned:
+                return static_cast<float>(Bits<std::uint64_t>(i + 1));
+            default:
+                return static_cast<float>(Bits<double>(i + 1));
+        }
+    }
+
+    template <class Json>
+    Json Materialize(const KeyDictionary &keys) const {
+        return tape.empty() ? Json(other) : Materialize<Json>(0, keys);
+    }
+
+    template <class Json>
+    Json Materialize(std::size_t i, const KeyDictionary &keys) const {
+        switch (TypeAt(i)) {
+            case Null:
+                return Json();
+            case True:
+                return Json(true);
+            case False:
+                return Json(false);
+            case Integer:
+                return Json(Bits<std::int64_t>(i + 1));
+            case Unsigned:
+                return Json(Bits<std::uint64_t>(i + 1));
+            case Float:
+                return Json(Bits<double>(i + 1));
+            case String: {
+                std::string_view value = StringAt(i);
+                return Json(typename Json::string_t(value.data(), value.size()));
+            }
+            case Array: {
+                Json array = Json::array();
+                for (std::size_t j = i + 1, end = Payload(i); j < end; j = Next(j)) {
+                    array.push_back(Materialize<Json>(j, keys));
+                }
+                return array;
+            }
+            default: {
+                Json object = Json::object();
+                auto &members = object.template get_ref<typename Json::object_t &>();
+                for (std::size_t j = i + 1, end = Payload(i); j < end; j = Next(j + 1)) {
+                    const std::string &key = keys.Key(static_cast<std::uint32_t>(Payload(j)));
+                    members.emplace_hint(members.end(), typename Json::string_t(key.data(), key.size()),
+                                         Materialize<Json>(j + 1, keys));
+                }
+                return object;
+            }
+        }
+    }
+
+    nlohmann::json Json(const KeyDictionary &keys) const { return Materialize<nlohmann::json>(keys); }
+
+    FieldValue FieldAt(std::size_t i) const {
+        FieldValue value;
+        switch (TypeAt(i)) {
+            case Null:
+                value.kind = FieldValue::Null;
+                break;
+            case True:
+            case False:
+                value.kind = FieldValue::Boolean;
+                value.boolean = TypeAt(i) == True;
+                break;
+            case Integer:
+                value.kind = FieldValue::Integer;
+                value.integer = Bits<std::int64_t>(i + 1);
+                break;
+            case Unsigned:
+                value.kind = FieldValue::Unsigned;
+                value.unsignedValue = Bits<std::uint64_t>(i + 1);
+                break;
+            case Float:
+                value.kind = FieldValue::Float;
+                value.number = Bits<double>(i + 1);
+                break;
+            case String:
+                value.kind = FieldValue::String;
+                value.string = StringAt(i);
+                break;
+            default:
+                value.kind = FieldValue::Other;
+        }
+        return value;
+    }
+
+    // Appends the document as JSON text, as `Json(keys).dump()` would.
+    void Serialize(std::string &out, const KeyDictionary &keys) const {
+        if (tape.empty()) {
+            out += other.dump();
+        } else {
+            Serialize(0, out, keys);
+        }
+    }
+
+   private:
+    static constexpr std::uint64_t payloadMask = (std::uint64_t(1) << 56) - 1;
+
+    std::uint64_t Payload(std::size_t i) const { return tape[i] & payloadMask; }
+
+    template <class T>
+    T Bits(std::size_t i) const {
+        T value;
+        std::memcpy(&value, &tape[i], sizeof(value));
+        return value;
+    }
+
+    // Index of the value following the one at i.
+    std::size_t Next(std::size_t i) const {
+        switch (TypeAt(i)) {
+            case Integer:
+            case Unsigned:
+            case Float:
+                return i + 2;
+            case String:
+                return i + 1 + (Payload(i) + 7) / 8;
+            case Object:
+            case Array:
+                return Payload(i);
+            default:
+                return i + 1;
+        }
+    }
+
+    static void Escape(std::string_view text, std::string &out) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (char c : text) {
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\b':
+                    out += "\\b";
+                    break;
+                case '\f':
+                    out += "\\f";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\r':
+                    out += "\\r";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        out += "\\u00";
+                        out += hex[c >> 4];
+                        out += hex[c & 0xf];
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        out += '"';
+    }
+
+   public:
+    // Appends the value at i as JSON text.
+    void Serialize(std::size_t i, std::string &out, const KeyDictionary &keys) const {
+        switch (TypeAt(i)) {
+            case Null:
+                out += "null";
+                break;
+            case True:
+                out += "true";
+                break;
+            case False:
+                out += "false";
+                break;
+            case Integer:
+                out += std::to_string(Bits<std::int64_t>(i + 1));
+                break;
+            case Unsigned:
+                out += std::to_string(Bits<std::uint64_t>(i + 1));
+                break;
+            case Float:
+                // nlohmann's shortest round-trip formatting
+                out += nlohmann::json(Bits<double>(i + 1)).dump();
+                break;
+            case String:
+                Escape(StringAt(i), out);
+                break;
+            case Array: {
+                out += '[';
+                for (std::size_t j = i + 1, end = Payload(i); j < end; j = Next(j)) {
+                    out += j > i + 1 ? "," : "";
+                    Serialize(j, out, keys);
+                }
+                out += ']';
+                break;
+            }
+            default: {
+                // members are stored by key id, JSON text lists them by name
+                std::vector<std::pair<const std::string *, std::size_t>> members;
+                for (std::size_t j = i + 1, end = Payload(i); j < end; j = Next(j + 1)) {
+                    members.emplace_back(&keys.Key(static_cast<std::uint32_t>(Payload(j))), j + 1);
+                }
+                std::sort(members.begin(), members.end(),
+                          [](const auto &a, const auto &b) { return *a.first < *b.first; });
+                out += '{';
+                for (const auto &member : members) {
+                    out += out.back() == '{' ? "" : ",";
+                    Escape(*member.first, out);
+                    out += ':';
+                    Serialize(member.second, out, keys);
+                }
+                out += '}';
+            }
+        }
+    }
+
+   private:
+    void Push(Type type, std::uint64_t payload = 0) {
+        tape.push_back(static_cast<std::uint64_t>(type) << 56 | payload);
+    }
+
+    template <class T>
+    void PushBits(Type type, T value) {
+        Push(type);
+        tape.emplace_back();
+        std::memcpy(&tape.back(), &value, sizeof(value));
+    }
+
+    bool Encode(const nlohmann::json &value, KeyDictionary &keys) {
+        switch (value.type()) {
+            case nlohmann::json::value_t::null:
+                Push(Null);
+                return true;
+            case nlohmann::json::value_t::boolean:
+                Push(value.get<bool>() ? True : False);
+                return true;
+            case nlohmann::json::value_t::number_integer:
+                PushBits(Integer, value.get<std::int64_t>());
+                return true;
+            case nlohmann::json::value_t::number_unsigned:
+                PushBits(Unsigned, value.get<std::uint64_t>());
+                return true;
+            case nlohmann::json::value_t::number_float:
+                PushBits(Float, value.get<double>());
+                return true;
+            case nlohmann::json::value_t::string: {
+                const std::string &text = value.get_ref<const std::string &>();
+                Push(String, text.size());
+                std::size_t begin = tape.size();
+                tape.resize(begin + (text.size() + 7) / 8);
+                if (!text.empty()) {
+                    std::memcpy(&tape[begin], text.data(), text.size());
+                }
+                return true;
+            }
+            case nlohmann::json::value_t::array: {
+                std::size_t header = tape.size();
+                Push(Array);
+                for (const auto &item : value) {
+                    if (!Encode(item, keys)) {
+                        return false;
+                    }
+                }
+                tape[header] |= tape.size();
+                return true;
+            }
+            case nlohmann::json::value_t::object: {
+                std::vector<std::pair<std::uint32_t, const nlohmann::json *>> members;
+                members.reserve(value.size());
+                for (auto it = value.begin(); it != value.end(); ++it) {
+                    members.emplace_back(keys.Intern(it.key()), &it.value());
+                }
+                std::sort(members.begin(), members.end(),
+                          [](const auto &a, const auto &b) { return a.first < b.first; });
+                std::size_t header = tape.size();
+                Push(Object);
+                for (const auto &member : members) {
+                    Push(Key, member.first);
+                    if (!Encode(*member.second, keys)) {
+                        return false;
+                    }
+                }
+                tape[header] |= tape.size();
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    std::vector<std::uint64_t> tape;
+    nlohmann::json other;
+};
+
+bool is_string_operator(const std::string &op) {
+    return op == "$prefix" || op == "$contains" || op == "$regex";
+}
+
+// Evaluates a string operator, "$regex" with the pattern compiled by the
+// caller when it passes one.
+bool match_string(const std::string &op, std::string_view value, const std::string &pattern,
+                  const std::regex *compiled = nullptr) {
+    if (op == "$prefix") {
+        return value.substr(0, pattern.size()) == pattern;
+    }
+    if (op == "$contains") {
+        return value.find(pattern) != std::string_view::npos;
+    }
+    if (compiled != nullptr) {
+        return std::regex_search(value.begin(), value.end(), *compiled);
+    }
+    return std::regex_search(value.begin(), value.end(), std::regex(pattern));
+}
+
+// Trigrams of a string, sorted and without duplicates.
+std::vector<std::uint32_t> trigrams(std::string_view text) {
+    std::vector<std::uint32_t> result;
+    for (std::size_t i = 0; i + 3 <= text.size(); i++) {
+        result.push_back(static_cast<std::uint32_t>(static_cast<unsigned char>(text[i])) << 16 |
+                         static_cast<std::uint32_t>(static_cast<unsigned char>(text[i + 1])) << 8 |
+                         static_cast<unsigned char>(text[i + 2]));
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// Length of the alphanumeric escape of an ECMAScript pattern starting
+// at `pos`, right after the backslash, or 0 when it is not understood.
+std::size_t escape_length(const std::string &pattern, std::size_t pos) {
+    auto count = [&](std::size_t from, std::size_t limit, bool (*accept)(int)) {
+        std::size_t n = 0;
+        while (n < limit && from + n < pattern.size() && accept(static_cast<unsigned char>(pattern[from + n]))) {
+            n++;
+        }
+        return n;
+    };
+    auto hex = [](int ch) { return std::isxdigit(ch) != 0; };
+    auto alpha = [](int ch) { return std::isalpha(ch) != 0; };
+    auto digit = [](int ch) { return std::isdigit(ch) != 0; };
+    const char c = pattern[pos];
+    switch (c) {
+        case 'd': case 'D': case 'w': case 'W': case 's': case 'S': case 'b': case 'B':
+        case 'f': case 'n': case 'r': case 't': case 'v':
+            return 1;
+        case 'x':
+            return count(pos + 1, 2, hex) == 2 ? 3 : 0;
+        case 'u':
+            return count(pos + 1, 4, hex) == 4 ? 5 : 0;
+        case 'c':
+            return count(pos + 1, 1, alpha) == 1 ? 2 : 0;
+        case 'k': {
+            std::size_t end = pattern.find('>', pos);
+            return pos + 1 < pattern.size() && pattern[pos + 1] == '<' && end != std::string::npos ? end - pos + 1 : 0;
+        }
+        default:
+            // NUL and back references
+            return count(pos, std::string::npos, digit);
+    }
+}
+
+// Literal strings every match of an ECMAScript pattern contains. The
+// analysis is conservative: text inside groups or made optional by a
+// quantifier is skipped, and a top-level alternation or an escape it does
+// not know yields nothing.
+std::vector<std::string> regex_literals(const std::string &pattern) {
+    std::vector<std::string> literals;
+    std::string run;
+    auto flush = [&] {
+        if (!run.empty()) {
+            literals.push_back(std::move(run));
+            run.clear();
+        }
+    };
+    int depth = 0;
+    for (std::size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        if (c == '\\') {
+            if (i + 1 < pattern.size() && !std::isalnum(static_cast<unsigned char>(pattern[i + 1]))) {
+                if (depth == 0) {
+                    run += pattern[++i];
+                } else {
+                    i++;
+                }
+            } else if (i + 1 < pattern.size()) {
+                // character classes, anchors and control escapes match
+                // something else than their text, so the escape ends the run
+                std::size_t length = escape_length(pattern, i + 1);
+                if (length == 0) {
+                    return {};
+                }
+                i += length;
+                flush();
+            }
+        } else if (c == '|' && depth == 0) {
+            return {};
+        } else if (c == '(' || c == ')') {
+            depth += c == '(' ? 1 : -1;
+            flush();
+        } else if (c == '[') {
+            for (i++; i < pattern.size() && pattern[i] != ']'; i++) {
+                i += pattern[i] == '\\' ? 1 : 0;
+            }
+            flush();
+        } else if (c == '*' || c == '?' || c == '{') {
+            // the previous character may be absent
+            if (!run.empty()) {
+                run.pop_back();
+            }
+            flush();
+            while (c == '{' && i < pattern.size() && pattern[i] != '}') {
+                i++;
+            }
+        } else if (c == '+' || c == '.' || c == '^' || c == '$') {
+            flush();
+        } else if (depth == 0) {
+            run += c;
+        }
+    }
+    flush();
+    return literals;
+}
+
+// Query with its columns resolved against a table dictionary once and its
+// statements decoded once, so that matching a resident document compares
+// key ids and evaluates the common comparisons directly on the tape.
+// Anything else goes through `generic_comparator` on the materialized
+// value, and queries `match_query` would not read as columns of
+// statements are left to it entirely.
+class Matcher {
+   public:
+    Matcher(const nlohmann::json &query, const KeyDictionary &keys) : query(query) {
+        nlohmann::json emptyQuery = {};
+        if (emptyQuery == query || query.is_null()) {
+            all = true;
+            return;
+        }
+        fallback = !query.is_object();
+        for (auto q = query.begin(); !fallback && q != query.end(); ++q) {
+            fallback = !q.value().is_object();
+            Column column{keys.Find(q.key()), {}};
+            never = never || column.key == KeyDictionary::npos;
+            for (auto s = q.value().begin(); !fallback && s != q.value().end(); ++s) {
+                column.statements.push_back(Decode(s.key(), s.value()));
+            }
+            columns.push_back(std::move(column));
+        }
+    }
+
+    // True when the query names a field missing from every document.
+    bool Never() const { return never && !fallback && !all; }
+
+    bool Matches(const Document &document, const KeyDictionary &keys) const {
+        if (all) {
+            return true;
+        }
+        if (fallback) {
+            return match_query(document.Json(keys), query);
+        }
+        if (never) {
+            return false;
+        }
+        for (const auto &column : columns) {
+            std::size_t value = document.Find(column.key);
+            if (value == 0) {
+                return false;
+            }
+            for (const auto &statement : column.statements) {
+                if (!Evaluate(statement, document, value, keys)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+   private:
+    enum class Op { Eq, Gt, Gte, Lt, Lte, String, Other };
+
+    struct Statement {
+        Op op;
+        const std::string *name;
+        const nlohmann::json *value;
+        std::shared_ptr<const std::regex> regex;
+    };
+
+    struct Column {
+        std::uint32_t key;
+        std::vector<Statement> statements;
+    };
+
+    static Statement Decode(const std::string &name, const nlohmann::json &value) {
+        Op op = name == "$eq"    ? Op::Eq
+                : name == "$gt"  ? Op::Gt
+                : name == "$gte" ? Op::Gte
+                : name == "$lt"  ? Op::Lt
+                : name == "$lte" ? Op::Lte
+                : is_string_operator(name) ? Op::String
+                                 : Op::Other;
+        std::shared_ptr<const std::regex> regex;
+        if (name == "$regex" && value.is_string()) {
+            regex = std::make_shared<const std::regex>(value.get_ref<const std::string &>());
+        }
+        return {op, &name, &value, std::move(regex)};
+    }
+
+    template <class T>
+    static bool Apply(Op op, const T &a, const T &b) {
+        switch (op) {
+            case Op::Eq:
+                return a == b;
+            case Op::Gt:
+                return a > b;
+            case Op::Gte:
+                return a >= b;
+            case Op::Lt:
+                return a < b;
+            default:
+                return a <= b;
+        }
+    }
+
+    static bool Evaluate(const Statement &statement, const Document &document, std::size_t value,
+                         const KeyDictionary &keys) {
+        const nlohmann::json &operand = *statement.value;
+        if (statement.op == Op::String) {
+            return document.TypeAt(value) == Document::String && operand.is_string() &&
+                   match_string(*statement.name, document.StringAt(value),
+                                operand.get_ref<const std::string &>(), statement.regex.get());
+        }
+        if (statement.op != Op::Other) {
+            switch (document.TypeAt(value)) {
+                case Document::String:
+                    if (operand.is_string()) {
+                        return Apply(statement.op, document.StringAt(value),
+                                     std::string_view(operand.get_ref<const std::string &>()));
+                    }
+                    break;
+                case Document::Integer:
+                case Document::Unsigned:
+                case Document::Float:
+                    if (operand.is_number()) {
+                        return Apply(statement.op, document.FloatAt(value), operand.get<float>());
+                    }
+                    break;
+                case Document::True:
+                case Document::False:
+                    if (operand.is_boolean()) {
+                        return Apply(statement.op, document.TypeAt(value) == Document::True, operand.get<bool>());
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        try {
+            return generic_comparator(*statement.name, document.Materialize<nlohmann::json>(value, keys), operand);
+        } catch (std::exception &e) {
+            std::cerr << "Error in comparison: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    const nlohmann::json &query;
+    bool all = false;
+    bool never = false;
+    bool fallback = false;
+    std::vector<Column> columns;
+};
+
+// Documents of a table by position, in fixed-size chunks shared by the
+// snapshots of the table. Copying the store copies one pointer per chunk,
+// and a write copies only the chunk it changes, so a single-document write
+// does not pay for the size of the table.
+class DocumentStore {
+   public:
+    using Pointer = std::shared_ptr<const Document>;
+    static constexpr std::size_t CHUNK_BITS = 10;
+    static constexpr std::size_t CHUNK_SIZE = std::size_t(1) << CHUNK_BITS;
+
+    class const_iterator {
+       public:
+        const_iterator(const DocumentStore &store, std::size_t pos) : store(&store), pos(pos) {}
+        const Pointer &operator*() const { return (*store)[pos]; }
+        const_iterator &operator++() {
+            pos++;
+            return *this;
+        }
+        bool operator!=(const const_iterator &other) const { return pos != other.pos; }
+
+       private:
+        const DocumentStore *store;
+        std::size_t pos;
+    };
+
+    std::size_t size() const { return count; }
+    const_iterator begin() const { return const_iterator(*this, 0); }
+    const_iterator end() const { return const_iterator(*this, count); }
+
+    const Pointer &operator[](std::size_t pos) const {
+        return (*chunks[pos >> CHUNK_BITS])[pos & (CHUNK_SIZE - 1)];
+    }
+
+    const Pointer &at(std::size_t pos) const {
+        if (pos >= count) {
+            throw std::out_of_range("No document at position " + std::to_string(pos));
+        }
+        return (*this)[pos];
+    }
+
+    void Set(std::size_t pos, Pointer document) {
+        at(pos);
+        Writable(pos >> CHUNK_BITS)[pos & (CHUNK_SIZE - 1)] = std::move(document);
+    }
+
+    void push_back(Pointer document) {
+        if ((count & (CHUNK_SIZE - 1)) == 0) {
+            chunks.push_back(std::make_shared<Chunk>());
+            chunks.back()->reserve(CHUNK_SIZE);
+        }
+        Writable(count >> CHUNK_BITS).push_back(std::move(document));
+        count++;
+    }
+
+    void reserve(std::size_t size) { chunks.reserve((size + CHUNK_SIZE - 1) >> CHUNK_BITS); }
+
+   private:
+    using Chunk = std::vector<Pointer>;
+
+    // A chunk only this store holds, copied first if a snapshot shares it.
+    // Other holders only ever get a chunk by copying a store, so a count of
+    // one cannot grow while this store is being written.
+    Chunk &Writable(std::size_t chunk) {
+        std::shared_ptr<Chunk> &held = chunks[chunk];
+        if (held.use_count() > 1) {
+            auto copy = std::make_shared<Chunk>();
+            copy->reserve(CHUNK_SIZE);
+            copy->assign(held->begin(), held->end());
+            held = std::move(copy);
+        }
+        return *held;
+    }
+
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    std::size_t count = 0;
+};
+
+struct TableData {
+    TableOptions options;
+    // documents by position, deleted ones are null until the next compaction
+    DocumentStore documents;
+    std::shared_ptr<KeyDictionary> keys = std::make_shared<KeyDictionary>();
+    std::size_t live = 0;
+    std::int64_t lastId = 0;
+    std::shared_ptr<IdIndex> ids = std::make_shared<IdIndex>();
+    std::shared_ptr<TextIndex> text = std::make_shared<TextIndex>();
+    // index files, the text ones in the order of `options.textIndexes`
+    std::string idsFile;
+    std::vector<std::string> textFiles;
+    FileStamp stamp;
+    // checksum of the table file, and whether the journal on disk was
+    // written for another one and has to start over
+    std::uint64_t fileChecksum = 0;
+    bool journalStale = false;
+
+    std::size_t Dead() const { return documents.size() - live; }
+
+    nlohmann::json Json(std::size_t pos) const { return documents[pos]->Json(*keys); }
+
+    bool Matches(std::size_t pos, const Matcher &matcher) const {
+        return documents[pos] && matcher.Matches(*documents[pos], *keys);
+    }
+
+    std::shared_ptr<const Document> Make(nlohmann::json document) const {
+        return std::make_shared<const Document>(std::move(document), *keys);
+    }
+
+    // Primary key of a resident document, null when it has none.
+    nlohmann::json Key(const Document &document) const {
+        std::size_t value = options.primaryKey.empty() ? 0 : document.Find(keys->Find(options.primaryKey));
+        return value == 0 ? nlohmann::json() : document.Materialize<nlohmann::json>(value, *keys);
+    }
+
+    const nlohmann::json *Key(const nlohmann::json &document) const {
+        if (options.primaryKey.empty() || !document.is_object()) {
+            return nullptr;
+        }
+        auto field = document.find(options.primaryKey);
+        return field == document.end() ? nullptr : &*field;
+    }
+
+    void Index(std::size_t pos) {
+        IndexKey(pos);
+        IndexText(pos);
+    }
+
+    void IndexKey(std::size_t pos) {
+        nlohmann::json id = Key(*documents[pos]);
+        if (id.is_null()) {
+            return;
+        }
+        if (id.is_number_integer() && id.get<std::int64_t>() > lastId) {
+            lastId = id.get<std::int64_t>();
+        }
+        std::unique_lock<std::shared_mutex> lock(ids->mutex);
+        ids->positions[id.dump()].push_back(pos);
+    }
+
+    void IndexText(std::size_t pos) {
+        if (options.textIndexes.empty() || !documents[pos]) {
+            return;
+        }
+        const Document &document = *documents[pos];
+        std::vector<std::pair<const std::string *, std::vector<std::uint32_t>>> values;
+        for (const auto &field : options.textIndexes) {
+            std::uint32_t key = keys->Find(field);
+            std::size_t value = key == KeyDictionary::npos ? 0 : document.Find(key);
+            if (value != 0 && document.TypeAt(value) == Document::String) {
+                values.emplace_back(&field, trigrams(document.StringAt(value)));
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(text->mutex);
+        for (const auto &value : values) {
+            auto &postings = text->fields[*value.first].added;
+            for (std::uint32_t trigram : value.second) {
+                postings[trigram].push_back(pos);
+            }
+        }
+    }
+
+    void Replace(std::size_t pos, std::shared_ptr<const Document> document) {
+        documents.Set(pos, std::move(document));
+        IndexText(pos);
+    }
+
+    void Add(nlohmann::json document) {
+        documents.push_back(Make(std::move(document)));
+        live++;
+        Index(documents.size() - 1);
+    }
+
+    void Remove(std::size_t pos) {
+        if (documents.at(pos)) {
+            documents.Set(pos, nullptr);
+            live--;
+        }
+    }
+
+    // Position of the live document with the given primary key, or -1.
+    std::ptrdiff_t Find(const nlohmann::json &id) const {
+        const std::string key = id.dump();
+        auto holds = [&](std::size_t pos) {
+            return pos < documents.size() && documents[pos] && Key(*documents[pos]) == id;
+        };
+        std::shared_lock<std::shared_mutex> lock(ids->mutex);
+        auto it = ids->positions.find(key);
+        if (it != ids->positions.end()) {
+            for (auto pos = it->second.rbegin(); pos != it->second.rend(); ++pos) {
+                if (holds(*pos)) {
+                    return static_cast<std::ptrdiff_t>(*pos);
+                }
+            }
+        }
+        if (ids->base) {
+            auto entries = key_entries(*ids->base);
+            const std::uint64_t hash = fnv1a(key);
+            auto entry = std::lower_bound(entries.first, entries.second, hash,
+                                          [](const KeyEntry &a, std::uint64_t b) { return a.hash < b; });
+            for (; entry != entries.second && entry->hash == hash; ++entry) {
+                if (holds(entry->position)) {
+                    return static_cast<std::ptrdiff_t>(entry->position);
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Sorted positions of the live documents whose `field` may hold every
+    // trigram of `grams`, rarest trigram first so the intersection shrinks
+    // quickly.
+    std::vector<std::size_t> TextCandidates(const std::string &field,
+                                            const std::vector<std::uint32_t> &grams) const {
+        struct List {
+            std::pair<const std::uint32_t *, const std::uint32_t *> base;
+            const std::vector<std::size_t> *added;
+
+            std::size_t Size() const {
+                return static_cast<std::size_t>(base.second - base.first) + (added ? added->size() : 0);
+            }
+        };
+        std::vector<std::size_t> result;
+        std::shared_lock<std::shared_mutex> lock(text->mutex);
+        auto postings = text->fields.find(field);
+        if (postings == text->fields.end()) {
+            return result;
+        }
+        std::vector<List> lists;
+        for (std::uint32_t trigram : grams) {
+            List list{{nullptr, nullptr}, nullptr};
+            if (postings->second.base) {
+                list.base = text_postings(*postings->second.base, trigram);
+            }
+            auto added = postings->second.added.find(trigram);
+            if (added != postings->second.added.end()) {
+                list.added = &added->second;
+            }
+            if (list.Size() == 0) {
+                return result;
+            }
+            lists.push_back(list);
+        }
+        std::sort(lists.begin(), lists.end(), [](const List &a, const List &b) { return a.Size() < b.Size(); });
+        auto live = [this](std::size_t pos) { return pos < documents.size() && documents[pos]; };
+        for (std::size_t i = 0; i < lists.size(); i++) {
+            std::vector<std::size_t> positions;
+            for (const std::uint32_t *pos = lists[i].base.first; pos != lists[i].base.second; ++pos) {
+                if (live(*pos)) {
+                    positions.push_back(*pos);
+                }
+            }
+            for (std::size_t j = 0; lists[i].added && j < lists[i].added->size(); j++) {
+                if (live((*lists[i].added)[j])) {
+                    positions.push_back((*lists[i].added)[j]);
+                }
+            }
+            std::sort(positions.begin(), positions.end());
+            positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+            if (i > 0) {
+                std::vector<std::size_t> both;
+                std::set_intersection(result.begin(), result.end(), positions.begin(), positions.end(),
+                                      std::back_inserter(both));
+                positions = std::move(both);
+            }
+            result = std::move(positions);
+            if (result.empty()) {
+                break;
+            }
+        }
+        return result;
+    }
+};
+
+// How a query reaches its candidate documents: every position of the
+// table, the positions of the primary keys it asks for with "$eq" or
+// "$in", the documents holding the trigrams of the text its string
+// operators require on fields with a text index, or none at all when it
+// names a field no document has. The candidates are still checked against
+// the whole query; the seek compares keys exactly, and only string and
+// integer keys are looked up.
+struct QueryPlan {
+    enum Type { FullScan, IdSeek, TextSeek, Empty };
+
+    QueryPlan(const TableData &data, const nlohmann::json &query, const Matcher &matcher) {
+        if (matcher.Never()) {
+            type = Empty;
+            return;
+        }
+        if (!SeekIds(data, query)) {
+            SeekText(data, query);
+        }
+    }
+
+    bool SeekIds(const TableData &data, const nlohmann::json &query) {
+        const nlohmann::json *condition = data.Key(query);
+        if (condition == nullptr || !condition->is_object()) {
+            return false;
+        }
+        std::vector<const nlohmann::json *> ids;
+        auto eq = condition->find("$eq");
+        auto in = condition->find("$in");
+        if (eq != condition->end()) {
+            ids.push_back(&*eq);
+        } else if (in != condition->end() && in->is_array()) {
+            for (const auto &id : *in) {
+                ids.push_back(&id);
+            }
+        }
+        if (ids.empty()) {
+            return false;
+        }
+        for (const auto *id : ids) {
+            if (!id->is_string() && !id->is_number_integer()) {
+                return false;
+            }
+        }
+        type = IdSeek;
+        index = data.options.primaryKey;
+        for (const auto *id : ids) {
+            std::ptrdiff_t pos = data.Find(*id);
+            if (pos >= 0) {
+                positions.push_back(static_cast<std::size_t>(pos));
+            }
+        }
+        std::sort(positions.begin(), positions.end());
+        positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+        return true;
+    }
+
+    void SeekText(const TableData &data, const nlohmann::json &query) {
+        if (data.options.textIndexes.empty() || !query.is_object()) {
+            return;
+        }
+        for (const auto &field : data.options.textIndexes) {
+            auto condition = query.find(field);
+            if (condition == query.end() || !condition->is_object()) {
+                continue;
+            }
+            std::vector<std::uint32_t> grams;
+            for (auto s = condition->begin(); s != condition->end(); ++s) {
+                if (!is_string_operator(s.key()) || !s.value().is_string()) {
+                    continue;
+                }
+                const std::string &pattern = s.value().get_ref<const std::string &>();
+                for (const auto &literal :
+                     s.key() == "$regex" ? regex_literals(pattern) : std::vector<std::string>{pattern}) {
+                    std::vector<std::uint32_t> more = trigrams(literal);
+                    grams.insert(grams.end(), more.begin(), more.end());
+                }
+            }
+            if (grams.empty()) {
+                continue;
+            }
+            std::sort(grams.begin(), grams.end());
+            grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+            std::vector<std::size_t> found = data.TextCandidates(field, grams);
+            if (type == TextSeek) {
+                std::vector<std::size_t> both;
+                std::set_intersection(positions.begin(), positions.end(), found.begin(), found.end(),
+                                      std::back_inserter(both));
+                found = std::move(both);
+            } else {
+                type = TextSeek;
+                index = field;
+            }
+            positions = std::move(found);
+        }
+    }
+
+    const char *Name() const {
+        return type == IdSeek ? "idSeek" : type == TextSeek ? "textSeek" : type == Empty ? "empty" : "fullScan";
+    }
+
+    // Number of documents the plan examines at most.
+    std::size_t Candidates(const TableData &data) const {
+        return type == IdSeek || type == TextSeek ? positions.size() : type == Empty ? 0 : data.documents.size();
+    }
+
+    // Visits the candidates in table order until `visit` returns false,
+    // returns the number of candidates visited.
+    template <class Visit>
+    std::size_t Scan(const TableData &data, Visit &&visit) const {
+        std::size_t visited = 0;
+        if (type == IdSeek || type == TextSeek) {
+            for (std::size_t pos : positions) {
+                visited++;
+                if (!visit(pos)) {
+                    break;
+                }
+            }
+        } else if (type == FullScan) {
+            for (std::size_t pos = 0; pos < data.documents.size(); pos++) {
+                visited++;
+                if (!visit(pos)) {
+                    break;
+                }
+            }
+        }
+        return visited;
+    }
+
+    Type type = FullScan;
+    // field of the index used by a seek
+    std::string index;
+    std::vector<std::size_t> positions;
+};
+
+// Bounded ring of the last changes of a table. Writers are serialized by
+// the table writer lock, so there is a single producer at a time. Every slot
+// has its own mutex, held only to swap or copy its event pointer, so a
+// reader waits at most for the writer replacing the slot it reads; readers
+// detect overwritten slots by their sequence number.
+class ChangeRing {
+   public:
+    explicit ChangeRing(std::size_t capacity) : ring(std::make_shared<Ring>(capacity)) {}
+
+    void Resize(std::size_t capacity) {
+        auto resized = std::make_shared<Ring>(capacity);
+        std::lock_guard<std::mutex> lock(ringMutex);
+        ring = std::move(resized);
+    }
+
+    std::uint64_t Last() const { return last.load(std::memory_order_acquire); }
+
+    void Push(ChangeEvent event) {
+        std::shared_ptr<Ring> current = Current();
+        event.sequence = last.load(std::memory_order_relaxed) + 1;
+        if (current->size > 0) {
+            auto stored = std::make_shared<const ChangeEvent>(std::move(event));
+            Slot &slot = current->slots[stored->sequence % current->size];
+            std::lock_guard<std::mutex> lock(slot.mutex);
+            slot.event.swap(stored);
+        }
+        last.fetch_add(1, std::memory_order_release);
+    }
+
+    bool Read(std::uint64_t after, std::vector<ChangeEvent> &events, std::size_t maxEvents) const {
+        std::shared_ptr<Ring> current = Current();
+        std::uint64_t newest = Last();
+        std::uint64_t oldest = newest >= current->size ? newest - current->size + 1 : 1;
+        bool complete = after + 1 >= oldest;
+        for (std::uint64_t seq = std::max(after + 1, oldest); seq <= newest && events.size() < maxEvents; seq++) {
+            std::shared_ptr<const ChangeEvent> event;
+            {
+                Slot &slot = current->slots[seq % current->size];
+                std::lock_guard<std::mutex> lock(slot.mutex);
+                event = slot.event;
+            }
+            if (!event || event->sequence != seq) {
+                // overwritten by a writer while reading
+                complete = false;
+                continue;
+            }
+            events.push_back(*event);
+        }
+        return complete;
+    }
+
+   private:
+    struct Slot {
+        std::mutex mutex;
+        std::shared_ptr<const ChangeEvent> event;
+    };
+    struct Ring {
+        explicit Ring(std::size_t size) : size(size), slots(new Slot[size]) {}
+        std::size_t size;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    std::shared_ptr<Ring> Current() const {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        return ring;
+    }
+
+    // only guards the swap of the ring on resize
+    mutable std::mutex ringMutex;
+    std::shared_ptr<Ring> ring;
+    std::atomic<std::uint64_t> last{0};
+};
+
+class SlowLog;
+
+struct TableState {
+    std::atomic<std::uint64_t> version{0};
+    QueryCache cache;
+    // serializes writers so read-modify-write operations are atomic
+    std::mutex writeMutex;
+    // readers share it while reading the table files, compaction takes it
+    // exclusively only to swap the table file and the journal
+    std::shared_mutex filesMutex;
+    std::atomic<double> compactionThreshold{0.5};
+    // set while an automatic compaction waits on the executor
+    std::atomic<bool> compactionQueued{false};
+    // last loaded or written version of the table, never modified in place
+    std::mutex snapshotMutex;
+    // held while loading the table files
+    std::mutex loadMutex;
+    std::shared_ptr<const TableData> snapshot;
+    ChangeRing changes{1024};
+    std::mutex watchMutex;
+    int lastWatch = 0;
+    std::map<int, std::pair<nlohmann::json, ChangeCallback>> watchers;
+    // reads queued on the executor, by cache key, with the promises of the
+    // callers sharing them; the task fulfils the list it was queued with
+    struct PendingRead {
+        std::uint64_t version;
+        std::shared_ptr<std::vector<std::promise<nlohmann::json>>> waiters;
+    };
+    std::mutex pendingMutex;
+    std::unordered_map<std::string, PendingRead> pending;
+    // checked first so a disabled slow-operation log costs a relaxed load
+    std::atomic<bool> slowLogEnabled{false};
+    std::shared_ptr<SlowLog> slowLog;
+
+    void Reset() {
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        snapshot.reset();
+    }
+};
+
+// Log-linear histogram in the style of HdrHistogram: values are bucketed by
+// power of two, each split in 16 linear sub-buckets, which bounds the error
+// of a percentile to 1/16 of its value with fixed memory and lock-free
+// updates.
+class Histogram {
+   public:
+    void Record(std::uint64_t value) {
+        counts[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        std::uint64_t seen = max.load(std::memory_order_relaxed);
+        while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::uint64_t Count() const { return total.load(std::memory_order_relaxed); }
+
+    nlohmann::json Summary(double scale) const {
+        std::uint64_t count = Count();
+        nlohmann::json summary = {{"count", count},
+                                  {"mean", count ? sum.load(std::memory_order_relaxed) / scale / count : 0.0},
+                                  {"max", max.load(std::memory_order_relaxed) / scale}};
+        for (const auto &percentile : {std::make_pair("p50", 0.5), std::make_pair("p90", 0.9),
+                                       std::make_pair("p99", 0.99), std::make_pair("p999", 0.999)}) {
+            summary[percentile.first] = Percentile(percentile.second) / scale;
+        }
+        return summary;
+    }
+
+   private:
+    static constexpr int subBits = 4;
+    static constexpr std::size_t subBuckets = 1 << subBits;
+    static constexpr std::size_t buckets = (64 - subBits + 1) * subBuckets;
+
+    static std::size_t Bucket(std::uint64_t value) {
+        if (value < subBuckets) {
+            return static_cast<std::size_t>(value);
+        }
+        int shift = 0;
+        while (value >> (shift + subBits + 1)) {
+            shift++;
+        }
+        return (shift + 1) * subBuckets + ((value >> shift) & (subBuckets - 1));
+    }
+
+    // Highest value of a bucket, so percentiles are never underestimated.
+    static std::uint64_t Highest(std::size_t bucket) {
+        if (bucket < subBuckets) {
+            return bucket;
+        }
+        std::size_t shift = bucket / subBuckets - 1;
+        return ((subBuckets + bucket % subBuckets + 1) << shift) - 1;
+    }
+
+    std::uint64_t Percentile(double fraction) const {
+        std::uint64_t count = Count();
+        if (count == 0) {
+            return 0;
+        }
+        std::uint64_t rank = static_cast<std::uint64_t>(fraction * (count - 1)) + 1;
+        std::uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < buckets; bucket++) {
+            seen += counts[bucket].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return std::min(Highest(bucket), max.load(std::memory_order_relaxed));
+            }
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<std::uint64_t> counts[buckets] = {};
+    std::atomic<std::uint64_t> total{0};
+    std::atomic<std::uint64_t> sum{0};
+    std::atomic<std::uint64_t> max{0};
+};
+
+enum class Operation {
+    DatabaseCreate,
+    DatabaseDrop,
+    Tables,
+    TableCreate,
+    TableDrop,
+    InsertDocument,
+    FindDocument,
+    FindDocuments,
+    UpdateDocument,
+    UpdateDocuments,
+    DeleteDocument,
+    DeleteDocuments,
+    GetById,
+    GetByIds,
+    UpdateById,
+    DeleteById,
+    Upsert,
+    FindOneAndUpdate,
+    Compact,
+    Load,
+    Commit,
+    Import,
+    Export,
+    Snapshot,
+    Join,
+    Count
+};
+
+const char *const OPERATION_NAMES[] = {
+    "JsonDB::Create",         "JsonDB::Drop",           "JsonDB::Tables",          "Table::Create",
+    "Table::Drop",            "Table::InsertDocument",  "Table::FindDocument",     "Table::FindDocuments",
+    "Table::UpdateDocument",  "Table::UpdateDocuments", "Table::DeleteDocument",   "Table::DeleteDocuments",
+    "Table::GetById",         "Table::GetByIds",        "Table::UpdateById",       "Table::DeleteById",
+    "Table::Upsert",          "Table::FindOneAndUpdate", "Table::Compact",         "Table::Load",
+    "Transaction::Commit",    "Table::Import",          "Table::Export",           "JsonDB::Snapshot",
+    "JsonDB::Join"};
+
+// Counters of a database, updated with relaxed atomics on the hot paths.
+struct Metrics {
+    Histogram latency[static_cast<std::size_t>(Operation::Count)];
+    std::atomic<std::uint64_t> bytesRead{0};
+    std::atomic<std::uint64_t> bytesWritten{0};
+    std::atomic<std::uint64_t> documentsScanned{0};
+    std::atomic<std::uint64_t> documentsReturned{0};
+    std::atomic<std::uint64_t> parseNanos{0};
+    std::atomic<std::uint64_t> serializeNanos{0};
+};
+
+// Adds the time spent in a scope to a histogram or a counter.
+class ScopeTimer {
+   public:
+    explicit ScopeTimer(Histogram &histogram) : histogram(&histogram), start(Now()) {}
+    explicit ScopeTimer(std::atomic<std::uint64_t> &counter) : counter(&counter), start(Now()) {}
+
+    ~ScopeTimer() {
+        std::uint64_t elapsed = Now() - start;
+        if (histogram != nullptr) {
+            histogram->Record(elapsed);
+        } else {
+            counter->fetch_add(elapsed, std::memory_order_relaxed);
+        }
+    }
+
+   private:
+    static std::uint64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    Histogram *histogram = nullptr;
+    std::atomic<std::uint64_t> *counter = nullptr;
+    std::uint64_t start;
+};
+
+#ifdef JSONDB_METRICS
+#define JSONDB_MEASURE(state, operation) \
+    ScopeTimer operationTimer((state).metrics.latency[static_cast<std::size_t>(operation)])
+#define JSONDB_TIME(state, counter) ScopeTimer counter##Timer((state).metrics.counter)
+#define JSONDB_COUNT(state, counter, amount) \
+    (state).metrics.counter.fetch_add((amount), std::memory_order_relaxed)
+#else
+#define JSONDB_MEASURE(state, operation) static_cast<void>(0)
+#define JSONDB_TIME(state, counter) static_cast<void>(0)
+#define JSONDB_COUNT(state, counter, amount) static_cast<void>(0)
+#endif
+
+// Query with every literal replaced by "?", so that queries of the same
+// shape read the same in a log.
+nlohmann::json normalize_query(const nlohmann::json &query) {
+    if (query.is_null()) {
+        return query;
+    }
+    if (!query.is_object()) {
+        return "?";
+    }
+    nlohmann::json normalized = nlohmann::json::object();
+    for (auto q = query.begin(); q != query.end(); ++q) {
+        normalized[q.key()] = normalize_query(q.value());
+    }
+    return normalized;
+}
+
+// Destinations of the slow-operation log of a table. The file is appended
+// to under a mutex and rotated by renaming once it reaches its size cap.
+class SlowLog {
+   public:
+    explicit SlowLog(SlowLogOptions options) : options(std::move(options)) {}
+
+    double Threshold() const { return options.thresholdUs; }
+
+    bool Sample() const {
+        if (options.sampleRate <= 0) {
+            return false;
+        }
+        thread_local std::minstd_rand generator(std::random_device{}());
+        return std::uniform_real_distribution<double>(0, 1)(generator) < options.sampleRate;
+    }
+
+    void Record(const SlowOperation &operation) {
+        if (options.callback) {
+            options.callback(operation);
+        }
+        if (options.path.empty()) {
+            return;
+        }
+        const std::string line = nlohmann::json({{"time", std::time(nullptr)},
+                                                 {"operation", operation.operation},
+                                                 {"table", operation.table},
+                                                 {"query", operation.query},
+                                                 {"plan", operation.plan},
+                                                 {"documentsScanned", operation.documentsScanned},
+                                                 {"durationUs", operation.durationUs},
+                                                 {"sampled", operation.sampled}})
+                                     .dump() +
+                                 "\n";
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!out.is_open()) {
+            std::error_code error;
+            std::uintmax_t existing = std::filesystem::file_size(options.path, error);
+            size = error ? 0 : static_cast<std::size_t>(existing);
+            out.open(options.path, std::ios::app);
+        }
+        if (size > 0 && size + line.size() > options.maxFileBytes) {
+            Rotate();
+        }
+        out << line;
+        out.flush();
+        size += line.size();
+    }
+
+   private:
+    void Rotate() {
+        out.close();
+        std::error_code error;
+        const std::string &path = options.path;
+        if (options.maxFiles > 0) {
+            std::filesystem::remove(path + "." + std::to_string(options.maxFiles), error);
+            for (std::size_t i = options.maxFiles; i > 1; i--) {
+                std::filesystem::rename(path + "." + std::to_string(i - 1), path + "." + std::to_string(i), error);
+            }
+            std::filesystem::rename(path, path + ".1", error);
+        }
+        out.open(path, std::ios::trunc);
+        size = 0;
+    }
+
+    const SlowLogOptions options;
+    std::mutex mutex;
+    std::ofstream out;
+    std::size_t size = 0;
+};
+
+// Times an operation of a table for its slow-operation log. When the log
+// is disabled the operation pays for one relaxed load and two stores.
+class SlowLogScope {
+   public:
+    SlowLogScope(const TableState &state, Operation operation, const std::string &table,
+                 const nlohmann::json *query = nullptr)
+        : operation(operation), table(table), query(query) {
+        if (state.slowLogEnabled.load(std::memory_order_relaxed)) {
+            log = std::atomic_load(&state.slowLog);
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    SlowLogScope(const SlowLogScope &) = delete;
+    SlowLogScope &operator=(const SlowLogScope &) = delete;
+
+    void Plan(const char *name, std::size_t scanned) {
+        plan = name;
+        documentsScanned = scanned;
+    }
+
+    ~SlowLogScope() {
+        if (!log) {
+            return;
+        }
+        double elapsed =
+            std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        bool slow = elapsed >= log->Threshold();
+        if (!slow && !log->Sample()) {
+            return;
+        }
+        try {
+            log->Record({OPERATION_NAMES[static_cast<std::size_t>(operation)], table,
+                         query ? normalize_query(*query) : nlohmann::json(), plan, documentsScanned, elapsed,
+                         !slow});
+        } catch (const std::exception &e) {
+            std::cerr << "Error in slow-operation log: " << e.what() << std::endl;
+        }
+    }
+
+   private:
+    std::shared_ptr<SlowLog> log;
+    Operation operation;
+    const std::string &table;
+    const nlohmann::json *query;
+    const char *plan = "none";
+    std::size_t documentsScanned = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+struct DatabaseState {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<TableState>> tables;
+    // guards the transaction log, taken after any table writer lock
+    std::mutex transactionsMutex;
+    // serializes the rewrites of the catalog with the snapshots reading it,
+    // taken before any table writer lock
+    std::mutex catalogMutex;
+    std::once_flag recovered;
+    std::shared_ptr<Executor> executor;
+    std::shared_ptr<IoBackend> io;
+    // asynchronous operations not finished yet, waited for on destruction
+    std::size_t inFlight = 0;
+    std::condition_variable idle;
+#ifdef JSONDB_METRICS
+    Metrics metrics;
+#endif
+};
+
+struct TransactionEntry {
+    std::unique_ptr<Table> table;
+    // snapshot the transaction started from, compared again on commit
+    std::shared_ptr<const TableData> base;
+    TableData data;
+    nlohmann::json records = nlohmann::json::array();
+};
+
+namespace {
+// Rough heap footprint of a json value, used to enforce the cache memory cap.
+std::size_t approximate_size(const nlohmann::json &value) {
+    std::size_t size = sizeof(nlohmann::json);
+    switch (value.type()) {
+        case nlohmann::json::value_t::object:
+            for (auto it = value.begin(); it != value.end(); ++it) {
+                // key string plus the red-black tree node around the pair
+                size += it.key().capacity() + 4 * sizeof(void *) +
+                        approximate_size(it.value());
+            }
+            break;
+        case nlohmann::json::value_t::array:
+            for (const auto &item : value) {
+                size += approximate_size(item);
+            }
+            break;
+        case nlohmann::json::value_t::string:
+            size += value.get_ref<const std::string &>().capacity();
+            break;
+        default:
+            break;
+    }
+    return size;
+}
+
+// Replays one journal record on top of the table data.
+void apply_record(TableData &data, const nlohmann::json &record) {
+    const std::string &op = record.at("op").get_ref<const std::string &>();
+    if (op == "insert") {
+        data.Add(record.at("doc"));
+    } else if (op == "update") {
+        for (const auto &pos : record.at("pos")) {
+            nlohmann::json updated = data.documents.at(pos.get<std::size_t>())->Json(*data.keys);
+            apply_update(updated, record.at("update"));
+            data.Replace(pos.get<std::size_t>(), data.Make(std::move(updated)));
+        }
+    } else if (op == "delete") {
+        for (const auto &pos : record.at("pos")) {
+            data.Remove(pos.get<std::size_t>());
+        }
+    } else if (op == "batch") {
+        for (const auto &batched : record.at("records")) {
+            apply_record(data, batched);
+        }
+    } else if (op != "base") {
+        throw std::runtime_error("Unknown journal record: " + op);
+    }
+}
+
+enum class OpenMode { Read, Truncate, Append };
+
+int open_file(const std::string &path, OpenMode mode) {
+#ifdef _WIN32
+    int flags = mode == OpenMode::Read     ? _O_RDONLY
+                : mode == OpenMode::Append ? _O_WRONLY | _O_CREAT | _O_APPEND
+                                           : _O_WRONLY | _O_CREAT | _O_TRUNC;
+    return _open(path.c_str(), flags | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int flags = mode == OpenMode::Read     ? O_RDONLY
+                : mode == OpenMode::Append ? O_WRONLY | O_CREAT | O_APPEND
+                                           : O_WRONLY | O_CREAT | O_TRUNC;
+    return ::open(path.c_str(), flags, 0644);
+#endif
+}
+
+void close_file(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+// Writes the part of a buffer not written yet, then flushes it if asked.
+bool write_fd(int fd, const std::string &content, std::size_t written, bool sync) {
+    bool ok = true;
+    while (ok && written < content.size()) {
+#ifdef _WIN32
+        int count = _write(fd, content.data() + written, static_cast<unsigned>(content.size() - written));
+#else
+        ssize_t count = ::write(fd, content.data() + written, content.size() - written);
+#endif
+        ok = count > 0;
+        written += ok ? count : 0;
+    }
+#ifdef _WIN32
+    return ok && (!sync || _commit(fd) == 0);
+#else
+    return ok && (!sync || ::fsync(fd) == 0);
+#endif
+}
+
+// Copies the first `size` bytes of an open file, as a reflink where the
+// file system supports it.
+void copy_prefix(int from, std::uint64_t size, const std::string &to) {
+    int out = open_file(to, OpenMode::Truncate);
+    if (out < 0) {
+        throw std::runtime_error("Error opening: " + to);
+    }
+    bool ok = false;
+#ifdef FICLONE
+    if (::ioctl(out, FICLONE, from) == 0) {
+        ok = ::ftruncate(out, static_cast<off_t>(size)) == 0;
+        if (!ok) {
+            close_file(out);
+            throw std::runtime_error("Error truncating: " + to);
+        }
+    }
+#endif
+    std::string buffer;
+    for (std::uint64_t copied = 0; !ok && copied < size;) {
+        buffer.resize(static_cast<std::size_t>(std::min<std::uint64_t>(size - copied, 1 << 20)));
+#ifdef _WIN32
+        _lseeki64(from, static_cast<__int64>(copied), SEEK_SET);
+        int count = _read(from, &buffer[0], static_cast<unsigned>(buffer.size()));
+#else
+        ssize_t count = ::pread(from, &buffer[0], buffer.size(), static_cast<off_t>(copied));
+#endif
+        if (count <= 0) {
+            close_file(out);
+            throw std::runtime_error("Error copying to: " + to);
+        }
+        buffer.resize(static_cast<std::size_t>(count));
+        if (!write_fd(out, buffer, 0, false)) {
+            close_file(out);
+            throw std::runtime_error("Error writing: " + to);
+        }
+        copied += static_cast<std::uint64_t>(count);
+    }
+    bool synced = write_fd(out, std::string(), 0, true);
+    close_file(out);
+    if (!synced) {
+        throw std::runtime_error("Error writing: " + to);
+    }
+}
+
+class PosixIoBackend : public IoBackend {
+   public:
+    std::string GetName() const override { return "posix"; }
+
+    std::vector<std::string> ReadFiles(const std::vector<std::string> &paths) override {
+        std::vector<std::string> contents;
+        for (const auto &path : paths) {
+            std::ifstream fileIn(path, std::ios::binary);
+            contents.emplace_back(std::istreambuf_iterator<char>(fileIn), std::istreambuf_iterator<char>());
+        }
+        return contents;
+    }
+
+    void WriteFile(const std::string &path, const std::string &content, bool sync) override {
+        Write(path, OpenMode::Truncate, content, sync);
+    }
+
+    void AppendFile(const std::string &path, const std::string &content, bool sync) override {
+        Write(path, OpenMode::Append, content, sync);
+    }
+
+    void SyncFiles(const std::vector<std::string> &paths) override {
+        for (const auto &path : paths) {
+            int fd = open_file(path, OpenMode::Read);
+            if (fd >= 0) {
+                write_fd(fd, std::string(), 0, true);
+                close_file(fd);
+            }
+        }
+    }
+
+   private:
+    static void Write(const std::string &path, OpenMode mode, const std::string &content, bool sync) {
+        int fd = open_file(path, mode);
+        if (fd < 0) {
+            throw std::runtime_error("Error opening: " + path);
+        }
+        bool ok = write_fd(fd, content, 0, sync);
+        close_file(fd);
+        if (!ok) {
+            throw std::runtime_error("Error writing to: " + path);
+        }
+    }
+};
+
+#ifdef JSONDB_IO_URING
+// Minimal io_uring driver on top of the raw system calls, so that no
+// library beyond the kernel headers is needed. Submissions are serialized
+// by a mutex; each call submits a batch and waits for all its completions.
+class UringIoBackend : public IoBackend {
+   public:
+    struct Operation {
+        std::uint8_t opcode;
+        int fd;
+        void *buffer;
+        unsigned length;
+        std::uint64_t offset;
+        // the next operation only starts once this one succeeded
+        bool link;
+        int result;
+    };
+
+    static std::shared_ptr<IoBackend> Create(unsigned queueDepth) {
+        auto backend = std::shared_ptr<UringIoBackend>(new UringIoBackend());
+        return backend->Setup(std::max(queueDepth, 2u)) ? backend : nullptr;
+    }
+
+    ~UringIoBackend() override {
+        if (sqRing != MAP_FAILED) {
+            ::munmap(sqRing, sqRingSize);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            ::munmap(cqRing, cqRingSize);
+        }
+        if (sqes != MAP_FAILED) {
+            ::munmap(sqes, sqesSize);
+        }
+        if (ringFd >= 0) {
+            ::close(ringFd);
+        }
+    }
+
+    std::string GetName() const override { return "io_uring"; }
+
+    std::vector<std::string> ReadFiles(const std::vector<std::string> &paths) override {
+        if (broken) {
+            return fallback.ReadFiles(paths);
+        }
+        std::vector<std::string> contents(paths.size());
+        std::vector<int> fds(paths.size(), -1);
+        std::vector<std::size_t> done(paths.size(), 0);
+        try {
+            for (std::size_t i = 0; i < paths.size(); i++) {
+                fds[i] = open_file(paths[i], OpenMode::Read);
+                struct stat info;
+                if (fds[i] >= 0 && ::fstat(fds[i], &info) == 0) {
+                    contents[i].resize(info.st_size);
+                }
+            }
+            // short reads are resubmitted for the rest of the file
+            for (bool pending = true; pending;) {
+                std::vector<Operation> operations;
+                std::vector<std::size_t> files;
+                for (std::size_t i = 0; i < paths.size(); i++) {
+                    if (fds[i] >= 0 && done[i] < contents[i].size()) {
+                        unsigned length = static_cast<unsigned>(std::min<std::size_t>(contents[i].size() - done[i], 1u << 30));
+                        operations.push_back({IORING_OP_READ, fds[i], &contents[i][done[i]], length, done[i], false, 0});
+                        files.push_back(i);
+                    }
+                }
+                Run(operations);
+                pending = false;
+                for (std::size_t j = 0; j < operations.size(); j++) {
+                    std::size_t i = files[j];
+                    if (operations[j].result < 0) {
+                        throw std::runtime_error("Error reading: " + paths[i]);
+                    }
+                    if (operations[j].result == 0) {
+                        // the file shrank since it was measured
+                        contents[i].resize(done[i]);
+                    }
+                    done[i] += operations[j].result;
+                    pending = pending || done[i] < contents[i].size();
+                }
+            }
+        } catch (...) {
+            CloseAll(fds);
+            throw;
+        }
+        CloseAll(fds);
+        return contents;
+    }
+
+    void WriteFile(const std::string &path, const std::string &content, bool sync) override {
+        if (broken) {
+            return fallback.WriteFile(path, content, sync);
+        }
+        Write(path, OpenMode::Truncate, content, sync);
+    }
+
+    void AppendFile(const std::string &path, const std::string &content, bool sync) override {
+        if (broken) {
+            return fallback.AppendFile(path, content, sync);
+        }
+        Write(path, OpenMode::Append, content, sync);
+    }
+
+    void SyncFiles(const std::vector<std::string> &paths) override {
+        if (broken) {
+            return fallback.SyncFiles(paths);
+        }
+        std::vector<int> fds;
+        std::vector<Operation> operations;
+        for (const auto &path : paths) {
+            int fd = open_file(path, OpenMode::Read);
+            if (fd >= 0) {
+                fds.push_back(fd);
+                operations.push_back({IORING_OP_FSYNC, fd, nullptr, 0, 0, false, 0});
+            }
+        }
+        try {
+            Run(operations);
+        } catch (...) {
+            CloseAll(fds);
+            throw;
+        }
+        CloseAll(fds);
+    }
+
+   private:
+    UringIoBackend() = default;
+
+    bool Setup(unsigned queueDepth) {
+        io_uring_params params{};
+        ringFd = static_cast<int>(::syscall(__NR_io_uring_setup, queueDepth, &params));
+        // reads and writes at an offset need the features of Linux 5.6
+        if (ringFd < 0 || !(params.features & IORING_FEAT_RW_CUR_POS)) {
+            return false;
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                        IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            return false;
+        }
+        cqRing = single ? sqRing
+                        : ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                                 IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_SQES);
+        if (cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            return false;
+        }
+        char *sq = static_cast<char *>(sqRing);
+        char *cq = static_cast<char *>(cqRing);
+        sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        entries = params.sq_entries;
+        return true;
+    }
+
+    // Submits the operations in batches the size of the ring, never
+    // splitting a linked chain, and stores the result of each one.
+    void Run(std::vector<Operation> &operations) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (broken) {
+            throw std::runtime_error("io_uring is no longer usable");
+        }
+        for (std::size_t begin = 0; begin < operations.size();) {
+            std::size_t end = std::min(operations.size(), begin + entries);
+            while (end < operations.size() && end > begin + 1 && operations[end - 1].link) {
+                end--;
+            }
+            const unsigned start = *sqTail;
+            unsigned tail = start;
+            for (std::size_t i = begin; i < end; i++, tail++) {
+                unsigned slot = tail & sqMask;
+                io_uring_sqe &sqe = static_cast<io_uring_sqe *>(sqes)[slot];
+                std::memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = operations[i].opcode;
+                sqe.fd = operations[i].fd;
+                sqe.addr = reinterpret_cast<std::uint64_t>(operations[i].buffer);
+                sqe.len = operations[i].length;
+                sqe.off = operations[i].offset;
+                sqe.flags = operations[i].link && i + 1 < end ? IOSQE_IO_LINK : 0;
+                sqe.user_data = i;
+                sqArray[slot] = slot;
+            }
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+            unsigned count = static_cast<unsigned>(end - begin);
+            for (unsigned submitted = 0, completed = 0; completed < count;) {
+                int ret = static_cast<int>(::syscall(__NR_io_uring_enter, ringFd, count - submitted,
+                                                     count - completed, IORING_ENTER_GETEVENTS, nullptr, 0));
+                if (ret < 0 && errno != EINTR) {
+                    Abandon(start, completed, operations);
+                    throw std::runtime_error("io_uring_enter failed");
+                }
+                submitted += ret > 0 ? ret : 0;
+                completed += Reap(operations);
+            }
+            begin = end;
+        }
+    }
+
+    // Stores the results of the completions posted so far.
+    unsigned Reap(std::vector<Operation> &operations) {
+        unsigned reaped = 0;
+        unsigned head = *cqHead;
+        for (; head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE); head++, reaped++) {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            if (cqe.user_data < operations.size()) {
+                operations[cqe.user_data].result = cqe.res;
+            }
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return reaped;
+    }
+
+    // After a failed submission: drops the entries the kernel did not take,
+    // waits for the ones it did since they point into buffers of the
+    // caller, and hands every later call to the POSIX backend.
+    void Abandon(unsigned start, unsigned completed, std::vector<Operation> &operations) {
+        const unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        __atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+        for (const unsigned taken = head - start; completed < taken;) {
+            int ret = static_cast<int>(::syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (ret < 0 && errno != EINTR) {
+                std::this_thread::yield();
+            }
+            completed += Reap(operations);
+        }
+        broken = true;
+    }
+
+    void Write(const std::string &path, OpenMode mode, const std::string &content, bool sync) {
+        int fd = open_file(path, mode);
+        if (fd < 0) {
+            throw std::runtime_error("Error opening: " + path);
+        }
+        // O_APPEND ignores the offset, which makes 0 right for both modes
+        unsigned length = static_cast<unsigned>(std::min<std::size_t>(content.size(), 1u << 30));
+        std::vector<Operation> operations = {
+            {IORING_OP_WRITE, fd, const_cast<char *>(content.data()), length, 0, sync, 0}};
+        if (sync) {
+            operations.push_back({IORING_OP_FSYNC, fd, nullptr, 0, 0, false, 0});
+        }
+        bool ok = true;
+        try {
+            Run(operations);
+            // a short write cancels the linked fsync, finish synchronously
+            if (operations[0].result < 0) {
+                ok = false;
+            } else if (static_cast<std::size_t>(operations[0].result) < content.size() ||
+                       (sync && operations[1].result < 0)) {
+                ok = write_fd(fd, content, operations[0].result, sync);
+            }
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        if (!ok) {
+            throw std::runtime_error("Error writing to: " + path);
+        }
+    }
+
+    static void CloseAll(const std::vector<int> &fds) {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+
+    std::mutex mutex;
+    // set once the ring failed, every call then goes to `fallback`
+    std::atomic<bool> broken{false};
+    PosixIoBackend fallback;
+    int ringFd = -1;
+    void *sqRing = MAP_FAILED;
+    void *cqRing = MAP_FAILED;
+    void *sqes = MAP_FAILED;
+    std::size_t sqRingSize = 0;
+    std::size_t cqRingSize = 0;
+    std::size_t sqesSize = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned cqMask = 0;
+    unsigned entries = 0;
+    io_uring_cqe *cqes = nullptr;
+};
+#endif
+
+// First record of a journal: the checksum of the table file the records
+// after it apply to. A journal left behind by an interrupted compaction
+// names the file before the fold and is not replayed again.
+std::string journal_header(std::uint64_t fileChecksum) {
+    return nlohmann::json({{"op", "base"}, {"checksum", fileChecksum}}).dump() + "\n";
+}
+
+// Whether a journal starting with `firstLine` applies to the table file
+// with `fileChecksum`. Journals written without a header always do.
+bool journal_current(const std::string &firstLine, std::uint64_t fileChecksum) {
+    nlohmann::json record = nlohmann::json::parse(firstLine);
+    return record.at("op") != "base" || record.at("checksum").get<std::uint64_t>() == fileChecksum;
+}
+
+// Complete lines of a log, skipping a last record still being written.
+std::vector<std::string> split_lines(const std::string &content) {
+    std::vector<std::string> lines;
+    std::size_t begin = 0;
+    for (std::size_t end; (end = content.find('\n', begin)) != std::string::npos; begin = end + 1) {
+        lines.emplace_back(content, begin, end - begin);
+    }
+    return lines;
+}
+
+// Asynchronous operations hold no reference on the database state: the
+// destructor of the last JsonDB waits for them instead, so that the state
+// and its executor are never released from a worker thread.
+DatabaseState *begin_operation(DatabaseState &state) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.inFlight++;
+    return &state;
+}
+
+void end_operation(DatabaseState &state) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (--state.inFlight == 0) {
+        state.idle.notify_all();
+    }
+}
+
+// Whether the journal of a table should be folded into its file: once
+// replaying it would cost more than the table itself, or when enough
+// documents are dead.
+bool needs_compaction(const TableData &data, double deadRatio) {
+    return data.Dead() > deadRatio * data.documents.size() ||
+           data.stamp.journalSize > data.stamp.tableSize + (1 << 20);
+}
+
+// Changes described by a journal record applied to `base`. Documents are
+// followed through the earlier records of a batch, so an update reports
+// the document it produced and a delete the one it removed, even when the
+// batch inserted or changed it first.
+struct ChangeCollector {
+    const TableData &base;
+    std::size_t size;
+    // documents changed by the records so far, null once deleted
+    std::map<std::size_t, nlohmann::json> changed;
+    std::vector<ChangeEvent> changes;
+
+    explicit ChangeCollector(const TableData &base) : base(base), size(base.documents.size()) {}
+
+    nlohmann::json Current(std::size_t pos) const {
+        auto found = changed.find(pos);
+        if (found != changed.end()) {
+            return found->second;
+        }
+        return pos < base.documents.size() && base.documents[pos] ? base.Json(pos) : nlohmann::json();
+    }
+
+    void Collect(const nlohmann::json &record) {
+        const std::string &op = record.at("op").get_ref<const std::string &>();
+        if (op == "insert") {
+            changed[size++] = record.at("doc");
+            changes.push_back({0, op, record.at("doc")});
+        } else if (op == "update" || op == "delete") {
+            for (const auto &pos : record.at("pos")) {
+                nlohmann::json document = Current(pos.get<std::size_t>());
+                if (document.is_null()) {
+                    continue;
+                }
+                if (op == "update") {
+                    apply_update(document, record.at("update"));
+                    changed[pos.get<std::size_t>()] = document;
+                } else {
+                    changed[pos.get<std::size_t>()] = nullptr;
+                }
+                changes.push_back({0, op, std::move(document)});
+            }
+        } else if (op == "batch") {
+            for (const auto &batched : record.at("records")) {
+                Collect(batched);
+            }
+        }
+    }
+};
+
+FileStamp stamp_files(const std::string &file, const std::string &journal) {
+    FileStamp stamp;
+    std::error_code error;
+    stamp.tableSize = std::filesystem::file_size(file, error);
+    stamp.tableTime = std::filesystem::last_write_time(file, error).time_since_epoch().count();
+    stamp.journalSize = std::filesystem::file_size(journal, error);
+    if (error) {
+        stamp.journalSize = 0;
+    }
+    return stamp;
+}
+
+// Catalog entry of an index file, relative to the tables directory.
+nlohmann::json index_entry(const std::string &type, const std::string &field, const std::string &file) {
+    return {{"type", type}, {"field", field}, {"file", file}};
+}
+
+// File of the text index a table gets after `count` others.
+std::string text_index_file(const std::string &tableName, std::size_t count) {
+    return tableName + ".text" + std::to_string(count) + ".idx";
+}
+
+// Reads the options of a table and the files of its indexes from the
+// database catalog. Catalogs written before index files were listed use
+// the default primary key index file.
+void read_options(const std::string &dbFile, const std::string &tableName, const std::string &tablesPath,
+                  TableData &table) {
+    std::ifstream dbFileIn(dbFile);
+    if (!dbFileIn.is_open()) {
+        throw std::runtime_error("Error opening: " + dbFile);
+    }
+    nlohmann::json data;
+    dbFileIn >> data;
+
+    TableOptions &options = table.options;
+    table.idsFile = tablesPath + "/" + tableName + ".pk";
+    for (const auto &tb : data["tables"]) {
+        if (tb["name"] == tableName) {
+            options.primaryKey = tb.value("primaryKey", "");
+            std::string generator = tb.value("idGenerator", "none");
+            if (generator == "monotonic") {
+                options.idGenerator = IdGenerator::Monotonic;
+            } else if (generator == "objectid") {
+                options.idGenerator = IdGenerator::ObjectId;
+            }
+            for (const auto &index : tb.value("indexes", nlohmann::json::array())) {
+                const std::string file = tablesPath + "/" + index.at("file").get<std::string>();
+                if (index.at("type") == "primary") {
+                    table.idsFile = file;
+                } else if (index.at("type") == "text") {
+                    options.textIndexes.push_back(index.at("field"));
+                    table.textFiles.push_back(file);
+                }
+            }
+        }
+    }
+}
+
+// 12 byte identifier in the style of MongoDB ObjectIds: seconds since the
+// epoch, a per-process random value and a counter, as 24 hex characters.
+std::string generate_object_id() {
+    static const std::uint64_t processId = std::random_device{}() ^
+                                           (std::uint64_t(std::random_device{}()) << 32);
+    static std::atomic<std::uint32_t> counter{std::random_device{}()};
+    std::uint32_t seconds = static_cast<std::uint32_t>(std::time(nullptr));
+    std::uint32_t count = counter++;
+
+    char id[25];
+    std::snprintf(id, sizeof(id), "%08x%010llx%06x", seconds,
+                  static_cast<unsigned long long>(processId & 0xffffffffffULL),
+                  count & 0xffffffU);
+    return id;
+}
+
+// Index file of `type` for the table file of `data`: room for the header,
+// filled in once `payload` has appended the entries.
+template <class Payload>
+std::string encode_index(IndexType type, const TableData &data, Payload &&payload) {
+    std::string content(sizeof(IndexFileHeader), '\0');
+    IndexFileHeader header{};
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.type = static_cast<std::uint32_t>(type);
+    header.tableSize = data.stamp.tableSize;
+    header.tableTime = data.stamp.tableTime;
+    payload(header, content);
+    header.checksum = checksum(content.data() + sizeof(IndexFileHeader), content.size() - sizeof(IndexFileHeader));
+    std::memcpy(&content[0], &header, sizeof(header));
+    return content;
+}
+
+// Primary key index file of the documents of `data`, also finding the
+// greatest integer key.
+std::string encode_ids(TableData &data) {
+    std::vector<KeyEntry> entries;
+    for (std::size_t pos = 0; pos < data.documents.size(); pos++) {
+        if (!data.documents[pos]) {
+            continue;
+        }
+        nlohmann::json id = data.Key(*data.documents[pos]);
+        if (id.is_null()) {
+            continue;
+        }
+        if (id.is_number_integer() && id.get<std::int64_t>() > data.lastId) {
+            data.lastId = id.get<std::int64_t>();
+        }
+        entries.push_back({fnv1a(id.dump()), pos});
+    }
+    std::sort(entries.begin(), entries.end(), [](const KeyEntry &a, const KeyEntry &b) {
+        return a.hash < b.hash || (a.hash == b.hash && a.position < b.position);
+    });
+    return encode_index(IndexType::Primary, data, [&](IndexFileHeader &header, std::string &content) {
+        header.entries = entries.size();
+        header.lastId = data.lastId;
+        content.append(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(KeyEntry));
+    });
+}
+
+// Text index file of `field` over the documents of `data`.
+std::string encode_text(const TableData &data, const std::string &field) {
+    if (data.documents.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("Too many documents for a text index on " + field);
+    }
+    // trigram in the high half, position in the low one, so that sorting
+    // groups the postings of a trigram in table order
+    std::vector<std::uint64_t> postings;
+    const std::uint32_t key = data.keys->Find(field);
+    for (std::size_t pos = 0; key != KeyDictionary::npos && pos < data.documents.size(); pos++) {
+        const auto &document = data.documents[pos];
+        std::size_t value = document ? document->Find(key) : 0;
+        if (value != 0 && document->TypeAt(value) == Document::String) {
+            for (std::uint32_t trigram : trigrams(document->StringAt(value))) {
+                postings.push_back(std::uint64_t(trigram) << 32 | pos);
+            }
+        }
+    }
+    std::sort(postings.begin(), postings.end());
+    std::vector<TrigramEntry> entries;
+    std::vector<std::uint32_t> positions(postings.size());
+    for (std::size_t i = 0; i < postings.size(); i++) {
+        const std::uint32_t trigram = static_cast<std::uint32_t>(postings[i] >> 32);
+        if (entries.empty() || entries.back().trigram != trigram) {
+            entries.push_back({trigram, 0, i});
+        }
+        entries.back().count++;
+        positions[i] = static_cast<std::uint32_t>(postings[i]);
+    }
+    return encode_index(IndexType::Text, data, [&](IndexFileHeader &header, std::string &content) {
+        header.entries = entries.size();
+        content.append(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(TrigramEntry));
+        content.append(reinterpret_cast<const char *>(positions.data()), positions.size() * sizeof(std::uint32_t));
+    });
+}
+
+// Replaces an index file, which readers may have mapped, and returns its
+// content. A file that cannot be written is rebuilt by the next load.
+std::shared_ptr<const MappedFile> write_index(IoBackend &io, const std::string &path, std::string content) {
+    // another process may rebuild the same file, each writes its own
+    // temporary file and renames it whole
+    const std::string tmpFile = path + "." + generate_object_id() + ".tmp";
+    try {
+        io.WriteFile(tmpFile, content, true);
+        std::filesystem::rename(tmpFile, path);
+    } catch (const std::exception &e) {
+        std::cerr << "Error writing index " << path << ": " << e.what() << std::endl;
+        std::error_code error;
+        std::filesystem::remove(tmpFile, error);
+    }
+    return std::make_shared<const MappedFile>(std::move(content));
+}
+
+// Starts a new generation of the indexes of `data` from their files,
+// which are mapped when they were written for the current table file and
+// rebuilt from the documents otherwise. Journal records applied afterwards
+// extend the indexes in memory.
+void open_indexes(IoBackend &io, TableData &data) {
+    data.ids = std::make_shared<IdIndex>();
+    data.text = std::make_shared<TextIndex>();
+    if (!data.options.primaryKey.empty()) {
+        auto file = MappedFile::Open(data.idsFile);
+        const IndexFileHeader *header = file ? index_header(*file, IndexType::Primary, data.stamp) : nullptr;
+        if (header != nullptr) {
+            data.ids->base = std::move(file);
+            data.lastId = header->lastId;
+        } else {
+            data.ids->base = write_index(io, data.idsFile, encode_ids(data));
+        }
+    }
+    for (std::size_t i = 0; i < data.options.textIndexes.size() && i < data.textFiles.size(); i++) {
+        const std::string &field = data.options.textIndexes[i];
+        auto file = MappedFile::Open(data.textFiles[i]);
+        if (!file || index_header(*file, IndexType::Text, data.stamp) == nullptr) {
+            file = write_index(io, data.textFiles[i], encode_text(data, field));
+        }
+        data.text->fields[field].base = std::move(file);
+    }
+}
+
+// Gives a document about to be inserted its primary key, generating one if
+// the table allows it, and refuses duplicate keys.
+void assign_key(const TableData &data, nlohmann::json &document) {
+    const std::string &primaryKey = data.options.primaryKey;
+    if (primaryKey.empty()) {
+        return;
+    }
+    if (!document.is_object()) {
+        throw std::invalid_argument("Document is not an object: " + document.dump());
+    }
+    if (!document.contains(primaryKey)) {
+        if (data.options.idGenerator == IdGenerator::Monotonic) {
+            document[primaryKey] = data.lastId + 1;
+        } else if (data.options.idGenerator == IdGenerator::ObjectId) {
+            document[primaryKey] = generate_object_id();
+        } else {
+            throw std::invalid_argument("Document has no " + primaryKey + ": " + document.dump());
+        }
+    } else if (data.Find(document[primaryKey]) >= 0) {
+        throw std::invalid_argument("Duplicate " + primaryKey + ": " + document[primaryKey].dump());
+    }
+}
+
+// Applies an update to a copy of a document, so a bad operator never
+// reaches the journal, and refuses to change its primary key.
+std::shared_ptr<const Document> update_document(const TableData &data,
+                                                const nlohmann::json &document,
+                                                const nlohmann::json &operators) {
+    nlohmann::json updated = document;
+    apply_update(updated, operators);
+    const nlohmann::json *before = data.Key(document);
+    const nlohmann::json *after = data.Key(updated);
+    if (before != nullptr && (after == nullptr || *before != *after)) {
+        throw std::invalid_argument("Cannot change the primary key of: " + before->dump());
+    }
+    return data.Make(std::move(updated));
+}
+
+// Runs `task` for every index below `count` on the executor and on the
+// calling thread, which takes indexes itself so that a busy executor only
+// slows the loop down. The first exception thrown by a task is rethrown.
+void parallel_for(Executor &executor, std::size_t count, const std::function<void(std::size_t)> &task) {
+    struct Loop {
+        std::size_t count;
+        const std::function<void(std::size_t)> *task;
+        std::atomic<std::size_t> next{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::size_t done = 0;
+        std::exception_ptr error;
+    };
+    auto loop = std::make_shared<Loop>();
+    loop->count = count;
+    loop->task = &task;
+    // helpers starting after the loop finished find no index left and
+    // never touch the task
+    auto work = [loop] {
+        for (std::size_t i = loop->next++; i < loop->count; i = loop->next++) {
+            std::exception_ptr error;
+            try {
+                (*loop->task)(i);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(loop->mutex);
+            if (error && !loop->error) {
+                loop->error = error;
+            }
+            if (++loop->done == loop->count) {
+                loop->finished.notify_all();
+            }
+        }
+    };
+    for (std::size_t i = 1; i < std::min(count, executor.GetThreadCount() + 1); i++) {
+        executor.Submit(work);
+    }
+    work();
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->finished.wait(lock, [&] { return loop->done == loop->count; });
+    if (loop->error) {
+        std::rethrow_exception(loop->error);
+    }
+}
+
+// Offsets and lengths of the records of an import file: its non-blank
+// lines, or the elements of its top-level array, found by tracking
+// strings and nesting without parsing the elements.
+std::vector<std::pair<std::size_t, std::size_t>> split_records(const std::string &content, FileFormat format) {
+    std::vector<std::pair<std::size_t, std::size_t>> records;
+    auto blank = [&](std::size_t begin, std::size_t end) {
+        return content.find_first_not_of(" \t\r\n", begin) >= end;
+    };
+    if (format == FileFormat::NdJson) {
+        for (std::size_t begin = 0; begin < content.size();) {
+            std::size_t end = content.find('\n', begin);
+            end = end == std::string::npos ? content.size() : end;
+            if (!blank(begin, end)) {
+                records.emplace_back(begin, end - begin);
+            }
+            begin = end + 1;
+        }
+        return records;
+    }
+
+    std::size_t open = content.find_first_not_of(" \t\r\n");
+    if (open == std::string::npos || content[open] != '[') {
+        throw std::runtime_error("Import file is not a JSON array");
+    }
+    std::size_t depth = 0;
+    bool inString = false;
+    std::size_t begin = open + 1;
+    for (std::size_t i = begin; i < content.size(); i++) {
+        char c = content[i];
+        if (inString) {
+            if (c == '\\') {
+                i++;
+            } else if (c == '"') {
+                inString = false;
+            }
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == '[' || c == '{') {
+            depth++;
+        } else if ((c == ']' || c == '}') && depth > 0) {
+            depth--;
+        } else if (depth == 0 && (c == ',' || c == ']')) {
+            if (c == ']' && records.empty() && blank(begin, i)) {
+                begin = i + 1;
+            } else {
+                records.emplace_back(begin, i - begin);
+                begin = i + 1;
+            }
+            if (c == ']') {
+                if (!blank(i + 1, content.size())) {
+                    throw std::runtime_error("Unexpected content after the JSON array");
+                }
+                return records;
+            }
+        }
+    }
+    throw std::runtime_error("Unterminated JSON array");
+}
+}  // namespace
+
+QueryCache::QueryCache(std::size_t capacityBytes) {
+    stats.capacity = capacityBytes;
+}
+
+void QueryCache::SetCapacity(std::size_t capacityBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.capacity = capacityBytes;
+    EvictUntil(capacityBytes);
+}
+
+std::size_t QueryCache::GetCapacity() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats.capacity;
+}
+
+bool QueryCache::Get(const std::string &key, std::uint64_t version,
+                     nlohmann::json &result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stats.capacity == 0) {
+        return false;
+    }
+    auto it = index.find(key);
+    if (it == index.end()) {
+        stats.misses++;
+        return false;
+    }
+    if (it->second->version != version) {
+        stats.bytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+        stats.entries = entries.size();
+        stats.misses++;
+        return false;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    result = it->second->result;
+    stats.hits++;
+    return true;
+}
+
+void QueryCache::Put(const std::string &key, std::uint64_t version,
+                     const nlohmann::json &result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::size_t bytes = key.capacity() + sizeof(Entry) + approximate_size(result);
+    if (stats.capacity == 0 || bytes > stats.capacity) {
+        return;
+    }
+    auto it = index.find(key);
+    if (it != index.end()) {
+        stats.bytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+    EvictUntil(stats.capacity - bytes);
+    entries.push_front({key, version, result, bytes});
+    index[key] = entries.begin();
+    stats.bytes += bytes;
+    stats.entries = entries.size();
+}
+
+void QueryCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    stats.bytes = 0;
+    stats.entries = 0;
+}
+
+std::size_t RawDocuments::Size() const {
+    return offsets.size();
+}
+
+std::string_view RawDocuments::Text() const {
+    return buffer;
+}
+
+std::string_view RawDocuments::Text(std::size_t i) const {
+    return std::string_view(buffer).substr(offsets.at(i).first, offsets.at(i).second);
+}
+
+std::pair<std::size_t, std::size_t> RawDocuments::Offset(std::size_t i) const {
+    return offsets.at(i);
+}
+
+nlohmann::json RawDocuments::Json(std::size_t i) const {
+    return nlohmann::json::parse(Text(i));
+}
+
+QueryCacheStats QueryCache::Stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+std::string QueryCache::MakeKey(const std::string &operation,
+                                const nlohmann::json &query) {
+    return operation + '\n' + query.dump();
+}
+
+void QueryCache::EvictUntil(std::size_t limit) {
+    while (!entries.empty() && stats.bytes > limit) {
+        stats.bytes -= entries.back().bytes;
+        index.erase(entries.back().key);
+        entries.pop_back();
+        stats.evictions++;
+    }
+    stats.entries = entries.size();
+}
+
+//TODO: improve the comparison algorith
+bool generic_comparator(const std::string &op, const nlohmann::json &documentValue, const nlohmann::json &queryValue){
+    bool result = false;
+    switch (documentValue.type()) {
+        case nlohmann::json::value_t::string:
+            if (queryValue.is_string() && is_string_operator(op)) {
+                result = match_string(op, documentValue.get_ref<const std::string &>(),
+                                      queryValue.get_ref<const std::string &>());
+            } else if(queryValue.is_string()){
+                result = compare(op, (std::string) documentValue, (std::string) queryValue);
+            }else if(queryValue.is_array()){
+                result =compare(op, (std::string) documentValue, (std::vector<std::string>) queryValue);
+            }
+            break;
+        case nlohmann::json::value_t::number_integer:
+        case nlohmann::json::value_t::number_unsigned:
+        case nlohmann::json::value_t::number_float:
+            if(queryValue.is_number()){
+                result = compare(op, (float) documentValue, (float) queryValue);
+            }else if(queryValue.is_array()){
+                result = compare(op, (float) documentValue, (std::vector<float>) queryValue);
+            }
+            break;
+        case nlohmann::json::value_t::boolean:
+            if(queryValue.is_boolean()){
+                result = compare(op, (bool) documentValue, (bool) queryValue);
+            }
+            break;
+        case nlohmann::json::value_t::null:
+            if(queryValue.is_null()){
+                result = compare(op, documentValue, queryValue);
+            }
+            break;
+        default:
+            result = false;
+    }
+    return result;
+}
+bool match_query(const nlohmann::json &document, const nlohmann::json &query) {
+    nlohmann::json emptyQuery = {};
+    if(emptyQuery == query){
+        return true;
+    }
+    bool result = true;
+    for (auto q = query.begin(); q != query.end(); ++q) {
+        std::string column = q.key();
+        if (document.find(column) != document.end()) {
+            nlohmann::json columnStatements = query.at(column);
+            for (auto s = columnStatements.begin(); s != columnStatements.end();
+                 ++s) {
+                try{
+                    std::string statement = s.key();
+                    auto propertyValue = document.at(column);
+                    auto queryValue = columnStatements.at(statement);
+                    result = result && generic_comparator(statement, propertyValue, queryValue);
+                } catch (std::exception &e){
+                    std::cerr << "Error in comparison: " << e.what() << std::endl;
+                    return false;
+                }
+                if (result == false) {
+                    return false;
+                }
+            }
+        } else {
+            return false;
+        }
+    }
+    return result;
+}
+namespace {
+thread_local std::pmr::memory_resource *arena = nullptr;
+}  // namespace
+
+std::pmr::memory_resource *current_arena() noexcept {
+    return arena != nullptr ? arena : std::pmr::new_delete_resource();
+}
+
+ArenaScope::ArenaScope(std::pmr::memory_resource *resource) noexcept : previous(arena) {
+    arena = resource;
+}
+
+ArenaScope::~ArenaScope() {
+    arena = previous;
+}
+
+std::shared_ptr<IoBackend> make_posix_io_backend() {
+    return std::make_shared<PosixIoBackend>();
+}
+
+std::shared_ptr<IoBackend> make_io_uring_backend(unsigned queueDepth) {
+#ifdef JSONDB_IO_URING
+    return UringIoBackend::Create(queueDepth);
+#else
+    (void)queueDepth;
+    return nullptr;
+#endif
+}
+
+std::shared_ptr<IoBackend> make_io_backend() {
+    std::shared_ptr<IoBackend> backend = make_io_uring_backend();
+    return backend ? backend : make_posix_io_backend();
+}
+
+Executor::Executor(std::size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (std::size_t i = 0; i < threadCount; i++) {
+        threads.emplace_back(&Executor::Run, this);
+    }
+}
+
+Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void Executor::Submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    ready.notify_one();
+}
+
+std::size_t Executor::GetThreadCount() const {
+    return threads.size();
+}
+
+void Executor::Run() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+nlohmann::json normalize_update(const nlohmann::json &update) {
+    if (!update.is_object()) {
+        throw std::invalid_argument("Update must be a JSON object");
+    }
+    for (auto u = update.begin(); u != update.end(); ++u) {
+        if (!u.key().empty() && u.key()[0] == '$') {
+            return update;
+        }
+    }
+    return {{"$set", update}};
+}
+
+void apply_update(nlohmann::json &document, const nlohmann::json &update) {
+    nlohmann::json operators = normalize_update(update);
+    for (auto u = operators.begin(); u != operators.end(); ++u) {
+        const std::string &op = u.key();
+        const nlohmann::json &fields = u.value();
+        if (op.empty() || op[0] != '$') {
+            throw std::invalid_argument("Cannot mix update operators and fields: " + op);
+        }
+        if (!fields.is_object()) {
+            throw std::invalid_argument("Operand of " + op + " must be an object");
+        }
+        for (auto f = fields.begin(); f != fields.end(); ++f) {
+            const std::string &column = f.key();
+            if (op == "$set") {
+                document[column] = f.value();
+            } else if (op == "$unset") {
+                document.erase(column);
+            } else if (op == "$inc") {
+                if (!f.value().is_number()) {
+                    throw std::invalid_argument("$inc amount must be a number: " + column);
+                }
+                auto &current = document[column];
+                if (current.is_null()) {
+                    current = f.value();
+                } else if (!current.is_number()) {
+                    throw std::invalid_argument("$inc target is not a number: " + column);
+                } else if (current.is_number_float() || f.value().is_number_float()) {
+                    current = current.get<double>() + f.value().get<double>();
+                } else {
+                    current = current.get<std::int64_t>() + f.value().get<std::int64_t>();
+                }
+            } else if (op == "$push") {
+                auto &current = document[column];
+                if (current.is_null()) {
+                    current = nlohmann::json::array();
+                } else if (!current.is_array()) {
+                    throw std::invalid_argument("$push target is not an array: " + column);
+                }
+                current.push_back(f.value());
+            } else {
+                throw std::invalid_argument("Unknown update operator: " + op);
+            }
+        }
+    }
+}
+
+JsonDB::~JsonDB() {
+    if (state.use_count() == 1) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->idle.wait(lock, [this] { return state->inFlight == 0; });
+    }
+}
+JsonDB::JsonDB(const std::string &dbName, const std::string &dbPath)
+    : name(dbName),
+      path(dbPath),
+      file(dbPath + "/" + dbName + ".json"),
+      tablesPath(dbPath + "/" + dbName),
+      transactionsFile(dbPath + "/" + dbName + ".txn"),
+      state(std::make_shared<DatabaseState>()) {}
+
+std::string JsonDB::GetFile() const { return file; }
+std::string JsonDB::GetName() const { return name; }
+std::string JsonDB::GetPath() const { return path; }
+std::string JsonDB::GetTablesPath() const { return tablesPath; }
+
+std::shared_ptr<TableState> JsonDB::GetTableState(const std::string &tableName) const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    auto &tableState = state->tables[tableName];
+    if (!tableState) {
+        tableState = std::make_shared<TableState>();
+    }
+    return tableState;
+}
+
+void JsonDB::SetExecutor(std::shared_ptr<Executor> executor) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->executor = std::move(executor);
+}
+
+void JsonDB::SetIoBackend(std::shared_ptr<IoBackend> backend) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->io = std::move(backend);
+}
+
+std::shared_ptr<IoBackend> JsonDB::GetIoBackend() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (!state->io) {
+        state->io = make_io_backend();
+    }
+    return state->io;
+}
+
+std::shared_ptr<Executor> JsonDB::GetExecutor() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (!state->executor) {
+        state->executor = std::make_shared<Executor>();
+    }
+    return state->executor;
+}
+
+nlohmann::json JsonDB::Stats() const {
+#ifdef JSONDB_METRICS
+    const Metrics &metrics = state->metrics;
+    nlohmann::json operations = nlohmann::json::object();
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Operation::Count); i++) {
+        if (metrics.latency[i].Count() > 0) {
+            operations[OPERATION_NAMES[i]] = {{"calls", metrics.latency[i].Count()},
+                                              {"latencyUs", metrics.latency[i].Summary(1000.0)}};
+        }
+    }
+    QueryCacheStats cache;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        for (const auto &tb : state->tables) {
+            QueryCacheStats tableCache = tb.second->cache.Stats();
+            cache.hits += tableCache.hits;
+            cache.misses += tableCache.misses;
+        }
+    }
+    std::uint64_t lookups = cache.hits + cache.misses;
+    return {{"enabled", true},
+            {"operations", operations},
+            {"io", {{"bytesRead", metrics.bytesRead.load()}, {"bytesWritten", metrics.bytesWritten.load()}}},
+            {"documents",
+             {{"scanned", metrics.documentsScanned.load()}, {"returned", metrics.documentsReturned.load()}}},
+            {"timeUs",
+             {{"parse", metrics.parseNanos.load() / 1000.0}, {"serialize", metrics.serializeNanos.load() / 1000.0}}},
+            {"cache",
+             {{"hits", cache.hits},
+              {"misses", cache.misses},
+              {"hitRate", lookups ? static_cast<double>(cache.hits) / lookups : 0.0}}}};
+#else
+    return {{"enabled", false}};
+#endif
+}
+
+Transaction JsonDB::BeginTransaction() const {
+    std::call_once(state->recovered, [this] { Recover(); });
+    return Transaction(*this);
+}
+
+void JsonDB::Recover() const {
+    std::lock_guard<std::mutex> lock(state->transactionsMutex);
+    std::shared_ptr<IoBackend> io = GetIoBackend();
+    std::unordered_map<std::string, std::string> journals;
+    for (const auto &line : split_lines(io->ReadFiles({transactionsFile})[0])) {
+        nlohmann::json entry = nlohmann::json::parse(line);
+        const std::string marker = "\"txn\":" + entry.at("txn").dump();
+        for (auto tb = entry.at("tables").begin(); tb != entry.at("tables").end(); ++tb) {
+            const std::string journal = tablesPath + "/" + tb.key() + ".log";
+            if (journals.find(journal) == journals.end()) {
+                std::vector<std::string> contents = io->ReadFiles({tablesPath + "/" + tb.key() + ".json", journal});
+                std::uint64_t fileChecksum = checksum(contents[0].data(), contents[0].size());
+                std::vector<std::string> lines = split_lines(contents[1]);
+                if (!contents[0].empty() && (lines.empty() || !journal_current(lines.front(), fileChecksum))) {
+                    contents[1] = journal_header(fileChecksum);
+                    io->WriteFile(journal, contents[1], false);
+                }
+                journals[journal] = std::move(contents[1]);
+            }
+            // the transaction was logged but never reached this journal
+            if (journals[journal].find(marker) == std::string::npos) {
+                nlohmann::json record = {{"op", "batch"}, {"txn", entry.at("txn")}, {"records", tb.value()}};
+                io->AppendFile(journal, record.dump() + "\n", false);
+            }
+        }
+    }
+    std::vector<std::string> paths;
+    for (const auto &journal : journals) {
+        paths.push_back(journal.first);
+    }
+    io->SyncFiles(paths);
+    std::filesystem::remove(transactionsFile);
+}
+
+void JsonDB::Checkpoint() const {
+    std::lock_guard<std::mutex> lock(state->transactionsMutex);
+    std::shared_ptr<IoBackend> io = GetIoBackend();
+    std::set<std::string> tables;
+    for (const auto &line : split_lines(io->ReadFiles({transactionsFile})[0])) {
+        nlohmann::json entry = nlohmann::json::parse(line);
+        for (auto tb = entry.at("tables").begin(); tb != entry.at("tables").end(); ++tb) {
+            tables.insert(tb.key());
+        }
+    }
+    // once the journals are on disk the log entries are no longer needed
+    std::vector<std::string> paths;
+    for (const auto &tb : tables) {
+        paths.push_back(tablesPath + "/" + tb + ".log");
+    }
+    io->SyncFiles(paths);
+    std::filesystem::remove(transactionsFile);
+}
+
+bool JsonDB::Create() {
+    JSONDB_MEASURE(*state, Operation::DatabaseCreate);
+    if(this->Exists()){
+        return false;
+    }
+    try {
+        nlohmann::json db;
+        db["name"] = name;
+        db["tables"] = {};
+
+        std::filesystem::create_directory(path);
+        std::filesystem::create_directory(tablesPath);
+        std::ofstream dbFile(file);
+        dbFile << db << std::endl;
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool JsonDB::Snapshot(const std::string &destPath) const {
+    JSONDB_MEASURE(*state, Operation::Snapshot);
+    // files still growing, copied up to their size at the consistency point
+    struct Growing {
+        int fd;
+        std::uint64_t size;
+        std::string dest;
+    };
+    std::vector<Growing> growing;
+    bool created = false;
+    bool ok = true;
+    try {
+        const std::string destFile = destPath + "/" + name + ".json";
+        const std::string destTables = destPath + "/" + name;
+        // never write through an existing file, it may be a link to a table
+        if (std::filesystem::exists(destFile) ||
+            (std::filesystem::exists(destTables) && !std::filesystem::is_empty(destTables))) {
+            throw std::runtime_error("Snapshot already exists: " + destFile);
+        }
+        std::filesystem::create_directories(destTables);
+        created = true;
+        std::shared_ptr<IoBackend> io = GetIoBackend();
+        std::string catalog;
+        std::vector<std::string> tables;
+        std::vector<std::string> indexFiles;
+        {
+            // held until the files are linked, so no table is created or
+            // dropped between the catalog and its files
+            std::lock_guard<std::mutex> catalogLock(state->catalogMutex);
+            catalog = io->ReadFiles({file})[0];
+            const nlohmann::json parsed = nlohmann::json::parse(catalog);
+            for (const auto &tb : parsed.at("tables")) {
+                tables.push_back(tb.at("name"));
+                indexFiles.push_back(tables.back() + ".pk");
+                for (const auto &index : tb.value("indexes", nlohmann::json::array())) {
+                    indexFiles.push_back(index.at("file"));
+                }
+            }
+            // locked in name order like transactions, and with the table
+            // writers the transaction log and compactions are blocked too
+            std::sort(tables.begin(), tables.end());
+            std::vector<std::unique_lock<std::mutex>> locks;
+            for (const auto &tb : tables) {
+                locks.emplace_back(GetTableState(tb)->writeMutex);
+            }
+            // a journal or transaction log may not exist yet, a table file must
+            auto grow = [&](const std::string &source, const std::string &dest, bool required) {
+                std::error_code error;
+                std::uintmax_t size = std::filesystem::file_size(source, error);
+                if (error) {
+                    if (required || error != std::errc::no_such_file_or_directory) {
+                        throw std::runtime_error("Error reading " + source + ": " + error.message());
+                    }
+                    return;
+                }
+                int fd = open_file(source, OpenMode::Read);
+                if (fd < 0) {
+                    throw std::runtime_error("Error opening: " + source);
+                }
+                growing.push_back({fd, size, dest});
+            };
+            for (const auto &tb : tables) {
+                const std::string source = tablesPath + "/" + tb;
+                std::error_code error;
+                std::filesystem::create_hard_link(source + ".json", destTables + "/" + tb + ".json", error);
+                if (error) {
+                    grow(source + ".json", destTables + "/" + tb + ".json", true);
+                }
+                grow(source + ".log", destTables + "/" + tb + ".log", false);
+            }
+            grow(transactionsFile, destPath + "/" + name + ".txn", false);
+        }
+
+        for (const auto &copy : growing) {
+            copy_prefix(copy.fd, copy.size, copy.dest);
+        }
+        // index files are checked against their table file when loaded,
+        // so a stale copy is only rebuilt
+        std::sort(indexFiles.begin(), indexFiles.end());
+        indexFiles.erase(std::unique(indexFiles.begin(), indexFiles.end()), indexFiles.end());
+        for (const auto &index : indexFiles) {
+            std::error_code error;
+            std::filesystem::copy_file(tablesPath + "/" + index, destTables + "/" + index, error);
+        }
+        // the catalog goes last, a snapshot without it does not open
+        io->WriteFile(destFile, catalog, true);
+    } catch (const std::exception &e) {
+        std::cerr << "Error during database snapshot: " << e.what() << std::endl;
+        ok = false;
+    }
+    for (const auto &copy : growing) {
+        close_file(copy.fd);
+    }
+    if (!ok && created) {
+        std::error_code error;
+        std::filesystem::remove_all(destPath + "/" + name, error);
+    }
+    return ok;
+}
+
+bool JsonDB::Join(const std::string &left, const std::string &right, const JoinOptions &options,
+                  const std::function<void(nlohmann::json &&document)> &sink) const {
+    JSONDB_MEASURE(*state, Operation::Join);
+    try {
+        Table leftTable(left, *this);
+        Table rightTable(right, *this);
+        auto leftData = leftTable.Snapshot();
+        auto rightData = rightTable.Snapshot();
+        const std::uint32_t leftKey = leftData->keys->Find(options.leftField);
+        const std::uint32_t rightKey = rightData->keys->Find(options.rightField);
+
+        // index of the join field of a document, 0 when it has none
+        auto field = [](const TableData &data, std::uint32_t key, std::size_t pos) -> std::size_t {
+            const auto &document = data.documents[pos];
+            return document && key != KeyDictionary::npos ? document->Find(key) : 0;
+        };
+        const std::string &as = options.as.empty() ? right : options.as;
+        // passes a left document on with the right documents it matched
+        auto emit = [&](std::size_t pos, const std::vector<std::size_t> *matches) {
+            nlohmann::json document = leftData->Json(pos);
+            if (document.is_object()) {
+                nlohmann::json &joined = document[as] = nlohmann::json::array();
+                for (std::size_t i = 0; matches != nullptr && i < matches->size(); i++) {
+                    joined.push_back(rightData->Json((*matches)[i]));
+                }
+            }
+            sink(std::move(document));
+        };
+
+        if (!rightData->options.primaryKey.empty() && options.rightField == rightData->options.primaryKey) {
+            std::vector<std::size_t> matches;
+            for (std::size_t pos = 0; pos < leftData->documents.size(); pos++) {
+                if (!leftData->documents[pos]) {
+                    continue;
+                }
+                matches.clear();
+                if (std::size_t value = field(*leftData, leftKey, pos)) {
+                    std::ptrdiff_t found =
+                        rightData->Find(leftData->documents[pos]->Materialize<nlohmann::json>(value, *leftData->keys));
+                    if (found >= 0) {
+                        matches.push_back(static_cast<std::size_t>(found));
+                    }
+                }
+                emit(pos, &matches);
+            }
+            return true;
+        }
+
+        const bool buildLeft = leftData->live < rightData->live;
+        const TableData &build = buildLeft ? *leftData : *rightData;
+        const TableData &probe = buildLeft ? *rightData : *leftData;
+        const std::uint32_t buildKey = buildLeft ? leftKey : rightKey;
+        const std::uint32_t probeKey = buildLeft ? rightKey : leftKey;
+        auto text = [&field](const TableData &data, std::uint32_t key, std::size_t pos, std::string &out) {
+            std::size_t value = field(data, key, pos);
+            out.clear();
+            if (value != 0) {
+                data.documents[pos]->Serialize(value, out, *data.keys);
+            }
+            return value != 0;
+        };
+
+        // the keys are hashed once, a pass only serializes the documents of
+        // its partition again; documents without a key belong to none
+        const std::size_t none = std::numeric_limits<std::size_t>::max();
+        std::hash<std::string> hash;
+        std::string key;
+        std::size_t bytes = 0;
+        auto hashes = [&](const TableData &data, std::uint32_t dataKey, bool measure) {
+            std::vector<std::size_t> result(data.documents.size(), none);
+            for (std::size_t pos = 0; pos < data.documents.size(); pos++) {
+                if (text(data, dataKey, pos, key)) {
+                    result[pos] = std::min(hash(key), none - 1);
+                    // keys and their position lists, with the overhead of the map nodes
+                    bytes += measure ? key.size() + 64 : 0;
+                }
+            }
+            return result;
+        };
+        const std::vector<std::size_t> buildHashes = hashes(build, buildKey, true);
+        const std::vector<std::size_t> probeHashes = hashes(probe, probeKey, false);
+        const std::size_t passes = std::max<std::size_t>(1, (bytes + options.maxBuildBytes - 1) /
+                                                                 std::max<std::size_t>(1, options.maxBuildBytes));
+        const std::vector<std::size_t> &leftHashes = buildLeft ? buildHashes : probeHashes;
+
+        // each pass holds the hash table of one partition of the keys and
+        // passes on the left documents of that partition, in table order;
+        // left documents without a key go with the first one
+        for (std::size_t pass = 0; pass < passes; pass++) {
+            std::unordered_map<std::string, std::vector<std::size_t>> table;
+            for (std::size_t pos = 0; pos < build.documents.size(); pos++) {
+                if (buildHashes[pos] != none && buildHashes[pos] % passes == pass) {
+                    text(build, buildKey, pos, key);
+                    table[key].push_back(pos);
+                }
+            }
+            // right documents matched by each left one of the partition
+            // when the left side is built
+            std::unordered_map<std::size_t, std::vector<std::size_t>> matched;
+            if (buildLeft) {
+                for (std::size_t pos = 0; pos < probe.documents.size(); pos++) {
+                    if (probeHashes[pos] == none || probeHashes[pos] % passes != pass) {
+                        continue;
+                    }
+                    text(probe, probeKey, pos, key);
+                    auto found = table.find(key);
+                    for (std::size_t i = 0; found != table.end() && i < found->second.size(); i++) {
+                        matched[found->second[i]].push_back(pos);
+                    }
+                }
+            }
+            for (std::size_t pos = 0; pos < leftData->documents.size(); pos++) {
+                if (!leftData->documents[pos] ||
+                    (leftHashes[pos] == none ? pass != 0 : leftHashes[pos] % passes != pass)) {
+                    continue;
+                }
+                const std::vector<std::size_t> *matches = nullptr;
+                if (buildLeft) {
+                    auto found = matched.find(pos);
+                    matches = found == matched.end() ? nullptr : &found->second;
+                } else if (leftHashes[pos] != none) {
+                    text(probe, probeKey, pos, key);
+                    auto found = table.find(key);
+                    matches = found == table.end() ? nullptr : &found->second;
+                }
+                emit(pos, matches);
+            }
+        }
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << "Error joining " << left << " and " << right << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+nlohmann::json JsonDB::Join(const std::string &left, const std::string &right, const JoinOptions &options) const {
+    nlohmann::json result = nlohmann::json::array();
+    if (!Join(left, right, options, [&result](nlohmann::json &&document) { result.push_back(std::move(document)); })) {
+        return nlohmann::json::array();
+    }
+    return result;
+}
+
+bool JsonDB::Exists() {
+    std::ifstream dbFile(file);
+    if (dbFile.good()) {
+        dbFile.close();
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool JsonDB::Drop() {
+    JSONDB_MEASURE(*state, Operation::DatabaseDrop);
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        for (auto &tb : state->tables) {
+            tb.second->Reset();
+            tb.second->version++;
+            tb.second->cache.Clear();
+        }
+    }
+    std::lock_guard<std::mutex> catalogLock(state->catalogMutex);
+    try {
+        if (std::filesystem::exists(file)) {
+            std::filesystem::remove(file);
+            std::cout << "Database file deleted: " << file << std::endl;
+        } else {
+            throw std::runtime_error("The database file does not exist: " + file);
+        }
+
+        std::filesystem::remove(transactionsFile);
+        if (std::filesystem::exists(tablesPath)) {
+            std::filesystem::remove_all(tablesPath);
+            std::cout << "Database folder deleted: " << tablesPath << std::endl;
+        } else {
+            throw std::runtime_error("The database folder does not exist: " + tablesPath);
+        }
+
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << "Error during database deletion: " << e.what()
+                  << std::endl;
+        return false;
+    }
+}
+
+std::vector<std::unordered_map<std::string, std::string>> JsonDB::Tables() {
+    JSONDB_MEASURE(*state, Operation::Tables);
+    std::vector<std::unordered_map<std::string, std::string>> tables;
+    std::ifstream dbFile(file);
+
+    if (!dbFile.is_open()) {
+        throw std::runtime_error("Unable to open database file");
+    }
+
+    try {
+        nlohmann::json data;
+        dbFile >> data;
+        if (data["tables"].is_array()) {
+            for(auto &tb: data["tables"]){
+                // the index list and other structured settings are left out
+                std::unordered_map<std::string, std::string> table;
+                for (auto it = tb.begin(); it != tb.end(); ++it) {
+                    if (it.value().is_string()) {
+                        table[it.key()] = it.value().get<std::string>();
+                    }
+                }
+                tables.push_back(std::move(table));
+            }
+        } else {
+            throw std::runtime_error("Invalid database format: 'tables' not found or not an array");
+        }
+    } catch (const nlohmann::json::exception& e) {
+        throw std::runtime_error("Error parsing database file: " + std::string(e.what()));
+    }
+
+    return tables;
+}
+
+
+Table::~Table() = default;
+Table::Table(const std::string &tableName, const JsonDB &database)
+    : name(tableName),
+      db(database),
+      file(database.GetTablesPath() + "/" + tableName + ".json"),
+      journal(database.GetTablesPath() + "/" + tableName + ".log"),
+      idsFile(database.GetTablesPath() + "/" + tableName + ".pk"),
+      state(database.GetTableState(tableName)) {}
+
+std::string Table::GetName() const { return name; }
+
+std::uint64_t Table::GetVersion() const { return state->version; }
+
+std::uint64_t Table::SyncVersion() const {
+    try {
+        Snapshot();
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return state->version;
+}
+
+void Table::SetQueryCacheCapacity(std::size_t capacityBytes) {
+    state->cache.SetCapacity(capacityBytes);
+}
+
+QueryCacheStats Table::GetQueryCacheStats() const {
+    return state->cache.Stats();
+}
+
+void Table::Touch() {
+    state->version++;
+    state->cache.Clear();
+}
+
+std::shared_ptr<const TableData> Table::Snapshot() const {
+    std::shared_ptr<const TableData> current;
+    {
+        std::lock_guard<std::mutex> lock(state->snapshotMutex);
+        current = state->snapshot;
+    }
+    if (current && current->stamp == stamp_files(file, journal)) {
+        return current;
+    }
+    std::call_once(db.state->recovered, [this] { db.Recover(); });
+    // one load at a time, so that the index files it may rebuild are
+    // written once; the readers waiting for it take its result
+    std::lock_guard<std::mutex> loading(state->loadMutex);
+    {
+        std::lock_guard<std::mutex> lock(state->snapshotMutex);
+        if (state->snapshot && state->snapshot != current &&
+            state->snapshot->stamp == stamp_files(file, journal)) {
+            return state->snapshot;
+        }
+    }
+    auto loaded = std::make_shared<const TableData>(Load());
+    {
+        // a writer may have installed a newer snapshot in the meantime
+        std::lock_guard<std::mutex> lock(state->snapshotMutex);
+        if (state->snapshot == current) {
+            state->snapshot = loaded;
+        }
+    }
+    if (current) {
+        // the files were changed by another instance, cached results of the
+        // previous snapshot are stale
+        state->version++;
+        state->cache.Clear();
+    }
+    return loaded;
+}
+
+TableData Table::Load() const {
+    JSONDB_MEASURE(*db.state, Operation::Load);
+    std::shared_lock<std::shared_mutex> lock(state->filesMutex);
+    TableData data;
+    read_options(db.GetFile(), name, db.GetTablesPath(), data);
+    data.stamp = stamp_files(file, journal);
+
+    // the table and its journal are read in one batch, the index files are
+    // mapped
+    std::shared_ptr<IoBackend> io = db.GetIoBackend();
+    std::vector<std::string> contents = io->ReadFiles({file, journal});
+    if (contents[0].empty()) {
+        throw std::runtime_error("Error opening: " + file);
+    }
+    JSONDB_COUNT(*db.state, bytesRead, contents[0].size() + contents[1].size());
+    data.fileChecksum = checksum(contents[0].data(), contents[0].size());
+
+    {
+        JSONDB_TIME(*db.state, parseNanos);
+        nlohmann::json documents = nlohmann::json::parse(contents[0]);
+        contents[0].clear();
+        if (!documents.is_array()) {
+            throw std::runtime_error("Invalid table format: " + file);
+        }
+        data.documents.reserve(documents.size());
+        for (auto &document : documents) {
+            data.documents.push_back(data.Make(std::move(document)));
+        }
+        data.live = data.documents.size();
+    }
+
+    open_indexes(*io, data);
+
+    std::vector<std::string> lines = split_lines(contents[1]);
+    data.journalStale = !lines.empty() && !journal_current(lines.front(), data.fileChecksum);
+    for (std::size_t i = 0; i < lines.size() && !data.journalStale; i++) {
+        apply_record(data, nlohmann::json::parse(lines[i]));
+    }
+    return data;
+}
+
+void Table::Store(TableData &data) {
+    const std::string tmpFile = file + ".tmp";
+    std::shared_ptr<IoBackend> io = db.GetIoBackend();
+    std::string content = "[";
+    {
+        JSONDB_TIME(*db.state, serializeNanos);
+        for (const auto &document : data.documents) {
+            if (document) {
+                content += content.size() > 1 ? "," : "";
+                content += document->Json(*data.keys).dump();
+            }
+        }
+        content += ']';
+    }
+    JSONDB_COUNT(*db.state, bytesWritten, content.size());
+    // the new file has to be on disk before it replaces the old one and
+    // the journal goes away
+    io->WriteFile(tmpFile, content, true);
+
+    // the journal is about to go away, so transactions logged for it must
+    // not be replayed again
+    std::error_code error;
+    if (std::filesystem::file_size(db.transactionsFile, error) > 0 && !error) {
+        db.Checkpoint();
+    }
+
+    {
+        // the new table file already contains every journal record
+        std::unique_lock<std::shared_mutex> lock(state->filesMutex);
+        std::filesystem::rename(tmpFile, file);
+        io->SyncFiles({db.GetTablesPath()});
+        std::filesystem::remove(journal);
+        data.stamp = stamp_files(file, journal);
+    }
+    data.fileChecksum = checksum(content.data(), content.size());
+    data.journalStale = false;
+
+    // positions changed, start a new generation of the indexes
+    DocumentStore documents;
+    documents.reserve(data.live);
+    for (const auto &document : data.documents) {
+        if (document) {
+            documents.push_back(document);
+        }
+    }
+    data.documents = std::move(documents);
+    open_indexes(*io, data);
+}
+
+void Table::Append(TableData &data, const nlohmann::json &record) {
+    std::string line;
+    {
+        JSONDB_TIME(*db.state, serializeNanos);
+        line = record.dump() + "\n";
+    }
+    std::error_code error;
+    if (data.journalStale || std::filesystem::file_size(journal, error) == 0 || error) {
+        // a new journal, or one left behind by an interrupted compaction,
+        // starts over with the checksum of the table file it applies to
+        line = journal_header(data.fileChecksum) + line;
+        JSONDB_COUNT(*db.state, bytesWritten, line.size());
+        db.GetIoBackend()->WriteFile(journal, line, false);
+        data.journalStale = false;
+        return;
+    }
+    JSONDB_COUNT(*db.state, bytesWritten, line.size());
+    db.GetIoBackend()->AppendFile(journal, line, false);
+}
+
+void Table::Commit(const TableData &base, TableData &&data, const nlohmann::json &record) {
+    Append(data, record);
+    Publish(base, std::move(data), record);
+}
+
+void Table::Publish(const TableData &base, TableData &&data, const nlohmann::json &record) {
+    ChangeCollector collector(base);
+    collector.Collect(record);
+    std::vector<ChangeEvent> &changes = collector.changes;
+
+    data.stamp = stamp_files(file, journal);
+    const bool compact = needs_compaction(data, state->compactionThreshold);
+    {
+        std::lock_guard<std::mutex> lock(state->snapshotMutex);
+        state->snapshot = std::make_shared<const TableData>(std::move(data));
+    }
+    Touch();
+
+    std::vector<std::pair<nlohmann::json, ChangeCallback>> watchers;
+    {
+        std::lock_guard<std::mutex> lock(state->watchMutex);
+        for (const auto &watcher : state->watchers) {
+            watchers.push_back(watcher.second);
+        }
+    }
+    for (auto &change : changes) {
+        for (const auto &watcher : watchers) {
+            if (match_query(change.document, watcher.first)) {
+                ChangeEvent event = change;
+                event.sequence = state->changes.Last() + 1;
+                watcher.second(event);
+            }
+        }
+        state->changes.Push(std::move(change));
+    }
+
+    // the journal is folded on the executor, the writer does not wait for it
+    if (compact && !state->compactionQueued.exchange(true)) {
+        DatabaseState *dbState = begin_operation(*db.state);
+        db.GetExecutor()->Submit([table = *this, dbState]() mutable {
+            table.state->compactionQueued = false;
+            try {
+                if (needs_compaction(*table.Snapshot(), table.state->compactionThreshold)) {
+                    table.Compact();
+                }
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << std::endl;
+            }
+            end_operation(*dbState);
+        });
+    }
+}
+
+bool Table::Update(const nlohmann::json &update, const nlohmann::json &query, bool many) {
+    JSONDB_MEASURE(*db.state, many ? Operation::UpdateDocuments : Operation::UpdateDocument);
+    SlowLogScope slow(*state, many ? Operation::UpdateDocuments : Operation::UpdateDocument, name, &query);
+    try {
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        nlohmann::json operators = normalize_update(update);
+        std::shared_ptr<const TableData> base = Snapshot();
+        TableData data = *base;
+        if (data.live < 1) {
+            return false;
+        }
+        nlohmann::json positions = nlohmann::json::array();
+        Matcher matcher(query, *data.keys);
+        QueryPlan plan(data, query, matcher);
+        slow.Plan(plan.Name(), plan.Scan(data, [&](std::size_t i) {
+            if (!data.Matches(i, matcher)) {
+                return true;
+            }
+            data.Replace(i, update_document(data, data.Json(i), operators));
+            positions.push_back(i);
+            return many;
+        }));
+        if (!positions.empty()) {
+            Commit(*base, std::move(data), {{"op", "update"}, {"pos", positions}, {"update", operators}});
+        }
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool Table::Create() {
+    return Create(TableOptions());
+}
+
+bool Table::Create(const TableOptions &options) {
+    JSONDB_MEASURE(*db.state, Operation::TableCreate);
+    try {
+        std::lock_guard<std::mutex> catalogLock(db.state->catalogMutex);
+        nlohmann::json data;
+        std::ifstream dbFileIn(db.GetFile());
+
+        if (!dbFileIn.is_open()) {
+            throw std::runtime_error("Error opening: " + db.GetFile());
+        }
+
+        dbFileIn >> data;
+        dbFileIn.close();
+
+        auto tables = data["tables"];
+
+        std::set<std::string> existingTables;
+        for (const auto &tb : tables) {
+            existingTables.insert(tb["name"]);
+        }
+
+        if (existingTables.find(name) != existingTables.end()) {
+            throw std::runtime_error("Error: " + name + "'s table already exists");
+        }
+
+        nlohmann::json newTable = {{"name", name}};
+        nlohmann::json indexes = nlohmann::json::array();
+        if (!options.primaryKey.empty()) {
+            const char *generators[] = {"none", "monotonic", "objectid"};
+            newTable["primaryKey"] = options.primaryKey;
+            newTable["idGenerator"] = generators[static_cast<int>(options.idGenerator)];
+            indexes.push_back(index_entry("primary", options.primaryKey, name + ".pk"));
+        }
+        for (const auto &field : options.textIndexes) {
+            indexes.push_back(index_entry("text", field, text_index_file(name, indexes.size())));
+        }
+        if (!indexes.empty()) {
+            newTable["indexes"] = indexes;
+        }
+        tables.push_back(newTable);
+        data["tables"] = tables;
+
+        std::ofstream dbFileOut(db.GetFile(), std::ios::out | std::ios::trunc);
+        dbFileOut << data << std::endl;
+
+        // table files are replaced, never rewritten in place, since
+        // snapshots of the database may hard-link them
+        std::filesystem::remove(journal);
+        std::filesystem::remove(idsFile);
+        for (const auto &index : indexes) {
+            std::filesystem::remove(db.GetTablesPath() + "/" + index["file"].get<std::string>());
+        }
+        std::filesystem::remove(file);
+        db.GetIoBackend()->WriteFile(file, "[]", false);
+        state->Reset();
+        Touch();
+
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+TableOptions Table::GetOptions() {
+    try {
+        return Snapshot()->options;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return TableOptions();
+    }
+}
+
+bool Table::CreateTextIndex(const std::string &field) {
+    try {
+        std::lock_guard<std::mutex> catalogLock(db.state->catalogMutex);
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        std::ifstream dbFileIn(db.GetFile());
+        if (!dbFileIn.is_open()) {
+            throw std::runtime_error("Error opening: " + db.GetFile());
+        }
+        nlohmann::json data;
+        dbFileIn >> data;
+        dbFileIn.close();
+
+        auto &tables = data["tables"];
+        auto table = std::find_if(tables.begin(), tables.end(),
+                                  [this](const nlohmann::json &tb) { return tb["name"] == name; });
+        if (table == tables.end()) {
+            throw std::runtime_error("Error: " + name + "'s table does not exist");
+        }
+        nlohmann::json &indexes = (*table)["indexes"];
+        if (indexes.is_null()) {
+            indexes = nlohmann::json::array();
+        }
+        for (const auto &index : indexes) {
+            if (index["type"] == "text" && index["field"] == field) {
+                return true;
+            }
+        }
+        // built by the next load of the table
+        indexes.push_back(index_entry("text", field, text_index_file(name, indexes.size())));
+        std::filesystem::remove(db.GetTablesPath() + "/" + indexes.back()["file"].get<std::string>());
+
+        std::ofstream dbFileOut(db.GetFile(), std::ios::out | std::ios::trunc);
+        dbFileOut << data << std::endl;
+        dbFileOut.close();
+        // the next snapshot is loaded with the index
+        state->Reset();
+        Touch();
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << "Error creating text index on " << field << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool Table::Exists() {
+    try{
+        std::ifstream dbFile(db.GetFile());
+
+        if (!dbFile.is_open()) {
+            std::cerr << "Error opening: " + db.GetFile() << std::endl;
+            return false;
+        }
+
+        nlohmann::json data;
+        dbFile >> data;
+        auto &tables = data["tables"];
+        for (const auto &tb : tables) {
+            if (tb["name"] == name) {
+                dbFile.close();
+                return true;
+            }
+        }
+        return false;
+    } catch (const std::exception &e){
+        std::cerr << "Error reading JSON data from: " + db.GetFile()
+                  << std::endl;
+        return false;
+    }
+}
+
+bool Table::Drop() {
+    JSONDB_MEASURE(*db.state, Operation::TableDrop);
+    std::lock_guard<std::mutex> catalogLock(db.state->catalogMutex);
+    std::fstream dbFile(db.GetFile(), std::ios::in | std::ios::out);
+
+    if (!dbFile.is_open()) {
+        std::cerr << "Error opening: " + db.GetFile() << std::endl;
+        return false;
+    }
+
+    nlohmann::json data;
+    dbFile >> data;
+    dbFile.close();
+    auto &tables = data["tables"];
+    for (auto it = tables.begin(); it != tables.end(); ++it) {
+        if ((*it)["name"] == name) {
+            const nlohmann::json indexes = it->value("indexes", nlohmann::json::array());
+            tables.erase(it);
+            dbFile.open(db.GetFile(),
+                        std::ofstream::out | std::ofstream::trunc);
+            dbFile.seekp(0, std::ios::beg);
+            dbFile << data;
+            dbFile.close();
+            state->Reset();
+            Touch();
+
+            std::filesystem::remove(journal);
+            std::filesystem::remove(idsFile);
+            for (const auto &index : indexes) {
+                std::filesystem::remove(db.GetTablesPath() + "/" + index["file"].get<std::string>());
+            }
+            if (std::filesystem::remove(file)) {
+                std::cout << "Table file deleted: " << file << std::endl;
+            } else {
+                std::cerr << "Error deleting table file: " << file << std::endl;
+            }
+            return true;
+        }
+    }
+
+    std::cerr << "Error: table does not exist " + name << std::endl;
+    dbFile.close();
+    return false;
+}
+bool Table::Delete(const nlohmann::json &query, bool many) {
+    JSONDB_MEASURE(*db.state, many ? Operation::DeleteDocuments : Operation::DeleteDocument);
+    SlowLogScope slow(*state, many ? Operation::DeleteDocuments : Operation::DeleteDocument, name, &query);
+    try {
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        std::shared_ptr<const TableData> base = Snapshot();
+        TableData data = *base;
+        if (data.live < 1) {
+            return false;
+        }
+        nlohmann::json positions = nlohmann::json::array();
+        Matcher matcher(query, *data.keys);
+        QueryPlan plan(data, query, matcher);
+        slow.Plan(plan.Name(), plan.Scan(data, [&](std::size_t i) {
+            if (!data.Matches(i, matcher)) {
+                return true;
+            }
+            positions.push_back(i);
+            data.Remove(i);
+            return many;
+        }));
+        if (!positions.empty()) {
+            Commit(*base, std::move(data), {{"op", "delete"}, {"pos", positions}});
+        }
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool Table::InsertDocument(const nlohmann::json &document) {
+    nlohmann::json id;
+    return InsertDocument(document, id);
+}
+bool Table::InsertDocument(const nlohmann::json &document, nlohmann::json &id) {
+    JSONDB_MEASURE(*db.state, Operation::InsertDocument);
+    SlowLogScope slow(*state, Operation::InsertDocument, name);
+    try {
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        std::shared_ptr<const TableData> base = Snapshot();
+        TableData data = *base;
+        nlohmann::json stored = document;
+        assign_key(data, stored);
+        id = data.options.primaryKey.empty() ? nlohmann::json() : stored[data.options.primaryKey];
+        nlohmann::json record = {{"op", "insert"}, {"doc", stored}};
+        data.Add(std::move(stored));
+        Commit(*base, std::move(data), record);
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+nlohmann::json Table::FindDocument() {
+    return FindDocument(nullptr);
+}
+nlohmann::json Table::FindDocument(const nlohmann::json &query) {
+    JSONDB_MEASURE(*db.state, Operation::FindDocument);
+    SlowLogScope slow(*state, Operation::FindDocument, name, &query);
+    const std::string key = QueryCache::MakeKey("FindDocument", query);
+    nlohmann::json result = nlohmann::json::object();
+    try {
+        // the version is read before the snapshot, so a result is never
+        // cached under a version newer than its data; the snapshot notices
+        // when other instances changed the files
+        const std::uint64_t version = state->version;
+        auto data = Snapshot();
+        if (state->cache.Get(key, state->version, result)) {
+            slow.Plan("cache", 0);
+            return result;
+        }
+        Matcher matcher(query, *data->keys);
+        QueryPlan plan(*data, query, matcher);
+        std::size_t scanned = plan.Scan(*data, [&](std::size_t i) {
+            if (!data->Matches(i, matcher)) {
+                return true;
+            }
+            result = data->Json(i);
+            JSONDB_COUNT(*db.state, documentsReturned, 1);
+            return false;
+        });
+        slow.Plan(plan.Name(), scanned);
+        JSONDB_COUNT(*db.state, documentsScanned, scanned);
+        state->cache.Put(key, version, result);
+        return result;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::object();
+    }
+}
+nlohmann::json Table::FindDocuments() {
+    return FindDocuments(nullptr);
+}
+nlohmann::json Table::FindDocuments(const nlohmann::json &query) {
+    JSONDB_MEASURE(*db.state, Operation::FindDocuments);
+    SlowLogScope slow(*state, Operation::FindDocuments, name, &query);
+    const std::string key = QueryCache::MakeKey("FindDocuments", query);
+    nlohmann::json result = nlohmann::json::array();
+    try {
+        // see FindDocument
+        const std::uint64_t version = state->version;
+        auto data = Snapshot();
+        if (state->cache.Get(key, state->version, result)) {
+            slow.Plan("cache", 0);
+            return result;
+        }
+        Matcher matcher(query, *data->keys);
+        QueryPlan plan(*data, query, matcher);
+        std::size_t scanned = plan.Scan(*data, [&](std::size_t i) {
+            if (data->Matches(i, matcher)) {
+                result.push_back(data->Json(i));
+            }
+            return true;
+        });
+        slow.Plan(plan.Name(), scanned);
+        JSONDB_COUNT(*db.state, documentsScanned, scanned);
+        JSONDB_COUNT(*db.state, documentsReturned, result.size());
+        state->cache.Put(key, version, result);
+
+        return result;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::array();
+    }
+}
+
+bool Table::FindDocuments(const nlohmann::json &query, ArenaJson &results) {
+    JSONDB_MEASURE(*db.state, Operation::FindDocuments);
+    SlowLogScope slow(*state, Operation::FindDocuments, name, &query);
+    try {
+        auto data = Snapshot();
+        if (!results.is_array()) {
+            results = ArenaJson::array();
+        }
+        Matcher matcher(query, *data->keys);
+        QueryPlan plan(*data, query, matcher);
+        std::size_t scanned = plan.Scan(*data, [&](std::size_t i) {
+            if (data->Matches(i, matcher)) {
+                results.push_back(data->documents[i]->Materialize<ArenaJson>(*data->keys));
+                JSONDB_COUNT(*db.state, documentsReturned, 1);
+            }
+            return true;
+        });
+        slow.Plan(plan.Name(), scanned);
+        JSONDB_COUNT(*db.state, documentsScanned, scanned);
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+nlohmann::json Table::Explain(const nlohmann::json &query, const ExplainOptions &options) {
+    using Clock = std::chrono::steady_clock;
+    auto micros = [](Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::micro>(to - from).count();
+    };
+    try {
+        const Clock::time_point start = Clock::now();
+        std::shared_ptr<const TableData> resident;
+        {
+            std::lock_guard<std::mutex> lock(state->snapshotMutex);
+            resident = state->snapshot;
+        }
+        auto data = Snapshot();
+        const Clock::time_point loaded = Clock::now();
+        Matcher matcher(query, *data->keys);
+        QueryPlan plan(*data, query, matcher);
+        const Clock::time_point planned = Clock::now();
+
+        nlohmann::json description = {{"type", plan.Name()}};
+        if (!plan.index.empty()) {
+            description["index"] = plan.index;
+        }
+        nlohmann::json result = {
+            {"table", name},
+            {"query", query},
+            {"operation", options.first ? "FindDocument" : "FindDocuments"},
+            {"plan", description},
+            {"segments", {{"total", 1}, {"pruned", plan.type == QueryPlan::Empty ? 1 : 0}}},
+            {"estimated", {{"documentsExamined", plan.Candidates(*data)}}},
+        };
+        if (!options.execute) {
+            return result;
+        }
+
+        std::vector<std::size_t> matches;
+        std::size_t examined = plan.Scan(*data, [&](std::size_t i) {
+            if (data->Matches(i, matcher)) {
+                matches.push_back(i);
+                return !options.first;
+            }
+            return true;
+        });
+        const Clock::time_point matched = Clock::now();
+        for (std::size_t i : matches) {
+            data->Json(i);
+        }
+        const Clock::time_point materialized = Clock::now();
+
+        result["actual"] = {{"documentsExamined", examined}, {"documentsReturned", matches.size()}};
+        result["timeUs"] = {{"load", micros(start, loaded)},
+                            {"plan", micros(loaded, planned)},
+                            {"match", micros(planned, matched)},
+                            {"materialize", micros(matched, materialized)},
+                            {"total", micros(start, materialized)}};
+        result["cold"] = resident != data;
+        return result;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::object();
+    }
+}
+
+bool Table::FindDocuments(const nlohmann::json &query, RawDocuments &results) {
+    JSONDB_MEASURE(*db.state, Operation::FindDocuments);
+    SlowLogScope slow(*state, Operation::FindDocuments, name, &query);
+    try {
+        auto data = Snapshot();
+        results.buffer = "[";
+        results.offsets.clear();
+        Matcher matcher(query, *data->keys);
+        QueryPlan plan(*data, query, matcher);
+        std::size_t scanned = plan.Scan(*data, [&](std::size_t i) {
+            if (data->Matches(i, matcher)) {
+                results.buffer += results.offsets.empty() ? "" : ",";
+                std::size_t offset = results.buffer.size();
+                JSONDB_TIME(*db.state, serializeNanos);
+                data->documents[i]->Serialize(results.buffer, *data->keys);
+                results.offsets.emplace_back(offset, results.buffer.size() - offset);
+            }
+            return true;
+        });
+        results.buffer += ']';
+        slow.Plan(plan.Name(), scanned);
+        JSONDB_COUNT(*db.state, documentsScanned, scanned);
+        JSONDB_COUNT(*db.state, documentsReturned, results.offsets.size());
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        results.buffer = "[]";
+        results.offsets.clear();
+        return false;
+    }
+}
+
+nlohmann::json Table::FindDocuments(const nlohmann::json &query, const std::vector<std::string> &fields,
+                                    const std::function<bool(const FieldValue *values)> &predicate) {
+    JSONDB_MEASURE(*db.state, Operation::FindDocuments);
+    SlowLogScope slow(*state, Operation::FindDocuments, name, &query);
+    nlohmann::json result = nlohmann::json::array();
+    try {
+        auto data = Snapshot();
+        std::vector<std::uint32_t> ids;
+        for (const auto &field : fields) {
+            ids.push_back(data->keys->Find(field));
+        }
+        std::vector<FieldValue> values(fields.size());
+        Matcher matcher(query, *data->keys);
+        QueryPlan plan(*data, query, matcher);
+        std::size_t scanned = plan.Scan(*data, [&](std::size_t i) {
+            const auto &document = data->documents[i];
+            if (!document) {
+                return true;
+            }
+            for (std::size_t f = 0; f < ids.size(); f++) {
+                std::size_t value = ids[f] == KeyDictionary::npos ? 0 : document->Find(ids[f]);
+                values[f] = value == 0 ? FieldValue() : document->FieldAt(value);
+            }
+            if (predicate(values.data())) {
+                result.push_back(data->Json(i));
+            }
+            return true;
+        });
+        slow.Plan(plan.Name(), scanned);
+        JSONDB_COUNT(*db.state, documentsScanned, scanned);
+        JSONDB_COUNT(*db.state, documentsReturned, result.size());
+        return result;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::array();
+    }
+}
+
+bool Table::ReadFields(const std::vector<std::string> &fields,
+                       const std::function<void(const FieldValue *values)> &row) const {
+    try {
+        auto data = Snapshot();
+        std::vector<std::uint32_t> ids;
+        for (const auto &field : fields) {
+            ids.push_back(data->keys->Find(field));
+        }
+        std::vector<FieldValue> values(fields.size());
+        for (const auto &document : data->documents) {
+            if (!document) {
+                continue;
+            }
+            for (std::size_t f = 0; f < ids.size(); f++) {
+                std::size_t value = ids[f] == KeyDictionary::npos ? 0 : document->Find(ids[f]);
+                values[f] = value == 0 ? FieldValue() : document->FieldAt(value);
+            }
+            row(values.data());
+        }
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool Table::WriteRows(std::uint64_t version, const std::vector<std::size_t> &rows,
+                      const std::vector<nlohmann::json> &values) {
+    const bool remove = values.empty();
+    JSONDB_MEASURE(*db.state, remove ? Operation::DeleteDocuments : Operation::UpdateDocuments);
+    SlowLogScope slow(*state, remove ? Operation::DeleteDocuments : Operation::UpdateDocuments, name);
+    try {
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        std::shared_ptr<const TableData> base = Snapshot();
+        if (state->version != version) {
+            return false;
+        }
+        if (!remove && values.size() != rows.size()) {
+            throw std::invalid_argument("WriteRows needs one value per row");
+        }
+        TableData data = *base;
+        // rows skip the deleted documents, positions do not
+        std::vector<std::size_t> positions;
+        std::size_t row = 0;
+        for (std::size_t i = 0; i < data.documents.size() && positions.size() < rows.size(); i++) {
+            if (data.documents[i] && row++ == rows[positions.size()]) {
+                positions.push_back(i);
+            }
+        }
+        slow.Plan("rowSeek", row);
+        if (positions.size() < rows.size()) {
+            throw std::out_of_range("Row " + std::to_string(rows[positions.size()]) + " is not in " + name);
+        }
+        if (positions.empty()) {
+            return true;
+        }
+        nlohmann::json record;
+        if (remove) {
+            for (std::size_t pos : positions) {
+                data.Remove(pos);
             }
-            break;
-        default:
-            result = false;
+            record = {{"op", "delete"}, {"pos", positions}};
+        } else {
+            nlohmann::json records = nlohmann::json::array();
+            for (std::size_t i = 0; i < positions.size(); i++) {
+                nlohmann::json operators = normalize_update(values[i]);
+                data.Replace(positions[i], update_document(data, data.Json(positions[i]), operators));
+                records.push_back({{"op", "update"}, {"pos", {positions[i]}}, {"update", operators}});
+            }
+            record = records.size() == 1 ? records[0] : nlohmann::json{{"op", "batch"}, {"records", records}};
+        }
+        Commit(*base, std::move(data), record);
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
     }
-    return result;
 }
-bool match_query(const nlohmann::json &document, const nlohmann::json &query) {
-    nlohmann::json emptyQuery = {};
-    if(emptyQuery == query){
-        return true;
+
+bool Table::UpdateDocument(const nlohmann::json &valuesToUpdate, const nlohmann::json &query){
+    return Update(valuesToUpdate, query, false);
+}
+bool Table::UpdateDocuments(const nlohmann::json &valuesToUpdate, const nlohmann::json &query){
+    return Update(valuesToUpdate, query, true);
+}
+bool Table::DeleteDocument(const nlohmann::json &query){
+    return Delete(query, false);
+}
+bool Table::DeleteDocuments(const nlohmann::json &query){
+    return Delete(query, true);
+}
+
+nlohmann::json Table::GetById(const nlohmann::json &id) {
+    JSONDB_MEASURE(*db.state, Operation::GetById);
+    SlowLogScope slow(*state, Operation::GetById, name, &id);
+    try {
+        auto data = Snapshot();
+        slow.Plan("idSeek", 1);
+        std::ptrdiff_t pos = data->Find(id);
+        if (pos < 0) {
+            return nlohmann::json::object();
+        }
+        return data->Json(pos);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::object();
     }
-    bool result = true;
-    for (auto q = query.begin(); q != query.end(); ++q) {
-        std::string column = q.key();
-        if (document.find(column) != document.end()) {
-            nlohmann::json columnStatements = query.at(column);
-            for (auto s = columnStatements.begin(); s != columnStatements.end();
-                 ++s) {
-                try{
-                    std::string statement = s.key();
-                    auto propertyValue = document.at(column);
-                    auto queryValue = columnStatements.at(statement);
-                    result = result && generic_comparator(statement, propertyValue, queryValue);
-                } catch (std::exception &e){
-                    std::cerr << "Error in comparison: " << e.what() << std::endl;
-                    return false;
-                }
-                if (result == false) {
-                    return false;
-                }
+}
+nlohmann::json Table::GetByIds(const nlohmann::json &ids) {
+    JSONDB_MEASURE(*db.state, Operation::GetByIds);
+    SlowLogScope slow(*state, Operation::GetByIds, name, &ids);
+    nlohmann::json result = nlohmann::json::array();
+    try {
+        auto data = Snapshot();
+        slow.Plan("idSeek", ids.size());
+        for (const auto &id : ids) {
+            std::ptrdiff_t pos = data->Find(id);
+            if (pos >= 0) {
+                result.push_back(data->Json(pos));
             }
-        } else {
+        }
+        return result;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::array();
+    }
+}
+bool Table::UpdateById(const nlohmann::json &id, const nlohmann::json &valuesToUpdate) {
+    JSONDB_MEASURE(*db.state, Operation::UpdateById);
+    SlowLogScope slow(*state, Operation::UpdateById, name, &id);
+    try {
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        nlohmann::json operators = normalize_update(valuesToUpdate);
+        std::shared_ptr<const TableData> base = Snapshot();
+        TableData data = *base;
+        slow.Plan("idSeek", 1);
+        std::ptrdiff_t pos = data.Find(id);
+        if (pos < 0) {
+            return false;
+        }
+        data.Replace(pos, update_document(data, data.Json(pos), operators));
+        Commit(*base, std::move(data), {{"op", "update"}, {"pos", {pos}}, {"update", operators}});
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+bool Table::DeleteById(const nlohmann::json &id) {
+    JSONDB_MEASURE(*db.state, Operation::DeleteById);
+    SlowLogScope slow(*state, Operation::DeleteById, name, &id);
+    try {
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        std::shared_ptr<const TableData> base = Snapshot();
+        TableData data = *base;
+        slow.Plan("idSeek", 1);
+        std::ptrdiff_t pos = data.Find(id);
+        if (pos < 0) {
             return false;
         }
+        data.Remove(pos);
+        Commit(*base, std::move(data), {{"op", "delete"}, {"pos", {pos}}});
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
     }
-    return result;
 }
-JsonDB::~JsonDB() = default;
-JsonDB::JsonDB(const std::string &dbName, const std::string &dbPath)
-    : name(dbName),
-      path(dbPath),
-      file(dbPath + "/" + dbName + ".json"),
-      tablesPath(dbPath + "/" + dbName) {}
 
-std::string JsonDB::GetFile() const { return file; }
-std::string JsonDB::GetName() const { return name; }
-std::string JsonDB::GetPath() const { return path; }
-std::string JsonDB::GetTablesPath() const { return tablesPath; }
+nlohmann::json Table::Upsert(const nlohmann::json &query, const nlohmann::json &valuesToUpdate) {
+    JSONDB_MEASURE(*db.state, Operation::Upsert);
+    SlowLogScope slow(*state, Operation::Upsert, name, &query);
+    try {
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        nlohmann::json operators = normalize_update(valuesToUpdate);
+        std::shared_ptr<const TableData> base = Snapshot();
+        TableData data = *base;
+        Matcher matcher(query, *data.keys);
+        QueryPlan plan(data, query, matcher);
+        std::ptrdiff_t found = -1;
+        slow.Plan(plan.Name(), plan.Scan(data, [&](std::size_t i) {
+            found = data.Matches(i, matcher) ? static_cast<std::ptrdiff_t>(i) : -1;
+            return found < 0;
+        }));
+        if (found >= 0) {
+            data.Replace(found, update_document(data, data.Json(found), operators));
+            nlohmann::json result = data.Json(found);
+            Commit(*base, std::move(data), {{"op", "update"}, {"pos", {found}}, {"update", operators}});
+            return result;
+        }
 
-bool JsonDB::Create() {
-    if(this->Exists()){
-        return false;
+        // seed the new document with the equality conditions of the query
+        nlohmann::json document = nlohmann::json::object();
+        if (query.is_object()) {
+            for (auto q = query.begin(); q != query.end(); ++q) {
+                if (q.value().is_object() && q.value().contains("$eq")) {
+                    document[q.key()] = q.value()["$eq"];
+                }
+            }
+        }
+        apply_update(document, operators);
+        assign_key(data, document);
+        nlohmann::json record = {{"op", "insert"}, {"doc", document}};
+        data.Add(document);
+        Commit(*base, std::move(data), record);
+        return document;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::object();
     }
+}
+
+nlohmann::json Table::FindOneAndUpdate(const nlohmann::json &query, const nlohmann::json &valuesToUpdate,
+                                       bool returnNew) {
+    JSONDB_MEASURE(*db.state, Operation::FindOneAndUpdate);
+    SlowLogScope slow(*state, Operation::FindOneAndUpdate, name, &query);
     try {
-        nlohmann::json db;
-        db["name"] = name;
-        db["tables"] = {};
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        nlohmann::json operators = normalize_update(valuesToUpdate);
+        std::shared_ptr<const TableData> base = Snapshot();
+        TableData data = *base;
+        Matcher matcher(query, *data.keys);
+        QueryPlan plan(data, query, matcher);
+        std::ptrdiff_t found = -1;
+        slow.Plan(plan.Name(), plan.Scan(data, [&](std::size_t i) {
+            found = data.Matches(i, matcher) ? static_cast<std::ptrdiff_t>(i) : -1;
+            return found < 0;
+        }));
+        if (found < 0) {
+            return nlohmann::json::object();
+        }
+        nlohmann::json result = data.Json(found);
+        data.Replace(found, update_document(data, data.Json(found), operators));
+        if (returnNew) {
+            result = data.Json(found);
+        }
+        Commit(*base, std::move(data), {{"op", "update"}, {"pos", {found}}, {"update", operators}});
+        return result;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::object();
+    }
+}
 
-        std::filesystem::create_directory(path);
-        std::filesystem::create_directory(tablesPath);
-        std::ofstream dbFile(file);
-        dbFile << db << std::endl;
+bool Table::Compact() {
+    JSONDB_MEASURE(*db.state, Operation::Compact);
+    try {
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        TableData data = *Snapshot();
+        Store(data);
+        {
+            std::lock_guard<std::mutex> lock(state->snapshotMutex);
+            state->snapshot = std::make_shared<const TableData>(std::move(data));
+        }
+        Touch();
         return true;
     } catch (const std::exception &e) {
         std::cerr << e.what() << std::endl;
@@ -140,107 +4541,326 @@ bool JsonDB::Create() {
     }
 }
 
-bool JsonDB::Exists() {
-    std::ifstream dbFile(file);
-    if (dbFile.good()) {
-        dbFile.close();
+bool Table::Import(const std::string &path, FileFormat format) {
+    JSONDB_MEASURE(*db.state, Operation::Import);
+    try {
+        if (!std::filesystem::is_regular_file(path)) {
+            throw std::runtime_error("Error opening: " + path);
+        }
+        std::string content = db.GetIoBackend()->ReadFiles({path})[0];
+        JSONDB_COUNT(*db.state, bytesRead, content.size());
+        const auto records = split_records(content, format);
+
+        std::lock_guard<std::mutex> lock(state->writeMutex);
+        TableData data = *Snapshot();
+        const bool keyed = !data.options.primaryKey.empty();
+
+        // documents carrying their primary key are built in parallel, the
+        // others wait for theirs to be generated in file order
+        std::vector<std::shared_ptr<const Document>> documents(records.size());
+        std::vector<nlohmann::json> pending(records.size());
+        const std::size_t chunk = 1024;
+        {
+            JSONDB_TIME(*db.state, parseNanos);
+            parallel_for(*db.GetExecutor(), (records.size() + chunk - 1) / chunk, [&](std::size_t c) {
+                for (std::size_t i = c * chunk; i < std::min(records.size(), (c + 1) * chunk); i++) {
+                    nlohmann::json document = nlohmann::json::parse(
+                        std::string_view(content).substr(records[i].first, records[i].second));
+                    if (!keyed || data.Key(document) != nullptr) {
+                        documents[i] = data.Make(std::move(document));
+                    } else {
+                        pending[i] = std::move(document);
+                    }
+                }
+            });
+        }
+        content.clear();
+
+        data.documents.reserve(data.documents.size() + records.size());
+        for (std::size_t i = 0; i < records.size(); i++) {
+            if (!documents[i]) {
+                assign_key(data, pending[i]);
+                documents[i] = data.Make(std::move(pending[i]));
+            } else if (keyed) {
+                nlohmann::json id = data.Key(*documents[i]);
+                if (data.Find(id) >= 0) {
+                    throw std::invalid_argument("Duplicate " + data.options.primaryKey + ": " + id.dump());
+                }
+            }
+            data.documents.push_back(std::move(documents[i]));
+            data.live++;
+            data.Index(data.documents.size() - 1);
+        }
+
+        Store(data);
+        {
+            std::lock_guard<std::mutex> lock(state->snapshotMutex);
+            state->snapshot = std::make_shared<const TableData>(std::move(data));
+        }
+        Touch();
         return true;
-    } else {
+    } catch (const std::exception &e) {
+        std::cerr << "Error importing " << path << ": " << e.what() << std::endl;
         return false;
     }
 }
 
-bool JsonDB::Drop() {
+bool Table::Export(const std::string &path, FileFormat format) {
+    JSONDB_MEASURE(*db.state, Operation::Export);
     try {
-        if (std::filesystem::exists(file)) {
-            std::filesystem::remove(file);
-            std::cout << "Database file deleted: " << file << std::endl;
-        } else {
-            throw std::runtime_error("The database file does not exist: " + file);
+        auto data = Snapshot();
+        std::shared_ptr<IoBackend> io = db.GetIoBackend();
+        const std::size_t block = 1 << 20;
+        std::string buffer = format == FileFormat::JsonArray ? "[" : "";
+        bool first = true;
+        bool created = false;
+        auto flush = [&] {
+            JSONDB_COUNT(*db.state, bytesWritten, buffer.size());
+            if (created) {
+                io->AppendFile(path, buffer, false);
+            } else {
+                io->WriteFile(path, buffer, false);
+                created = true;
+            }
+            buffer.clear();
+        };
+        for (std::size_t i = 0; i < data->documents.size(); i++) {
+            if (!data->documents[i]) {
+                continue;
+            }
+            if (format == FileFormat::JsonArray && !first) {
+                buffer += ',';
+            }
+            first = false;
+            {
+                JSONDB_TIME(*db.state, serializeNanos);
+                buffer += data->Json(i).dump();
+            }
+            if (format == FileFormat::NdJson) {
+                buffer += '\n';
+            }
+            if (buffer.size() >= block) {
+                flush();
+            }
         }
-
-        if (std::filesystem::exists(tablesPath)) {
-            std::filesystem::remove_all(tablesPath);
-            std::cout << "Database folder deleted: " << tablesPath << std::endl;
-        } else {
-            throw std::runtime_error("The database folder does not exist: " + tablesPath);
+        if (format == FileFormat::JsonArray) {
+            buffer += ']';
         }
-
+        flush();
         return true;
     } catch (const std::exception &e) {
-        std::cerr << "Error during database deletion: " << e.what()
-                  << std::endl;
+        std::cerr << "Error exporting " << path << ": " << e.what() << std::endl;
         return false;
     }
 }
 
-std::vector<std::unordered_map<std::string, std::string>> JsonDB::Tables() {
-    std::vector<std::unordered_map<std::string, std::string>> tables;
-    std::ifstream dbFile(file);
+void Table::SetSlowLog(const SlowLogOptions &options) {
+    std::atomic_store(&state->slowLog, std::make_shared<SlowLog>(options));
+    state->slowLogEnabled = true;
+}
 
-    if (!dbFile.is_open()) {
-        throw std::runtime_error("Unable to open database file");
-    }
+void Table::DisableSlowLog() {
+    state->slowLogEnabled = false;
+    std::atomic_store(&state->slowLog, std::shared_ptr<SlowLog>());
+}
 
-    try {
-        nlohmann::json data;
-        dbFile >> data;
-        if (data["tables"].is_array()) {
-            for(auto &tb: data["tables"]){
-                tables.push_back(tb);
-            }
-        } else {
-            throw std::runtime_error("Invalid database format: 'tables' not found or not an array");
+void Table::SetCompactionThreshold(double deadRatio) {
+    state->compactionThreshold = deadRatio;
+}
+
+std::future<bool> Table::Write(std::function<bool(Table &)> write) const {
+    auto executor = db.GetExecutor();
+    auto promise = std::make_shared<std::promise<bool>>();
+    std::future<bool> result = promise->get_future();
+    DatabaseState *dbState = begin_operation(*db.state);
+    executor->Submit([table = *this, write = std::move(write), promise, dbState]() mutable {
+        promise->set_value(write(table));
+        end_operation(*dbState);
+    });
+    return result;
+}
+
+std::future<nlohmann::json> Table::Read(const std::string &key,
+                                        std::function<nlohmann::json(Table &)> read) const {
+    std::promise<nlohmann::json> promise;
+    std::future<nlohmann::json> result = promise.get_future();
+    auto waiters = std::make_shared<std::vector<std::promise<nlohmann::json>>>();
+    {
+        std::lock_guard<std::mutex> lock(state->pendingMutex);
+        auto found = state->pending.find(key);
+        if (found != state->pending.end() && found->second.version == state->version) {
+            found->second.waiters->push_back(std::move(promise));
+            return result;
         }
-    } catch (const nlohmann::json::exception& e) {
-        throw std::runtime_error("Error parsing database file: " + std::string(e.what()));
+        waiters->push_back(std::move(promise));
+        state->pending[key] = {state->version, waiters};
     }
+    auto executor = db.GetExecutor();
+    DatabaseState *dbState = begin_operation(*db.state);
+    executor->Submit([table = *this, key, read = std::move(read), waiters, dbState]() mutable {
+        nlohmann::json value;
+        std::exception_ptr error;
+        try {
+            value = read(table);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // no caller joins the list once it is out of the map
+        std::vector<std::promise<nlohmann::json>> promises;
+        {
+            std::lock_guard<std::mutex> lock(table.state->pendingMutex);
+            auto found = table.state->pending.find(key);
+            if (found != table.state->pending.end() && found->second.waiters == waiters) {
+                table.state->pending.erase(found);
+            }
+            promises = std::move(*waiters);
+        }
+        for (std::size_t i = 0; i < promises.size(); i++) {
+            if (error) {
+                promises[i].set_exception(error);
+            } else if (i + 1 < promises.size()) {
+                promises[i].set_value(value);
+            } else {
+                promises[i].set_value(std::move(value));
+            }
+        }
+        end_operation(*dbState);
+    });
+    return result;
+}
 
-    return tables;
+std::future<nlohmann::json> Table::FindDocumentAsync(const nlohmann::json &query) const {
+    return Read(QueryCache::MakeKey("FindDocument", query),
+                [query](Table &table) { return table.FindDocument(query); });
 }
 
+std::future<nlohmann::json> Table::FindDocumentsAsync(const nlohmann::json &query) const {
+    return Read(QueryCache::MakeKey("FindDocuments", query),
+                [query](Table &table) { return table.FindDocuments(query); });
+}
 
-Table::~Table() = default;
-Table::Table(const std::string &tableName, const JsonDB &database)
-    : name(tableName),
-      db(database),
-      file(database.GetTablesPath() + "/" + tableName + ".json") {}
+std::future<bool> Table::InsertDocumentAsync(const nlohmann::json &document) const {
+    return Write([document](Table &table) { return table.InsertDocument(document); });
+}
 
-std::string Table::GetName() const { return name; }
+std::future<bool> Table::UpdateDocumentsAsync(const nlohmann::json &valuesToUpdate,
+                                              const nlohmann::json &query) const {
+    return Write([valuesToUpdate, query](Table &table) {
+        return table.UpdateDocuments(valuesToUpdate, query);
+    });
+}
 
-bool Table::Create() {
-    try {
-        nlohmann::json data;
-        std::ifstream dbFileIn(db.GetFile());
+std::future<bool> Table::DeleteDocumentsAsync(const nlohmann::json &query) const {
+    return Write([query](Table &table) { return table.DeleteDocuments(query); });
+}
 
-        if (!dbFileIn.is_open()) {
-            throw std::runtime_error("Error opening: " + db.GetFile());
-        }
+int Table::Watch(const nlohmann::json &query, ChangeCallback callback) {
+    std::lock_guard<std::mutex> lock(state->watchMutex);
+    int watchId = ++state->lastWatch;
+    state->watchers[watchId] = {query, std::move(callback)};
+    return watchId;
+}
 
-        dbFileIn >> data;
-        dbFileIn.close();
+bool Table::Unwatch(int watchId) {
+    std::lock_guard<std::mutex> lock(state->watchMutex);
+    return state->watchers.erase(watchId) > 0;
+}
 
-        auto tables = data["tables"];
+bool Table::ReadChanges(std::uint64_t afterSequence, std::vector<ChangeEvent> &events,
+                        std::size_t maxEvents) const {
+    return state->changes.Read(afterSequence, events, maxEvents);
+}
 
-        std::set<std::string> existingTables;
-        for (const auto &tb : tables) {
-            existingTables.insert(tb["name"]);
-        }
+std::uint64_t Table::GetLastSequence() const {
+    return state->changes.Last();
+}
 
-        if (existingTables.find(name) != existingTables.end()) {
-            throw std::runtime_error("Error: " + name + "'s table already exists");
-        }
+void Table::SetChangeFeedCapacity(std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(state->writeMutex);
+    state->changes.Resize(capacity);
+}
 
-        nlohmann::json newTable = {{"name", name}};
-        tables.push_back(newTable);
-        data["tables"] = tables;
+Transaction::Transaction(const JsonDB &database) : db(database) {}
 
-        std::ofstream dbFileOut(db.GetFile(), std::ios::out | std::ios::trunc);
-        dbFileOut << data << std::endl;
+Transaction::Transaction(Transaction &&other) noexcept
+    : db(other.db), entries(std::move(other.entries)), finished(other.finished) {
+    other.finished = true;
+}
+
+Transaction::~Transaction() {
+    if (!finished) {
+        Rollback();
+    }
+}
+
+TransactionEntry &Transaction::Entry(const std::string &tableName) {
+    if (finished) {
+        throw std::logic_error("Transaction already finished");
+    }
+    auto entry = entries.find(tableName);
+    if (entry == entries.end()) {
+        auto created = std::make_shared<TransactionEntry>();
+        created->table = std::make_unique<Table>(tableName, db);
+        created->base = created->table->Snapshot();
+        created->data = *created->base;
+        entry = entries.emplace(tableName, created).first;
+    }
+    return *entry->second;
+}
+
+bool Transaction::InsertDocument(const std::string &tableName, const nlohmann::json &document) {
+    try {
+        TransactionEntry &entry = Entry(tableName);
+        nlohmann::json stored = document;
+        assign_key(entry.data, stored);
+        entry.records.push_back({{"op", "insert"}, {"doc", stored}});
+        entry.data.Add(std::move(stored));
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
 
-        std::ofstream tbFile(file);
-        tbFile << "[]";
+nlohmann::json Transaction::FindDocuments(const std::string &tableName, const nlohmann::json &query) {
+    nlohmann::json result = nlohmann::json::array();
+    try {
+        TransactionEntry &entry = Entry(tableName);
+        Matcher matcher(query, *entry.data.keys);
+        QueryPlan(entry.data, query, matcher).Scan(entry.data, [&](std::size_t i) {
+            if (entry.data.Matches(i, matcher)) {
+                result.push_back(entry.data.Json(i));
+            }
+            return true;
+        });
+        return result;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::array();
+    }
+}
 
+bool Transaction::UpdateDocuments(const std::string &tableName, const nlohmann::json &valuesToUpdate,
+                                  const nlohmann::json &query) {
+    try {
+        TransactionEntry &entry = Entry(tableName);
+        nlohmann::json operators = normalize_update(valuesToUpdate);
+        nlohmann::json positions = nlohmann::json::array();
+        std::vector<std::pair<std::size_t, std::shared_ptr<const Document>>> updated;
+        Matcher matcher(query, *entry.data.keys);
+        for (std::size_t i = 0; i < entry.data.documents.size(); i++) {
+            if (entry.data.Matches(i, matcher)) {
+                updated.emplace_back(i, update_document(entry.data, entry.data.Json(i), operators));
+                positions.push_back(i);
+            }
+        }
+        // only touch the documents once every update is known to be valid
+        for (auto &document : updated) {
+            entry.data.Replace(document.first, std::move(document.second));
+        }
+        if (!positions.empty()) {
+            entry.records.push_back({{"op", "update"}, {"pos", positions}, {"update", operators}});
+        }
         return true;
     } catch (const std::exception &e) {
         std::cerr << e.what() << std::endl;
@@ -248,293 +4868,599 @@ bool Table::Create() {
     }
 }
 
-bool Table::Exists() {
-    try{
-        std::ifstream dbFile(db.GetFile());
-
-        if (!dbFile.is_open()) {
-            std::cerr << "Error opening: " + db.GetFile() << std::endl;
-            return false;
+bool Transaction::DeleteDocuments(const std::string &tableName, const nlohmann::json &query) {
+    try {
+        TransactionEntry &entry = Entry(tableName);
+        nlohmann::json positions = nlohmann::json::array();
+        Matcher matcher(query, *entry.data.keys);
+        for (std::size_t i = 0; i < entry.data.documents.size(); i++) {
+            if (entry.data.Matches(i, matcher)) {
+                entry.data.Remove(i);
+                positions.push_back(i);
+            }
+        }
+        if (!positions.empty()) {
+            entry.records.push_back({{"op", "delete"}, {"pos", positions}});
         }
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
 
-        nlohmann::json data;
-        dbFile >> data;
-        auto &tables = data["tables"];
-        for (const auto &tb : tables) {
-            if (tb["name"] == name) {
-                dbFile.close();
-                return true;
+bool Transaction::Commit() {
+    JSONDB_MEASURE(*db.state, Operation::Commit);
+    if (finished) {
+        return false;
+    }
+    finished = true;
+    try {
+        // entries are ordered by table name, so concurrent commits lock
+        // their tables in the same order
+        std::vector<std::unique_lock<std::mutex>> locks;
+        nlohmann::json tables = nlohmann::json::object();
+        for (auto &entry : entries) {
+            locks.emplace_back(entry.second->table->state->writeMutex);
+            if (entry.second->table->Snapshot() != entry.second->base) {
+                throw std::runtime_error("Transaction conflict on table: " + entry.first);
+            }
+            if (!entry.second->records.empty()) {
+                tables[entry.first] = entry.second->records;
             }
         }
-        return false;
-    } catch (const std::exception &e){
-        std::cerr << "Error reading JSON data from: " + db.GetFile()
-                  << std::endl;
+        if (!tables.empty()) {
+            const std::string id = generate_object_id();
+            {
+                std::lock_guard<std::mutex> lock(db.state->transactionsMutex);
+                // sizes to cut the files back to if an append fails, a
+                // journal that was empty or stale is removed instead
+                std::error_code error;
+                std::uintmax_t logSize = std::filesystem::file_size(db.transactionsFile, error);
+                logSize = error ? 0 : logSize;
+                std::vector<std::pair<std::string, std::uintmax_t>> appended;
+                try {
+                    nlohmann::json logEntry = {{"txn", id}, {"tables", tables}};
+                    const std::string line = logEntry.dump() + "\n";
+                    JSONDB_COUNT(*db.state, bytesWritten, line.size());
+                    db.GetIoBackend()->AppendFile(db.transactionsFile, line, true);
+                    for (auto &entry : entries) {
+                        if (!entry.second->records.empty()) {
+                            Table &table = *entry.second->table;
+                            std::uintmax_t size = std::filesystem::file_size(table.journal, error);
+                            appended.emplace_back(table.journal, error || entry.second->data.journalStale ? 0 : size);
+                            table.Append(entry.second->data,
+                                         {{"op", "batch"}, {"txn", id}, {"records", entry.second->records}});
+                        }
+                    }
+                } catch (...) {
+                    // the log entry goes first, so recovery cannot complete
+                    // the transaction from it
+                    std::filesystem::resize_file(db.transactionsFile, logSize, error);
+                    for (const auto &journal : appended) {
+                        if (journal.second == 0) {
+                            std::filesystem::remove(journal.first, error);
+                        } else {
+                            std::filesystem::resize_file(journal.first, journal.second, error);
+                        }
+                    }
+                    throw;
+                }
+            }
+            // the transaction is on disk from here on, a table that fails to
+            // publish it reloads it from its journal
+            for (auto &entry : entries) {
+                if (!entry.second->records.empty()) {
+                    try {
+                        entry.second->table->Publish(
+                            *entry.second->base, std::move(entry.second->data),
+                            {{"op", "batch"}, {"txn", id}, {"records", entry.second->records}});
+                    } catch (const std::exception &e) {
+                        std::cerr << e.what() << std::endl;
+                    }
+                }
+            }
+            std::error_code error;
+            if (std::filesystem::file_size(db.transactionsFile, error) > (1 << 20) && !error) {
+                try {
+                    db.Checkpoint();
+                } catch (const std::exception &e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+        }
+        entries.clear();
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        entries.clear();
         return false;
     }
 }
 
-bool Table::Drop() {
-    std::fstream dbFile(db.GetFile(), std::ios::in | std::ios::out);
+void Transaction::Rollback() {
+    finished = true;
+    entries.clear();
+}
 
-    if (!dbFile.is_open()) {
-        std::cerr << "Error opening: " + db.GetFile() << std::endl;
+#ifndef _WIN32
+// Bytes of a frame before its body: length, request id and code.
+const std::size_t FRAME_HEADER = 9;
+
+// A frame cut from the input buffer, its body still encoded.
+struct Frame {
+    std::uint32_t id = 0;
+    std::uint8_t code = 0;
+    std::string_view body;
+
+    nlohmann::json Decode() const { return nlohmann::json::from_msgpack(body.begin(), body.end()); }
+};
+
+void put_u32(std::string &out, std::size_t at, std::uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[at + i] = static_cast<char>(value >> (8 * i) & 0xff);
+    }
+}
+
+std::uint32_t get_u32(const char *data) {
+    std::uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= static_cast<std::uint32_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+void append_frame(std::string &out, std::uint32_t id, std::uint8_t code, const nlohmann::json &body) {
+    const std::size_t start = out.size();
+    out.append(FRAME_HEADER, '\0');
+    nlohmann::json::to_msgpack(body, out);
+    put_u32(out, start, static_cast<std::uint32_t>(out.size() - start - 4));
+    put_u32(out, start + 4, id);
+    out[start + 8] = static_cast<char>(code);
+}
+
+// Cuts the frame at `offset` out of `in` and moves past it, false when it
+// is not complete yet. A frame longer than `maxFrame` is refused before
+// its body is buffered; `frame.id` is then the id it was sent with.
+bool read_frame(const std::string &in, std::size_t &offset, Frame &frame, std::size_t maxFrame) {
+    if (in.size() - offset < FRAME_HEADER) {
+        return false;
+    }
+    const std::uint32_t length = get_u32(in.data() + offset);
+    frame.id = get_u32(in.data() + offset + 4);
+    frame.code = static_cast<std::uint8_t>(in[offset + 8]);
+    if (length < FRAME_HEADER - 4 || length > maxFrame) {
+        throw std::length_error("Invalid frame length: " + std::to_string(length));
+    }
+    if (in.size() - offset - 4 < length) {
         return false;
     }
+    frame.body = std::string_view(in).substr(offset + FRAME_HEADER, length - (FRAME_HEADER - 4));
+    offset += 4 + length;
+    return true;
+}
 
-    nlohmann::json data;
-    dbFile >> data;
-    dbFile.close();
-    auto &tables = data["tables"];
-    for (auto it = tables.begin(); it != tables.end(); ++it) {
-        if ((*it)["name"] == name) {
-            tables.erase(it);
-            dbFile.open(db.GetFile(),
-                        std::ofstream::out | std::ofstream::trunc);
-            dbFile.seekp(0, std::ios::beg);
-            dbFile << data;
-            dbFile.close();
+// Appends what the socket has to `in`, dropping the bytes before `offset`
+// first. Returns false when the peer closed the connection.
+bool receive(int fd, std::string &in, std::size_t &offset) {
+    in.erase(0, offset);
+    offset = 0;
+    char chunk[1 << 16];
+    ssize_t count;
+    do {
+        count = ::recv(fd, chunk, sizeof(chunk), 0);
+    } while (count < 0 && errno == EINTR);
+    if (count <= 0) {
+        return false;
+    }
+    in.append(chunk, static_cast<std::size_t>(count));
+    return true;
+}
 
-            if (std::filesystem::remove(file)) {
-                std::cout << "Table file deleted: " << file << std::endl;
-            } else {
-                std::cerr << "Error deleting table file: " << file << std::endl;
-            }
-            return true;
+bool send_all(int fd, const std::string &out) {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    for (std::size_t sent = 0; sent < out.size();) {
+        ssize_t count = ::send(fd, out.data() + sent, out.size() - sent, flags);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
         }
+        sent += static_cast<std::size_t>(count);
     }
+    return true;
+}
 
-    std::cerr << "Error: table does not exist " + name << std::endl;
-    dbFile.close();
-    return false;
+sockaddr_un socket_address(const std::string &socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path too long: " + socketPath);
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return address;
 }
-bool Table::InsertDocument(const nlohmann::json &document) {
-    try {
-        std::fstream tbFile(file, std::ios::in | std::ios::out);
 
-        if (!tbFile.is_open()) {
-            throw std::runtime_error("Error opening: " + file);
-        }
+nlohmann::json options_to_json(const TableOptions &options) {
+    return {{"primaryKey", options.primaryKey},
+            {"idGenerator", static_cast<int>(options.idGenerator)},
+            {"textIndexes", options.textIndexes}};
+}
 
-        nlohmann::json data;
-        tbFile >> data;
-        data.push_back(document);
+TableOptions options_from_json(const nlohmann::json &json) {
+    TableOptions options;
+    options.primaryKey = json.value("primaryKey", "");
+    options.idGenerator = static_cast<IdGenerator>(json.value("idGenerator", 0));
+    options.textIndexes = json.value("textIndexes", std::vector<std::string>());
+    return options;
+}
+
+Server::Server(const JsonDB &db, const std::string &socketPath) : db(db), socketPath(socketPath) {}
 
-        tbFile.close();
+void Server::SetMaxFrameSize(std::size_t bytes) {
+    maxFrame = bytes;
+}
 
-        std::ofstream tbFileOut(file,
-                                std::ofstream::out | std::ofstream::trunc);
-        tbFileOut << data;
+Server::~Server() {
+    Stop();
+}
 
-        if (!tbFileOut) {
-            throw std::runtime_error("Error writing to: " + file);
+bool Server::Start() {
+    if (running) {
+        return true;
+    }
+    try {
+        sockaddr_un address = socket_address(socketPath);
+        ::unlink(socketPath.c_str());
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        // nothing authenticates the clients, so only the owner may connect;
+        // no connection is accepted before listen
+        if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) != 0 || ::listen(listenFd, SOMAXCONN) != 0) {
+            throw std::runtime_error("Error listening on " + socketPath + ": " + std::strerror(errno));
         }
-
-        tbFileOut.close();
+        running = true;
+        acceptor = std::thread([this] { Accept(); });
         return true;
     } catch (const std::exception &e) {
         std::cerr << e.what() << std::endl;
+        if (listenFd >= 0) {
+            ::close(listenFd);
+            listenFd = -1;
+        }
         return false;
     }
 }
-nlohmann::json Table::FindDocument() {
-    try {
-        std::ifstream tbFile(file);
-
-        if (!tbFile.is_open()) {
-            throw std::runtime_error("Error opening: " + file);
-        }
 
-        nlohmann::json data;
-        tbFile >> data;
-        tbFile.close();
-        if (data.size() < 1) {
-            return nlohmann::json::object();
-        }
-        return data[0];
-    } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return nlohmann::json::object();
+void Server::Stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    acceptor.join();
+    ::close(listenFd);
+    listenFd = -1;
+    ::unlink(socketPath.c_str());
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for (auto &connection : connections) {
+        // wakes up the connection thread blocked in recv
+        ::shutdown(connection.fd, SHUT_RDWR);
     }
+    for (auto &connection : connections) {
+        connection.thread.join();
+        ::close(connection.fd);
+    }
+    connections.clear();
 }
-nlohmann::json Table::FindDocument(const nlohmann::json &query) {
-    try {
-        std::ifstream tbFile(file);
 
-        if (!tbFile.is_open()) {
-            throw std::runtime_error("Error opening: " + file);
+void Server::Accept() {
+    while (running) {
+        pollfd listening{listenFd, POLLIN, 0};
+        int ready = ::poll(&listening, 1, 100);
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        // connections closed by their client are reaped at least every poll
+        // timeout, and before a new one could reuse their descriptor
+        for (auto connection = connections.begin(); connection != connections.end();) {
+            if (connection->done) {
+                connection->thread.join();
+                ::close(connection->fd);
+                connection = connections.erase(connection);
+            } else {
+                ++connection;
+            }
         }
-
-        nlohmann::json data;
-        tbFile >> data;
-        tbFile.close();
-        if (data.size() < 1) {
-            return nlohmann::json::object();
+        int fd = ready > 0 ? ::accept(listenFd, nullptr, nullptr) : -1;
+        if (fd < 0) {
+            continue;
         }
-        for (int i = 0; i < data.size(); i++) {
-            if (match_query(data[i], query)) {
-                return data[i];
+        Connection &connection = connections.emplace_back();
+        connection.fd = fd;
+        connection.thread = std::thread([this, &connection] { Serve(connection); });
+    }
+}
+
+void Server::Serve(Connection &connection) const {
+    std::string in;
+    std::string out;
+    std::size_t offset = 0;
+    for (bool open = true; open && receive(connection.fd, in, offset);) {
+        // every complete request is run before the replies are sent at
+        // once, so pipelined requests cost one write
+        Frame frame;
+        try {
+            while (read_frame(in, offset, frame, maxFrame)) {
+                try {
+                    nlohmann::json body = frame.Decode();
+                    RemoteRequest request;
+                    request.command = static_cast<RemoteCommand>(frame.code);
+                    request.table = body.at(0).get<std::string>();
+                    request.arguments.insert(request.arguments.end(), body.begin() + 1, body.end());
+                    append_frame(out, frame.id, 0, Execute(request));
+                } catch (const std::exception &e) {
+                    append_frame(out, frame.id, 1, e.what());
+                }
             }
+        } catch (const std::length_error &e) {
+            // the stream cannot be resynchronized past a bad length, the
+            // replies to the requests before it still go out
+            std::cerr << "Error serving " << socketPath << ": " << e.what() << std::endl;
+            append_frame(out, frame.id, 1, e.what());
+            open = false;
         }
-        return nlohmann::json::object();
-    } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return nlohmann::json::object();
+        open = send_all(connection.fd, out) && open;
+        out.clear();
     }
+    connection.done = true;
 }
-nlohmann::json Table::FindDocuments() {
-    try {
-        std::ifstream tbFile(file);
 
-        if (!tbFile.is_open()) {
-            throw std::runtime_error("Error opening: " + file);
+nlohmann::json Server::Execute(const RemoteRequest &request) const {
+    const nlohmann::json &arguments = request.arguments;
+    if (request.command == RemoteCommand::Ping) {
+        return true;
+    }
+    Table table(request.table, db);
+    switch (request.command) {
+        case RemoteCommand::Create:
+            return table.Create(options_from_json(arguments.at(0)));
+        case RemoteCommand::GetOptions:
+            return options_to_json(table.GetOptions());
+        case RemoteCommand::CreateTextIndex:
+            return table.CreateTextIndex(arguments.at(0).get<std::string>());
+        case RemoteCommand::Exists:
+            return table.Exists();
+        case RemoteCommand::Drop:
+            return table.Drop();
+        case RemoteCommand::InsertDocument: {
+            nlohmann::json id;
+            bool inserted = table.InsertDocument(arguments.at(0), id);
+            return nlohmann::json::array({inserted, id});
         }
-
-        nlohmann::json data;
-        tbFile >> data;
-        tbFile.close();
-        return data;
-    } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return nlohmann::json::array();
+        case RemoteCommand::FindDocument:
+            return table.FindDocument(arguments.at(0));
+        case RemoteCommand::FindDocuments:
+            return table.FindDocuments(arguments.at(0));
+        case RemoteCommand::Explain:
+            return table.Explain(arguments.at(0), {arguments.at(1).at("execute"), arguments.at(1).at("first")});
+        case RemoteCommand::UpdateDocument:
+            return table.UpdateDocument(arguments.at(0), arguments.at(1));
+        case RemoteCommand::UpdateDocuments:
+            return table.UpdateDocuments(arguments.at(0), arguments.at(1));
+        case RemoteCommand::DeleteDocument:
+            return table.DeleteDocument(arguments.at(0));
+        case RemoteCommand::DeleteDocuments:
+            return table.DeleteDocuments(arguments.at(0));
+        case RemoteCommand::Upsert:
+            return table.Upsert(arguments.at(0), arguments.at(1));
+        case RemoteCommand::FindOneAndUpdate:
+            return table.FindOneAndUpdate(arguments.at(0), arguments.at(1), arguments.at(2).get<bool>());
+        case RemoteCommand::GetById:
+            return table.GetById(arguments.at(0));
+        case RemoteCommand::GetByIds:
+            return table.GetByIds(arguments.at(0));
+        case RemoteCommand::UpdateById:
+            return table.UpdateById(arguments.at(0), arguments.at(1));
+        case RemoteCommand::DeleteById:
+            return table.DeleteById(arguments.at(0));
+        case RemoteCommand::Compact:
+            return table.Compact();
+        default:
+            throw std::invalid_argument("Unknown command: " + std::to_string(static_cast<int>(request.command)));
     }
 }
-nlohmann::json Table::FindDocuments(const nlohmann::json &query) {
-    nlohmann::json result = nlohmann::json::array();
-    try {
-        std::ifstream tbFile(file);
 
-        nlohmann::json data;
-        tbFile >> data;
-        tbFile.close();
-        if(!data.is_array()||data.size()<1){
-            return result;
-        }
-        for (int i = 0; i < data.size(); i++) {
-            if (match_query(data[i], query)) {
-                result.push_back(data[i]);
-            }
-        }
+Client::Client(const std::string &socketPath) : socketPath(socketPath) {}
 
-        return result;
-    } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return nlohmann::json::array();
-    }
+Client::~Client() {
+    Close();
 }
 
-bool Table::UpdateDocument(const nlohmann::json &valuesToUpdate, const nlohmann::json &query){
-    bool result = false;
-    try {
-        std::ifstream tbFile(file);
+bool Client::Connect() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return Open();
+}
 
-        nlohmann::json data;
-        tbFile >> data;
-        tbFile.close();
-        if(!data.is_array()||data.size()<1){
-            return false;
-        }
-        for (int i = 0; i < data.size(); i++) {
-            if (match_query(data[i], query)) {
-                for (auto q = valuesToUpdate.begin(); q != valuesToUpdate.end(); ++q) {
-                    data[i][q.key()]=q.value();
-                }
-                break;
-            }
-        }
-        std::ofstream tbFileOut(file);
-        tbFileOut << data;
-        result = true;
+void Client::Close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Disconnect();
+}
 
-    } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return result;
+bool Client::Open() {
+    if (fd >= 0) {
+        return true;
     }
-    return result;
+    sockaddr_un address = socket_address(socketPath);
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        Disconnect();
+    }
+    return fd >= 0;
 }
-bool Table::UpdateDocuments(const nlohmann::json &valuesToUpdate, const nlohmann::json &query){
-    bool result = false;
-    try {
-        std::ifstream tbFile(file);
 
-        nlohmann::json data;
-        tbFile >> data;
-        tbFile.close();
-        if(!data.is_array()||data.size()<1){
-            return false;
+void Client::Disconnect() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+std::vector<RemoteReply> Client::Pipeline(const std::vector<RemoteRequest> &requests) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!Open()) {
+        throw std::runtime_error("Error connecting to " + socketPath + ": " + std::strerror(errno));
+    }
+    std::string out;
+    const std::uint32_t first = nextId;
+    for (const auto &request : requests) {
+        nlohmann::json body = nlohmann::json::array({request.table});
+        body.insert(body.end(), request.arguments.begin(), request.arguments.end());
+        append_frame(out, nextId++, static_cast<std::uint8_t>(request.command), body);
+    }
+    std::vector<RemoteReply> replies;
+    replies.reserve(requests.size());
+    try {
+        if (!send_all(fd, out)) {
+            throw std::runtime_error("Error sending to " + socketPath + ": " + std::strerror(errno));
         }
-        for (int i = 0; i < data.size(); i++) {
-            if (match_query(data[i], query)) {
-                for (auto q = valuesToUpdate.begin(); q != valuesToUpdate.end(); ++q) {
-                    data[i][q.key()]=q.value();
+        std::string in;
+        std::size_t offset = 0;
+        Frame frame;
+        while (replies.size() < requests.size()) {
+            if (!read_frame(in, offset, frame, std::numeric_limits<std::uint32_t>::max())) {
+                if (!receive(fd, in, offset)) {
+                    throw std::runtime_error("Connection closed by " + socketPath);
                 }
+                continue;
             }
+            if (frame.id != first + replies.size()) {
+                throw std::runtime_error("Unexpected reply from " + socketPath);
+            }
+            replies.push_back({frame.code == 0, frame.Decode()});
         }
-        std::ofstream tbFileOut(file);
-        tbFileOut << data;
-        result = true;
-
     } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return result;
+        // the replies left on the connection would be read by the next call
+        Disconnect();
+        throw;
     }
-    return result;
+    return replies;
 }
-bool Table::DeleteDocument(const nlohmann::json &query){
-    bool result = false;
-    try {
-        std::ifstream tbFile(file);
-
-        nlohmann::json data;
-        tbFile >> data;
-        tbFile.close();
-        if(!data.is_array()||data.size()<1){
-            return false;
-        }
-        for (int i = 0; i < data.size(); i++) {
-            if (match_query(data[i], query)) {
-                data.erase(data.begin() + i);
-                break;
-            }
-        }
-        std::ofstream tbFileOut(file);
-        tbFileOut << data;
-        result = true;
 
-    } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return result;
+nlohmann::json Client::Call(const RemoteRequest &request) {
+    RemoteReply reply = std::move(Pipeline({request}).front());
+    if (!reply.ok) {
+        throw std::runtime_error(reply.value.is_string() ? reply.value.get<std::string>() : reply.value.dump());
     }
-    return result;
+    return std::move(reply.value);
 }
-bool Table::DeleteDocuments(const nlohmann::json &query){
-    bool result = false;
-    try {
-        std::ifstream tbFile(file);
 
-        nlohmann::json data;
-        tbFile >> data;
-        tbFile.close();
-        nlohmann::json copy = data;
-        if(!data.is_array()||data.size()<1){
-            return false;
-        }
-        for (int i = 0; i < data.size(); i++) {
-            if (match_query(data[i], query)) {
-                copy.erase(copy.begin() + i);
-            }
-        }
-        std::ofstream tbFileOut(file);
-        tbFileOut << copy;
-//        std::cout << copy.dump(4) <<std::endl;
-        result = true;
+RemoteTable::RemoteTable(const std::string &tableName, Client &client) : name(tableName), client(client) {}
+
+std::string RemoteTable::GetName() const {
+    return name;
+}
 
+nlohmann::json RemoteTable::Call(RemoteCommand command, nlohmann::json arguments, nlohmann::json fallback) {
+    try {
+        return client.Call({command, name, std::move(arguments)});
     } catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return result;
+        std::cerr << "Error on remote table " << name << ": " << e.what() << std::endl;
+        return fallback;
     }
-    return result;
+}
+
+bool RemoteTable::Create(const TableOptions &options) {
+    return Call(RemoteCommand::Create, nlohmann::json::array({options_to_json(options)}), false).get<bool>();
+}
+
+TableOptions RemoteTable::GetOptions() {
+    return options_from_json(Call(RemoteCommand::GetOptions, nlohmann::json::array(), nlohmann::json::object()));
+}
+
+bool RemoteTable::CreateTextIndex(const std::string &field) {
+    return Call(RemoteCommand::CreateTextIndex, nlohmann::json::array({field}), false).get<bool>();
+}
+
+bool RemoteTable::Exists() {
+    return Call(RemoteCommand::Exists, nlohmann::json::array(), false).get<bool>();
+}
+
+bool RemoteTable::Drop() {
+    return Call(RemoteCommand::Drop, nlohmann::json::array(), false).get<bool>();
+}
+
+bool RemoteTable::InsertDocument(const nlohmann::json &document) {
+    nlohmann::json id;
+    return InsertDocument(document, id);
+}
+
+bool RemoteTable::InsertDocument(const nlohmann::json &document, nlohmann::json &id) {
+    nlohmann::json reply = Call(RemoteCommand::InsertDocument, nlohmann::json::array({document}),
+                                nlohmann::json::array({false, nullptr}));
+    id = reply.at(1);
+    return reply.at(0).get<bool>();
+}
+
+nlohmann::json RemoteTable::FindDocument(const nlohmann::json &query) {
+    return Call(RemoteCommand::FindDocument, nlohmann::json::array({query}), nlohmann::json::object());
+}
+
+nlohmann::json RemoteTable::FindDocuments(const nlohmann::json &query) {
+    return Call(RemoteCommand::FindDocuments, nlohmann::json::array({query}), nlohmann::json::array());
+}
+
+nlohmann::json RemoteTable::Explain(const nlohmann::json &query, const ExplainOptions &options) {
+    nlohmann::json explain = {{"execute", options.execute}, {"first", options.first}};
+    return Call(RemoteCommand::Explain, nlohmann::json::array({query, explain}), nlohmann::json::object());
+}
+
+bool RemoteTable::UpdateDocument(const nlohmann::json &valuesToUpdate, const nlohmann::json &query) {
+    return Call(RemoteCommand::UpdateDocument, nlohmann::json::array({valuesToUpdate, query}), false).get<bool>();
+}
+
+bool RemoteTable::UpdateDocuments(const nlohmann::json &valuesToUpdate, const nlohmann::json &query) {
+    return Call(RemoteCommand::UpdateDocuments, nlohmann::json::array({valuesToUpdate, query}), false).get<bool>();
+}
+
+bool RemoteTable::DeleteDocument(const nlohmann::json &query) {
+    return Call(RemoteCommand::DeleteDocument, nlohmann::json::array({query}), false).get<bool>();
+}
+
+bool RemoteTable::DeleteDocuments(const nlohmann::json &query) {
+    return Call(RemoteCommand::DeleteDocuments, nlohmann::json::array({query}), false).get<bool>();
+}
+
+nlohmann::json RemoteTable::Upsert(const nlohmann::json &query, const nlohmann::json &valuesToUpdate) {
+    return Call(RemoteCommand::Upsert, nlohmann::json::array({query, valuesToUpdate}), nlohmann::json::object());
+}
+
+nlohmann::json RemoteTable::FindOneAndUpdate(const nlohmann::json &query, const nlohmann::json &valuesToUpdate,
+                                             bool returnNew) {
+    return Call(RemoteCommand::FindOneAndUpdate, nlohmann::json::array({query, valuesToUpdate, returnNew}),
+                nlohmann::json::object());
+}
+
+nlohmann::json RemoteTable::GetById(const nlohmann::json &id) {
+    return Call(RemoteCommand::GetById, nlohmann::json::array({id}), nlohmann::json::object());
+}
+
+nlohmann::json RemoteTable::GetByIds(const nlohmann::json &ids) {
+    return Call(RemoteCommand::GetByIds, nlohmann::json::array({ids}), nlohmann::json::array());
+}
+
+bool RemoteTable::UpdateById(const nlohmann::json &id, const nlohmann::json &valuesToUpdate) {
+    return Call(RemoteCommand::UpdateById, nlohmann::json::array({id, valuesToUpdate}), false).get<bool>();
+}
+
+bool RemoteTable::DeleteById(const nlohmann::json &id) {
+    return Call(RemoteCommand::DeleteById, nlohmann::json::array({id}), false).get<bool>();
+}
 
+bool RemoteTable::Compact() {
+    return Call(RemoteCommand::Compact, nlohmann::json::array(), false).get<bool>();
 }
+#endif
 
 }  // namespace jsondb
@@ -28,10 +28,30 @@
 #ifndef SRC_JSONDB_H_
 #define SRC_JSONDB_H_
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <future>
+#include <initializer_list>
 #include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 // #include "nlohmann/json.hpp"
@@ -69,11 +89,14 @@ extern const char DEFAULT_DBPATH[];
  * false otherwise.
  *
  * @note This function is capable of handling JSON values of different
- * types, such as strings, numbers, booleans, and nulls.
+ * types, such as strings, numbers, booleans, and nulls. Strings also
+ * support "$prefix", "$contains" and "$regex", an ECMAScript regular
+ * expression searched anywhere in the value.
  * @warning Data types must be compatible with the specified comparison
  * operator to obtain meaningful results.
  */
-bool generic_comparator(std::string comparisonOperator, nlohmann::json documentValue, nlohmann::json queryValue);
+bool generic_comparator(const std::string &comparisonOperator, const nlohmann::json &documentValue,
+                        const nlohmann::json &queryValue);
 
 /**
  * @brief Matches a JSON document against a query.
@@ -92,182 +115,2482 @@ bool generic_comparator(std::string comparisonOperator, nlohmann::json documentV
  */
 bool match_query(const nlohmann::json &document, const nlohmann::json &query);
 
+/**
+ * @brief Applies an update to a JSON document in place.
+ *
+ * The update is either a plain object whose members are assigned to the
+ * document, or an object of update operators:
+ *   - "$set": assign the given fields
+ *   - "$unset": remove the given fields
+ *   - "$inc": add the given number to numeric fields (missing fields start at 0)
+ *   - "$push": append the given value to array fields (missing fields become arrays)
+ *
+ * @param document The JSON document to modify.
+ * @param update The update to apply.
+ *
+ * @throws std::invalid_argument if the update mixes operators and plain
+ * fields, uses an unknown operator or targets a field of the wrong type.
+ * The document may be partially updated when an exception is thrown.
+ */
+void apply_update(nlohmann::json &document, const nlohmann::json &update);
+
+/**
+ * @brief Converts an update into its operator form.
+ *
+ * A plain object of fields becomes a "$set" update, an operator update is
+ * returned unchanged.
+ *
+ * @param update The update to normalize.
+ * @return The equivalent operator update.
+ */
+nlohmann::json normalize_update(const nlohmann::json &update);
+
+/**
+ * @brief Shared runtime state of a database, defined in jsondb.cpp.
+ */
+struct DatabaseState;
+
+/**
+ * @brief Shared runtime state of a table, defined in jsondb.cpp.
+ *
+ * Every `Table` instance that refers to the same table of the same `JsonDB`
+ * shares one `TableState`, so version counters and caches stay coherent.
+ */
+struct TableState;
+
+/**
+ * @brief Documents of a table with their tombstones, defined in jsondb.cpp.
+ */
+struct TableData;
+
+/**
+ * @brief Format of the files read by `Table::Import` and written by `Table::Export`.
+ */
+enum class FileFormat {
+    NdJson,   ///< One JSON document per line.
+    JsonArray ///< A single JSON array of documents, like a table file.
+};
+
+/**
+ * @brief How missing primary keys are generated on insert.
+ */
+enum class IdGenerator {
+    None,      ///< Documents must carry their own primary key.
+    Monotonic, ///< Next integer after the greatest integer key in the table.
+    ObjectId   ///< 24 hex characters: timestamp, process random and counter.
+};
+
+/**
+ * @brief Options of a table, stored with the table in the database catalog.
+ */
+struct TableOptions {
+    /**
+     * @brief Field holding the primary key, empty for a table without one.
+     */
+    std::string primaryKey = {};
+
+    /**
+     * @brief How the primary key is generated when a document has none.
+     */
+    IdGenerator idGenerator = IdGenerator::None;
+
+    /**
+     * @brief Top-level string fields with a trigram index, which narrows
+     * the documents examined by "$prefix", "$contains" and "$regex".
+     */
+    std::vector<std::string> textIndexes = {};
+};
+
+/**
+ * @brief Options of `Table::Explain`.
+ */
+struct ExplainOptions {
+    /**
+     * @brief Run the query to report what it actually examined and how long
+     * each phase took, otherwise only the plan and its estimate are reported.
+     */
+    bool execute = true;
+
+    /**
+     * @brief Explain `FindDocument`, which stops at the first match, rather
+     * than `FindDocuments`.
+     */
+    bool first = false;
+};
+
+/**
+ * @brief How `JsonDB::Join` pairs the documents of two tables.
+ */
+struct JoinOptions {
+    /**
+     * @brief Top-level field of the left documents.
+     */
+    std::string leftField = {};
+
+    /**
+     * @brief Top-level field of the right documents, equal to `leftField`
+     * in matching documents.
+     */
+    std::string rightField = {};
+
+    /**
+     * @brief Field of the left documents receiving their matches, the name
+     * of the right table if empty.
+     */
+    std::string as = {};
+
+    /**
+     * @brief Memory cap of the hash table in bytes. A larger build side is
+     * joined in several passes, each over a partition of the join keys.
+     */
+    std::size_t maxBuildBytes = 64 * 1024 * 1024;
+};
+
+/**
+ * @brief A change made to a table, as published by its change feed.
+ */
+struct ChangeEvent {
+    /**
+     * @brief Position of the change in the feed of the table, starting at 1.
+     */
+    std::uint64_t sequence = 0;
+
+    /**
+     * @brief "insert", "update" or "delete".
+     */
+    std::string operation;
+
+    /**
+     * @brief The document after an insert or update, before a delete.
+     */
+    nlohmann::json document;
+};
+
+/**
+ * @brief Function called with the changes a `Table::Watch` subscribed to.
+ */
+using ChangeCallback = std::function<void(const ChangeEvent &)>;
+
+/**
+ * @brief A top-level field of a document, read without building a JSON value.
+ */
+struct FieldValue {
+    /**
+     * @brief Type of the value; arrays and objects are `Other`.
+     */
+    enum Kind { Missing, Null, Boolean, Integer, Unsigned, Float, String, Other } kind = Missing;
+
+    bool boolean = false;            ///< Value of a `Boolean`.
+    std::int64_t integer = 0;        ///< Value of an `Integer`.
+    std::uint64_t unsignedValue = 0; ///< Value of an `Unsigned`.
+    double number = 0;               ///< Value of a `Float`.
+    std::string_view string;         ///< Value of a `String`, valid during the callback.
+};
+
+/**
+ * @brief An operation recorded by the slow-operation log of a table.
+ */
+struct SlowOperation {
+    /**
+     * @brief Name of the operation, such as "Table::FindDocuments".
+     */
+    std::string operation;
+
+    /**
+     * @brief Name of the table.
+     */
+    std::string table;
+
+    /**
+     * @brief The query with every literal replaced by "?", null when the
+     * operation has none.
+     */
+    nlohmann::json query;
+
+    /**
+     * @brief Plan of the query, as reported by `Table::Explain`, "cache" for
+     * a query cache hit or "none" for an operation without a query.
+     */
+    std::string plan;
+
+    /**
+     * @brief Number of documents examined.
+     */
+    std::size_t documentsScanned = 0;
+
+    /**
+     * @brief Duration of the operation in microseconds.
+     */
+    double durationUs = 0;
+
+    /**
+     * @brief True when recorded by sampling rather than for its duration.
+     */
+    bool sampled = false;
+};
+
+/**
+ * @brief Function called with the operations of a slow-operation log.
+ *
+ * It runs on the thread of the operation, possibly on several threads at once.
+ */
+using SlowOperationCallback = std::function<void(const SlowOperation &)>;
+
+/**
+ * @brief Options of the slow-operation log of a table.
+ */
+struct SlowLogOptions {
+    /**
+     * @brief Operations lasting at least this many microseconds are recorded.
+     */
+    double thresholdUs = 100000;
+
+    /**
+     * @brief Fraction of the faster operations recorded anyway, from 0 to 1.
+     */
+    double sampleRate = 0;
+
+    /**
+     * @brief File the operations are appended to as JSON lines, none if empty.
+     */
+    std::string path = {};
+
+    /**
+     * @brief Size at which the file is rotated to `path.1`, `path.2`, ...
+     */
+    std::size_t maxFileBytes = 16 * 1024 * 1024;
+
+    /**
+     * @brief Number of rotated files kept besides the current one.
+     */
+    std::size_t maxFiles = 4;
+
+    /**
+     * @brief Function called with every recorded operation, none if empty.
+     */
+    SlowOperationCallback callback = {};
+};
+
+/**
+ * @brief Get the memory resource of the innermost `ArenaScope` of the thread.
+ * @return The resource, or `std::pmr::new_delete_resource()` outside any scope.
+ */
+std::pmr::memory_resource *current_arena() noexcept;
+
+/**
+ * @brief Make `ArenaJson` values created on this thread allocate from a resource.
+ *
+ * Typically used with a `std::pmr::monotonic_buffer_resource`, so that a
+ * whole result is allocated by bumping a pointer and freed at once with the
+ * resource. Values must be destroyed while a scope of the same resource is
+ * active, or outlived by the resource and never destroyed.
+ */
+class ArenaScope {
+   public:
+    /**
+     * @brief Make a resource the current arena of the thread.
+     * @param resource The resource, which must outlive the scope.
+     */
+    explicit ArenaScope(std::pmr::memory_resource *resource) noexcept;
+
+    /**
+     * @brief Restore the previous arena of the thread.
+     */
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+   private:
+    std::pmr::memory_resource *previous;
+};
+
+/**
+ * @brief Allocator bound to the current arena of the thread when created.
+ *
+ * `nlohmann::basic_json` default-constructs its allocators, so the resource
+ * cannot be passed explicitly and is taken from `current_arena()` instead.
+ */
+template <class T>
+class ArenaAllocator {
+   public:
+    using value_type = T;
+
+    ArenaAllocator() noexcept : resource(current_arena()) {}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept : resource(other.GetResource()) {}
+
+    T *allocate(std::size_t count) {
+        return static_cast<T *>(resource->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *pointer, std::size_t count) noexcept {
+        resource->deallocate(pointer, count * sizeof(T), alignof(T));
+    }
+
+    std::pmr::memory_resource *GetResource() const noexcept { return resource; }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U> &other) const noexcept {
+        return resource->is_equal(*other.GetResource());
+    }
+
+    template <class U>
+    bool operator!=(const ArenaAllocator<U> &other) const noexcept {
+        return !(*this == other);
+    }
+
+   private:
+    std::pmr::memory_resource *resource;
+};
+
+/**
+ * @brief String type of `ArenaJson`.
+ */
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+/**
+ * @brief JSON value whose objects, arrays and strings come from the current arena.
+ */
+using ArenaJson = nlohmann::basic_json<std::map, std::vector, ArenaString, bool, std::int64_t,
+                                       std::uint64_t, double, ArenaAllocator>;
+
+/**
+ * @brief Documents found by a query, kept serialized in a single buffer.
+ *
+ * The buffer holds the documents as a JSON array, byte for byte the
+ * `dump()` of the matching `FindDocuments` result, so it can be written
+ * out as is. Each document is a view into the buffer and is only parsed
+ * when asked for.
+ */
+class RawDocuments {
+   public:
+    /**
+     * @brief Get the number of documents.
+     * @return The number of documents.
+     */
+    std::size_t Size() const;
+
+    /**
+     * @brief Get the documents as a serialized JSON array.
+     * @return A view valid until the documents are replaced or destroyed.
+     */
+    std::string_view Text() const;
+
+    /**
+     * @brief Get a serialized document.
+     * @param i The index of the document.
+     * @return A view into `Text()`.
+     */
+    std::string_view Text(std::size_t i) const;
+
+    /**
+     * @brief Get where a document lies in `Text()`.
+     * @param i The index of the document.
+     * @return The offset and the length of the document.
+     */
+    std::pair<std::size_t, std::size_t> Offset(std::size_t i) const;
+
+    /**
+     * @brief Parse a document.
+     * @param i The index of the document.
+     * @return The document.
+     */
+    nlohmann::json Json(std::size_t i) const;
+
+   private:
+    std::string buffer = "[]";
+    std::vector<std::pair<std::size_t, std::size_t>> offsets;
+
+    friend class Table;
+};
+
+/**
+ * @brief Counters describing the activity of a `QueryCache`.
+ */
+struct QueryCacheStats {
+    std::uint64_t hits = 0;      ///< Lookups answered from the cache.
+    std::uint64_t misses = 0;    ///< Lookups that had to run the query.
+    std::uint64_t evictions = 0; ///< Entries dropped to respect the memory cap.
+    std::size_t entries = 0;     ///< Entries currently cached.
+    std::size_t bytes = 0;       ///< Approximate memory used by the entries.
+    std::size_t capacity = 0;    ///< Memory cap in bytes (0 means disabled).
+};
+
+/**
+ * @brief Least-recently-used cache of query results.
+ *
+ * Entries are keyed by a canonical form of the query (see `MakeKey`) and
+ * tagged with the table version they were computed against. A lookup made
+ * with a different version is a miss and drops the stale entry, so bumping
+ * the table version invalidates every cached result at once.
+ *
+ * @note All methods are thread safe.
+ */
+class QueryCache {
+   public:
+    /**
+     * @brief Constructor for QueryCache class.
+     * @param capacityBytes Memory cap in bytes, 0 disables the cache.
+     */
+    explicit QueryCache(std::size_t capacityBytes = 0);
+
+    /**
+     * @brief Change the memory cap, evicting entries if needed.
+     * @param capacityBytes Memory cap in bytes, 0 disables the cache.
+     */
+    void SetCapacity(std::size_t capacityBytes);
+
+    /**
+     * @brief Get the memory cap of the cache.
+     * @return The memory cap in bytes.
+     */
+    std::size_t GetCapacity() const;
+
+    /**
+     * @brief Look up a cached result.
+     * @param key The canonical key of the query.
+     * @param version The current version of the table.
+     * @param result Receives a copy of the cached result on a hit.
+     * @return True on a hit, false otherwise.
+     */
+    bool Get(const std::string &key, std::uint64_t version,
+             nlohmann::json &result);
+
+    /**
+     * @brief Store a result computed against the given table version.
+     *
+     * Results larger than the whole capacity are not cached.
+     *
+     * @param key The canonical key of the query.
+     * @param version The table version the result was computed against.
+     * @param result The query result.
+     */
+    void Put(const std::string &key, std::uint64_t version,
+             const nlohmann::json &result);
+
+    /**
+     * @brief Remove every entry, keeping the counters.
+     */
+    void Clear();
+
+    /**
+     * @brief Get the cache counters.
+     * @return A copy of the current counters.
+     */
+    QueryCacheStats Stats() const;
+
+    /**
+     * @brief Build the canonical cache key of a query.
+     *
+     * Object keys of `nlohmann::json` are kept sorted, so two queries with
+     * the same members produce the same key whatever order they were
+     * written in.
+     *
+     * @param operation Name of the operation and its options.
+     * @param query The JSON query.
+     * @return The canonical key.
+     */
+    static std::string MakeKey(const std::string &operation,
+                               const nlohmann::json &query);
+
+   private:
+    struct Entry {
+        std::string key;
+        std::uint64_t version;
+        nlohmann::json result;
+        std::size_t bytes;
+    };
+
+    void EvictUntil(std::size_t limit);
+
+    mutable std::mutex mutex;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    QueryCacheStats stats;
+};
+
+/**
+ * @brief Interface of the file access used for table, journal and index files.
+ *
+ * Implementations must be safe to call from several threads and report
+ * failures by throwing `std::runtime_error`.
+ */
+class IoBackend {
+   public:
+    virtual ~IoBackend() = default;
+
+    /**
+     * @brief Get the name of the backend, such as "posix" or "io_uring".
+     * @return The name of the backend.
+     */
+    virtual std::string GetName() const = 0;
+
+    /**
+     * @brief Read whole files, possibly in parallel.
+     * @param paths The files to read.
+     * @return The content of every file, in order, empty for a missing file.
+     */
+    virtual std::vector<std::string> ReadFiles(const std::vector<std::string> &paths) = 0;
+
+    /**
+     * @brief Replace the content of a file, creating it if needed.
+     * @param path The file to write.
+     * @param content The new content.
+     * @param sync Wait until the content reaches the disk.
+     */
+    virtual void WriteFile(const std::string &path, const std::string &content, bool sync) = 0;
+
+    /**
+     * @brief Append to a file, creating it if needed.
+     * @param path The file to append to.
+     * @param content The content to append.
+     * @param sync Wait until the content reaches the disk.
+     */
+    virtual void AppendFile(const std::string &path, const std::string &content, bool sync) = 0;
+
+    /**
+     * @brief Flush files already written to the disk, skipping missing ones.
+     * @param paths The files to flush.
+     */
+    virtual void SyncFiles(const std::vector<std::string> &paths) = 0;
+};
+
+/**
+ * @brief Create a backend using blocking POSIX (or Windows CRT) calls.
+ * @return The backend.
+ */
+std::shared_ptr<IoBackend> make_posix_io_backend();
+
+/**
+ * @brief Create a backend batching its requests through a Linux io_uring.
+ *
+ * Reads of several files are submitted together and an append followed by
+ * a flush is submitted as a linked write and fsync.
+ *
+ * @param queueDepth Number of requests submitted at once.
+ * @return The backend, or nullptr when io_uring is not compiled in or not
+ * allowed by the kernel.
+ */
+std::shared_ptr<IoBackend> make_io_uring_backend(unsigned queueDepth = 64);
+
+/**
+ * @brief Create the io_uring backend, falling back to the POSIX one.
+ * @return The backend.
+ */
+std::shared_ptr<IoBackend> make_io_backend();
+
+/**
+ * @brief Fixed pool of threads running the asynchronous operations of a database.
+ */
+class Executor {
+   public:
+    /**
+     * @brief Start the worker threads.
+     * @param threadCount Number of threads, 0 for one per hardware thread.
+     */
+    explicit Executor(std::size_t threadCount = 0);
+
+    /**
+     * @brief Run the queued tasks, then stop the worker threads.
+     */
+    ~Executor();
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    /**
+     * @brief Queue a task to run on one of the worker threads.
+     * @param task The task to run.
+     */
+    void Submit(std::function<void()> task);
+
+    /**
+     * @brief Get the number of worker threads.
+     * @return The number of worker threads.
+     */
+    std::size_t GetThreadCount() const;
+
+   private:
+    void Run();
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
+
+/**
+ * @brief Pending changes of a transaction to one table, defined in jsondb.cpp.
+ */
+struct TransactionEntry;
+
+class Transaction;
+
+template <class E>
+class Query;
+
 /**
  * @brief Class for managing JSON databases.
  */
-class JsonDB {
+class JsonDB {
+   private:
+    std::string name;
+    std::string path;
+    std::string file;
+    std::string tablesPath;
+    std::string transactionsFile;
+    std::shared_ptr<DatabaseState> state;
+
+    void Recover() const;
+    void Checkpoint() const;
+
+    friend class Table;
+    friend class Transaction;
+
+   public:
+    /**
+     * @brief Constructor for JsonDB class.
+     * @param dbName The name of the database.
+     * @param dbPath The path to the database (default is "./data").
+     */
+    JsonDB(const std::string &dbName,
+           const std::string &dbPath = DEFAULT_DBPATH);
+
+    /**
+     * @brief Destructor for JsonDB class.
+     */
+    ~JsonDB();
+
+    /**
+     * @brief Get the name of the database.
+     * @return The name of the database.
+     */
+    std::string GetName() const;
+
+    /**
+     * @brief Get the path to the database.
+     * @return The path to the database.
+     */
+    std::string GetPath() const;
+
+    /**
+     * @brief Get the filename of the database.
+     * @return The filename of the database.
+     */
+    std::string GetFile() const;
+
+    /**
+     * @brief Get the path of tables files.
+     * @return The path of the tables files.
+     */
+    std::string GetTablesPath() const;
+
+    /**
+     * @brief Create a new database.
+     * @return True if the database is created successfully, false otherwise.
+     */
+    bool Create();
+
+    /**
+     * @brief Check if the database exists.
+     * @return True if the database exists, false otherwise.
+     */
+    bool Exists();
+
+    /**
+     * @brief Drop (delete) the database.
+     * @return True if the database is successfully dropped, false otherwise.
+     */
+    bool Drop();
+
+    /**
+     * @brief Write a consistent point-in-time copy of the database.
+     *
+     * The copy is laid out like the database under `destPath`, so it opens
+     * with `JsonDB(GetName(), destPath)`. Writers of every table are
+     * blocked only while table files, which are never modified in place,
+     * are hard-linked and the sizes of the growing journals are noted;
+     * journals and files that cannot be linked are then copied as reflinks
+     * where the file system supports them, or byte by byte.
+     *
+     * @param destPath The directory receiving the copy.
+     * @return True if the copy is complete, false otherwise.
+     */
+    bool Snapshot(const std::string &destPath) const;
+
+    /**
+     * @brief Get a vector of tables in the database.
+     *
+     * Each table is described by the string members of its catalog entry,
+     * such as "name" and "primaryKey"; its index list is not included.
+     *
+     * @return A vector of table in the database.
+     */
+    std::vector<std::unordered_map<std::string, std::string>> Tables();
+
+    /**
+     * @brief Join two tables like an aggregation `$lookup` stage.
+     *
+     * Every document of the left table is passed on with the array of
+     * right documents whose `rightField` equals its `leftField` added as
+     * `as`. Values are equal when their JSON text is, as for primary keys;
+     * a missing field matches nothing. When `rightField` is the primary key
+     * of the right table its index is probed; otherwise a hash table is
+     * built over the smaller side and the other side is streamed through
+     * it, in as many passes as `maxBuildBytes` requires. Each pass holds
+     * one partition of the join keys and passes its left documents on as
+     * soon as it is probed, so left documents come in table order within
+     * a pass only. Left documents that are not objects are passed on
+     * unchanged.
+     *
+     * @param left The name of the left table.
+     * @param right The name of the right table.
+     * @param options The fields to join on and the memory cap.
+     * @param sink Called with every joined document.
+     * @return True if the tables were joined, false on error.
+     */
+    bool Join(const std::string &left, const std::string &right, const JoinOptions &options,
+              const std::function<void(nlohmann::json &&document)> &sink) const;
+
+    /**
+     * @brief Join two tables into an array, see the streaming overload.
+     * @param left The name of the left table.
+     * @param right The name of the right table.
+     * @param options The fields to join on and the memory cap.
+     * @return A JSON array of the joined documents, empty on error.
+     */
+    nlohmann::json Join(const std::string &left, const std::string &right, const JoinOptions &options) const;
+
+    /**
+     * @brief Get the shared runtime state of a table.
+     *
+     * The state is created on first use and shared by every `Table`
+     * referring to the same table name.
+     *
+     * @param tableName The name of the table.
+     * @return The shared state of the table.
+     */
+    std::shared_ptr<TableState> GetTableState(const std::string &tableName) const;
+
+    /**
+     * @brief Get the metrics collected by the operations of the database.
+     *
+     * Reports, as JSON, the number of calls and a latency histogram summary
+     * (mean, p50, p90, p99, p999 and max, in microseconds) of every
+     * operation called at least once, the bytes read from and written to
+     * table files, the documents scanned and returned by queries, the time
+     * spent parsing and serializing, and the query cache hit rate.
+     * Collection is compiled out when the library is built with
+     * `JSONDB_METRICS=OFF`, in which case only `{"enabled": false}` is
+     * returned.
+     *
+     * @return The metrics as a JSON object.
+     */
+    nlohmann::json Stats() const;
+
+    /**
+     * @brief Start a transaction over the tables of the database.
+     * @return A transaction, committed with `Transaction::Commit`.
+     */
+    Transaction BeginTransaction() const;
+
+    /**
+     * @brief Set the executor running the asynchronous operations of the tables.
+     *
+     * The executor can be shared between databases. Operations already
+     * queued keep running on the previous executor.
+     *
+     * @param executor The executor to use.
+     */
+    void SetExecutor(std::shared_ptr<Executor> executor);
+
+    /**
+     * @brief Get the executor running the asynchronous operations of the tables.
+     *
+     * A private executor with one thread per hardware thread is started on
+     * first use when none was set.
+     *
+     * @return The executor of the database.
+     */
+    std::shared_ptr<Executor> GetExecutor() const;
+
+    /**
+     * @brief Set the backend used to access the files of the tables.
+     * @param backend The backend to use.
+     */
+    void SetIoBackend(std::shared_ptr<IoBackend> backend);
+
+    /**
+     * @brief Get the backend used to access the files of the tables.
+     *
+     * `make_io_backend` is used on first use when none was set.
+     *
+     * @return The backend of the database.
+     */
+    std::shared_ptr<IoBackend> GetIoBackend() const;
+};
+
+/**
+ * @brief Class for managing database tables.
+ */
+class Table {
+   private:
+    std::string name;
+    const JsonDB &db;
+    std::string file;
+    std::string journal;
+    std::string idsFile;
+    std::shared_ptr<TableState> state;
+
+    void Touch();
+    std::shared_ptr<const TableData> Snapshot() const;
+    TableData Load() const;
+    void Store(TableData &data);
+    void Append(TableData &data, const nlohmann::json &record);
+    void Publish(const TableData &base, TableData &&data, const nlohmann::json &record);
+    void Commit(const TableData &base, TableData &&data, const nlohmann::json &record);
+    bool Update(const nlohmann::json &update, const nlohmann::json &query, bool many);
+    bool Delete(const nlohmann::json &query, bool many);
+    std::future<nlohmann::json> Read(const std::string &key,
+                                     std::function<nlohmann::json(Table &)> read) const;
+    std::future<bool> Write(std::function<bool(Table &)> write) const;
+
+   public:
+    /**
+     * @brief Constructor for Table class.
+     * @param tableName The name of the table.
+     * @param db A reference to the associated JsonDB instance.
+     */
+    Table(const std::string &tableName, const JsonDB &db);
+
+    /**
+     * @brief Destructor for Table class.
+     */
+    ~Table();
+
+    /**
+     * @brief Get the name of the table.
+     * @return The name of the table.
+     */
+    std::string GetName() const;
+
+    /**
+     * @brief Create a new table.
+     * @return True if the table is created successfully, false otherwise.
+     */
+    bool Create();
+
+    /**
+     * @brief Create a new table with the given options.
+     *
+     * When `options.primaryKey` is set, every document of the table carries
+     * a unique value in that field, indexed by a hash index persisted next
+     * to the table file. Each field of `options.textIndexes` gets a text
+     * index, see `CreateTextIndex`.
+     *
+     * @param options The options of the table.
+     * @return True if the table is created successfully, false otherwise.
+     */
+    bool Create(const TableOptions &options);
+
+    /**
+     * @brief Get the options the table was created with.
+     * @return The options of the table.
+     */
+    TableOptions GetOptions();
+
+    /**
+     * @brief Index the trigrams of a top-level string field.
+     *
+     * Queries using "$prefix", "$contains" or "$regex" on the field then
+     * only examine the documents holding every trigram of the literal text
+     * the pattern requires. The index is stored in its own file, listed in
+     * the database catalog and mapped when the table is loaded; it is
+     * rebuilt when the table file changed since it was written, and
+     * extended in memory by the writes in between.
+     *
+     * @param field The field to index.
+     * @return True if the index is created or already exists, false otherwise.
+     */
+    bool CreateTextIndex(const std::string &field);
+
+    /**
+     * @brief Check if the table exists.
+     * @return True if the table exists, false otherwise.
+     */
+    bool Exists();
+
+    /**
+     * @brief Drop (delete) the table.
+     * @return True if the table is successfully dropped, false otherwise.
+     */
+    bool Drop();
+
+    /**
+     * @brief Insert a JSON document into the table.
+     * @param document The JSON document to insert.
+     * @return True if the document is inserted successfully, false otherwise.
+     */
+    bool InsertDocument(const nlohmann::json &document);
+
+    /**
+     * @brief Insert a JSON document into the table and get its primary key.
+     *
+     * The insert fails if the table has a primary key and the document
+     * repeats an existing key, or has none and the table generates none.
+     *
+     * @param document The JSON document to insert.
+     * @param id Receives the primary key of the document, or null when the
+     * table has no primary key.
+     * @return True if the document is inserted successfully, false otherwise.
+     */
+    bool InsertDocument(const nlohmann::json &document, nlohmann::json &id);
+
+    /**
+     * @brief Find the first JSON document in the table.
+     * @return The found JSON document or an empty JSON object if not found.
+     */
+    nlohmann::json FindDocument();
+
+    /**
+     * @brief Find the first JSON document in the table that match the filter.
+     * @return The found JSON document or an empty JSON object if not found.
+     */
+    nlohmann::json FindDocument(const nlohmann::json &query);
+
+    /**
+     * @brief Find multiple JSON documents in the table.
+     * @return A JSON array containing the found documents.
+     */
+    nlohmann::json FindDocuments();
+
+   /**
+     * @brief Find multiple JSON documents in the table.
+     * @return A JSON array containing the found documents.
+     */
+    nlohmann::json FindDocuments(const nlohmann::json &query);
+
+    /**
+     * @brief Find multiple JSON documents, copying them into the current arena.
+     *
+     * Call it inside an `ArenaScope` to allocate the whole result from the
+     * arena; the query cache is bypassed.
+     *
+     * @param query The JSON query.
+     * @param results Receives the found documents, appended to an array.
+     * @return True if the query ran, false on error.
+     */
+    bool FindDocuments(const nlohmann::json &query, ArenaJson &results);
+
+    /**
+     * @brief Find multiple JSON documents, serialized straight from the table.
+     *
+     * Documents are written to the buffer of `results` from their resident
+     * form without building JSON values, for callers that forward them as
+     * text; the query cache is bypassed.
+     *
+     * @param query The JSON query.
+     * @param results Receives the found documents, replacing its content.
+     * @return True if the query ran, false on error.
+     */
+    bool FindDocuments(const nlohmann::json &query, RawDocuments &results);
+
+    /**
+     * @brief Describe how a query is executed.
+     *
+     * The result holds the plan ("fullScan", "idSeek" for "$eq" or "$in"
+     * on the primary key, "textSeek" for "$prefix", "$contains" or
+     * "$regex" on a field with a text index, or "empty" when the query
+     * names a field no document has), the segments of the table and how many were pruned,
+     * the estimated number of documents examined and, when the query is
+     * executed, the actual numbers and the time of each phase in
+     * microseconds ("load", "plan", "match", "materialize" and "total"),
+     * with "cold" telling whether the table was loaded from its files.
+     * The query cache is bypassed.
+     *
+     * @param query The JSON query.
+     * @param options What to explain.
+     * @return The plan as a JSON object, or an empty JSON object on error.
+     */
+    nlohmann::json Explain(const nlohmann::json &query, const ExplainOptions &options = {});
+
+    /**
+     * @brief Find the documents matching a query expression.
+     *
+     * The expression is evaluated on the fields of the resident documents
+     * without any operator lookup; its `PlanJson` form plans the scan and is
+     * what the slow-operation log records. The query cache is bypassed.
+     *
+     * @param query The query, such as `field("age") >= 28 && field("city").in({"NY", "LA"})`.
+     * @return A JSON array containing the found documents.
+     */
+    template <class E>
+    nlohmann::json FindDocuments(const Query<E> &query);
+
+    /**
+     * @brief Find the documents whose fields satisfy a predicate.
+     *
+     * Used by query expressions, see `FindDocuments(const Query<E> &)`.
+     *
+     * @param query The JSON form of the predicate, used to plan and log the scan.
+     * @param fields The names of the top-level fields the predicate reads.
+     * @param predicate Called with one value per field for every candidate document.
+     * @return A JSON array containing the found documents.
+     */
+    nlohmann::json FindDocuments(const nlohmann::json &query, const std::vector<std::string> &fields,
+                                 const std::function<bool(const FieldValue *values)> &predicate);
+
+    /**
+     * @brief Read top-level fields of every document straight from the table.
+     *
+     * Used by `TypedTable` to decode records without building JSON values.
+     *
+     * @param fields The names of the fields to read.
+     * @param row Called once per document, in table order, with one value
+     *            per field.
+     * @return True if the table was read, false on error.
+     */
+    bool ReadFields(const std::vector<std::string> &fields,
+                    const std::function<void(const FieldValue *values)> &row) const;
+
+    /**
+     * @brief Set fields of, or delete, documents picked by their row in `ReadFields`.
+     *
+     * Used by `TypedTable` to write back records it decoded, without
+     * looking the documents up again. Rows count the documents `ReadFields`
+     * passes, in its order.
+     *
+     * @param version The table version the rows were read at. Nothing is
+     *                written if the table changed since.
+     * @param rows The rows to write, in ascending order.
+     * @param values For every row, an object of fields to set, see
+     *               `UpdateDocuments`; empty to delete the rows instead.
+     * @return True if the rows are written, false if the table changed or on error.
+     */
+    bool WriteRows(std::uint64_t version, const std::vector<std::size_t> &rows,
+                   const std::vector<nlohmann::json> &values);
+
+    /**
+     * @brief Update the first JSON document in the table that match the filter.
+     *
+     * `valuesToUpdate` is either a plain object of fields to assign or an
+     * object of update operators ("$set", "$unset", "$inc", "$push"), see
+     * `apply_update`. The change is appended to the table journal as a
+     * single delta record instead of rewriting the table file.
+     *
+     * @return True if the document is updated successfully, false otherwise.
+     */
+    bool UpdateDocument(const nlohmann::json &valuesToUpdate, const nlohmann::json &query);
+
+    /**
+     * @brief Update every JSON document in the table that match the filter.
+     *
+     * Accepts the same updates as `UpdateDocument`.
+     *
+     * @return True if the documents are updated successfully, false otherwise.
+     */
+    bool UpdateDocuments(const nlohmann::json &valuesToUpdate, const nlohmann::json &query);
+
+    /**
+     * @brief Delete the first JSON document from the table that match the filter.
+     *
+     * The document is marked dead by a tombstone record appended to the
+     * table journal; its space is reclaimed by `Compact`.
+     *
+     * @return True if the document is deleted successfully, false otherwise.
+     */
+    bool DeleteDocument(const nlohmann::json &query);
+
+    /**
+     * @brief Delete every JSON document from the table that match the filter.
+     *
+     * All the matched documents are marked dead by a single tombstone record.
+     *
+     * @return True if the documents are deleted successfully, false otherwise.
+     */
+    bool DeleteDocuments(const nlohmann::json &query);
+
+    /**
+     * @brief Asynchronous `FindDocument`, run on the database executor.
+     *
+     * Identical reads issued while one is still pending and before any
+     * write share its result instead of scanning the table again. The
+     * `JsonDB` must stay alive until the future is ready.
+     *
+     * @param query The JSON query.
+     * @return A future receiving the found document.
+     */
+    std::future<nlohmann::json> FindDocumentAsync(const nlohmann::json &query) const;
+
+    /**
+     * @brief Asynchronous `FindDocuments`, coalesced like `FindDocumentAsync`.
+     * @param query The JSON query.
+     * @return A future receiving the found documents.
+     */
+    std::future<nlohmann::json> FindDocumentsAsync(const nlohmann::json &query) const;
+
+    /**
+     * @brief Asynchronous `InsertDocument`, run on the database executor.
+     * @param document The JSON document to insert.
+     * @return A future receiving the result of `InsertDocument`.
+     */
+    std::future<bool> InsertDocumentAsync(const nlohmann::json &document) const;
+
+    /**
+     * @brief Asynchronous `UpdateDocuments`, run on the database executor.
+     * @param valuesToUpdate The update to apply, see `UpdateDocument`.
+     * @param query The JSON query.
+     * @return A future receiving the result of `UpdateDocuments`.
+     */
+    std::future<bool> UpdateDocumentsAsync(const nlohmann::json &valuesToUpdate,
+                                           const nlohmann::json &query) const;
+
+    /**
+     * @brief Asynchronous `DeleteDocuments`, run on the database executor.
+     * @param query The JSON query.
+     * @return A future receiving the result of `DeleteDocuments`.
+     */
+    std::future<bool> DeleteDocumentsAsync(const nlohmann::json &query) const;
+
+    /**
+     * @brief Update the first JSON document that match the filter, or insert one.
+     *
+     * When no document matches, a new one is built from the "$eq" conditions
+     * of the query, the update is applied to it and it is inserted. The
+     * lookup, the change and its journal record happen under one lock.
+     *
+     * @param query The JSON query selecting the document.
+     * @param valuesToUpdate The update to apply, see `UpdateDocument`.
+     * @return The updated or inserted document, or an empty JSON object on error.
+     */
+    nlohmann::json Upsert(const nlohmann::json &query, const nlohmann::json &valuesToUpdate);
+
+    /**
+     * @brief Atomically update the first JSON document that match the filter.
+     * @param query The JSON query selecting the document.
+     * @param valuesToUpdate The update to apply, see `UpdateDocument`.
+     * @param returnNew Return the document after the update instead of before.
+     * @return The document, or an empty JSON object if none matched.
+     */
+    nlohmann::json FindOneAndUpdate(const nlohmann::json &query, const nlohmann::json &valuesToUpdate,
+                                    bool returnNew = true);
+
+    /**
+     * @brief Find a JSON document by primary key.
+     * @param id The primary key of the document.
+     * @return The found JSON document or an empty JSON object if not found.
+     */
+    nlohmann::json GetById(const nlohmann::json &id);
+
+    /**
+     * @brief Find JSON documents by primary key.
+     * @param ids A JSON array of primary keys.
+     * @return A JSON array with the found documents, in the order of `ids`.
+     */
+    nlohmann::json GetByIds(const nlohmann::json &ids);
+
+    /**
+     * @brief Update a JSON document by primary key.
+     *
+     * Accepts the same updates as `UpdateDocument`, except that the primary
+     * key itself cannot be changed.
+     *
+     * @param id The primary key of the document.
+     * @param valuesToUpdate The update to apply.
+     * @return True if the document is updated successfully, false otherwise.
+     */
+    bool UpdateById(const nlohmann::json &id, const nlohmann::json &valuesToUpdate);
+
+    /**
+     * @brief Delete a JSON document by primary key.
+     * @param id The primary key of the document.
+     * @return True if the document is deleted successfully, false otherwise.
+     */
+    bool DeleteById(const nlohmann::json &id);
+
+    /**
+     * @brief Rewrite the table file without its dead documents.
+     *
+     * The journal is folded into the new table file, which is written aside
+     * and renamed into place, so readers are only held back while the files
+     * are swapped.
+     *
+     * @return True if the table is compacted successfully, false otherwise.
+     */
+    bool Compact();
+
+    /**
+     * @brief Set the fraction of dead documents that triggers a compaction.
+     *
+     * After every write, a compaction is queued on the database executor
+     * when the fraction of dead documents is greater than the threshold;
+     * the writer does not wait for it. The default is 0.5, a threshold of
+     * 1 or more disables automatic compaction.
+     *
+     * @param deadRatio Fraction of dead documents, between 0 and 1.
+     */
+    void SetCompactionThreshold(double deadRatio);
+
+    /**
+     * @brief Call a function for every future change matching a query.
+     *
+     * The callback runs on the writing thread, right after the change is
+     * committed and while the table writer lock is held: it may read the
+     * table but must not modify it.
+     *
+     * @param query The JSON query the changed documents must match.
+     * @param callback The function to call.
+     * @return An identifier to pass to `Unwatch`.
+     */
+    int Watch(const nlohmann::json &query, ChangeCallback callback);
+
+    /**
+     * @brief Stop calling a function registered with `Watch`.
+     * @param watchId The identifier returned by `Watch`.
+     * @return True if the watch existed, false otherwise.
+     */
+    bool Unwatch(int watchId);
+
+    /**
+     * @brief Read the changes published after a sequence number.
+     *
+     * Changes are kept in a bounded ring buffer (1024 entries by default),
+     * so a consumer that falls too far behind loses the oldest ones and
+     * should rescan the table before resuming from `GetLastSequence`.
+     *
+     * @param afterSequence The last sequence number already consumed, 0 for
+     * the oldest change still available.
+     * @param events Receives the changes, oldest first.
+     * @param maxEvents Maximum number of changes to read.
+     * @return True if no change after `afterSequence` was lost, false otherwise.
+     */
+    bool ReadChanges(std::uint64_t afterSequence, std::vector<ChangeEvent> &events,
+                     std::size_t maxEvents = 1024) const;
+
+    /**
+     * @brief Get the sequence number of the last change published.
+     * @return The sequence number, 0 if the table never changed.
+     */
+    std::uint64_t GetLastSequence() const;
+
+    /**
+     * @brief Set how many changes the change feed keeps, dropping the current ones.
+     * @param capacity Number of changes kept, 0 disables the feed.
+     */
+    void SetChangeFeedCapacity(std::size_t capacity);
+
+    /**
+     * @brief Insert every document of a file in one write of the table.
+     *
+     * The file is split at record boundaries and the chunks are parsed in
+     * parallel on the executor of the database and the calling thread;
+     * primary keys are then checked, generated and indexed in file order
+     * and the table file is written once. Either every document is
+     * imported or none is. Imported documents are not published to the
+     * change feed.
+     *
+     * @param path The file to import.
+     * @param format The format of the file.
+     * @return True if every document was imported, false otherwise.
+     */
+    bool Import(const std::string &path, FileFormat format = FileFormat::NdJson);
+
+    /**
+     * @brief Write every document of the table to a file.
+     *
+     * Documents are serialized one at a time from a snapshot of the table
+     * and written in buffered blocks, so the table is never materialized
+     * as a whole.
+     *
+     * @param path The file to write, replaced if it exists.
+     * @param format The format of the file.
+     * @return True if the file was written, false otherwise.
+     */
+    bool Export(const std::string &path, FileFormat format = FileFormat::NdJson);
+
+    /**
+     * @brief Enable the slow-operation log of the table, or replace its options.
+     *
+     * Reads and writes of the table lasting longer than the threshold, plus
+     * a sample of the others, are written to a rotating file and/or passed
+     * to a callback. The log is shared by every `Table` instance referring
+     * to this table; while it is disabled an operation only pays for an
+     * atomic load.
+     *
+     * @param options Threshold, sampling rate and destinations of the log.
+     */
+    void SetSlowLog(const SlowLogOptions &options);
+
+    /**
+     * @brief Disable the slow-operation log of the table.
+     */
+    void DisableSlowLog();
+
+    /**
+     * @brief Get the version of the table.
+     *
+     * The version starts at 0 and is bumped by every mutation made through
+     * this library (create, drop, insert, update and delete).
+     *
+     * @return The current version of the table.
+     */
+    std::uint64_t GetVersion() const;
+
+    /**
+     * @brief Get the version of the table after checking its files.
+     *
+     * Like `GetVersion`, but changes made to the files by other instances
+     * are noticed first: the table is reloaded and its version bumped.
+     *
+     * @return The current version of the table.
+     */
+    std::uint64_t SyncVersion() const;
+
+    /**
+     * @brief Enable, resize or disable the query result cache.
+     *
+     * Results of `FindDocument` and `FindDocuments` are cached until the
+     * table version changes. The cache is shared by every `Table` instance
+     * referring to this table.
+     *
+     * @param capacityBytes Memory cap in bytes, 0 disables the cache.
+     */
+    void SetQueryCacheCapacity(std::size_t capacityBytes);
+
+    /**
+     * @brief Get the query result cache counters.
+     * @return The hit/miss counters and memory usage of the cache.
+     */
+    QueryCacheStats GetQueryCacheStats() const;
+
+    friend class JsonDB;
+    friend class Transaction;
+};
+
+/**
+ * @brief Group of changes to one or more tables committed all at once.
+ *
+ * Each table is read from the snapshot of its last committed version the
+ * first time the transaction uses it; later reads in the transaction see
+ * its own changes, and nothing is visible to other readers before
+ * `Commit`. Commits are optimistic: a transaction fails to commit when a
+ * table it used was changed by someone else in the meantime.
+ *
+ * A commit is made durable by one synced append to the database
+ * transaction log (`<db>.txn`), then applied to the table journals. A log
+ * entry whose journals were not all written is replayed the next time the
+ * database is opened.
+ */
+class Transaction {
    private:
-    std::string name;
-    std::string path;
-    std::string file;
-    std::string tablesPath;
+    const JsonDB &db;
+    std::map<std::string, std::shared_ptr<TransactionEntry>> entries;
+    bool finished = false;
+
+    TransactionEntry &Entry(const std::string &tableName);
+
+   public:
+    /**
+     * @brief Constructor for Transaction class.
+     * @param db A reference to the associated JsonDB instance.
+     */
+    explicit Transaction(const JsonDB &db);
+
+    /**
+     * @brief Move constructor, the moved-from transaction is finished.
+     * @param other The transaction to take the changes of.
+     */
+    Transaction(Transaction &&other) noexcept;
+
+    Transaction(const Transaction &) = delete;
+    Transaction &operator=(const Transaction &) = delete;
+    Transaction &operator=(Transaction &&) = delete;
+
+    /**
+     * @brief Destructor for Transaction class, rolls back if not committed.
+     */
+    ~Transaction();
+
+    /**
+     * @brief Insert a JSON document into a table.
+     * @param tableName The name of the table.
+     * @param document The JSON document to insert.
+     * @return True if the document is inserted successfully, false otherwise.
+     */
+    bool InsertDocument(const std::string &tableName, const nlohmann::json &document);
+
+    /**
+     * @brief Find the JSON documents of a table that match the filter.
+     * @param tableName The name of the table.
+     * @param query The JSON query.
+     * @return A JSON array containing the found documents.
+     */
+    nlohmann::json FindDocuments(const std::string &tableName, const nlohmann::json &query);
+
+    /**
+     * @brief Update the JSON documents of a table that match the filter.
+     * @param tableName The name of the table.
+     * @param valuesToUpdate The update to apply, see `Table::UpdateDocument`.
+     * @param query The JSON query.
+     * @return True if the documents are updated successfully, false otherwise.
+     */
+    bool UpdateDocuments(const std::string &tableName, const nlohmann::json &valuesToUpdate,
+                         const nlohmann::json &query);
+
+    /**
+     * @brief Delete the JSON documents of a table that match the filter.
+     * @param tableName The name of the table.
+     * @param query The JSON query.
+     * @return True if the documents are deleted successfully, false otherwise.
+     */
+    bool DeleteDocuments(const std::string &tableName, const nlohmann::json &query);
+
+    /**
+     * @brief Apply every change of the transaction.
+     * @return True if the transaction is committed, false on conflict or error,
+     * in which case nothing is applied.
+     */
+    bool Commit();
+
+    /**
+     * @brief Discard every change of the transaction.
+     */
+    void Rollback();
+};
+
+#ifndef _WIN32
+/**
+ * @brief Table operations served by `Server` to `Client`s.
+ */
+enum class RemoteCommand : std::uint8_t {
+    Ping,
+    Create,
+    GetOptions,
+    CreateTextIndex,
+    Exists,
+    Drop,
+    InsertDocument,
+    FindDocument,
+    FindDocuments,
+    Explain,
+    UpdateDocument,
+    UpdateDocuments,
+    DeleteDocument,
+    DeleteDocuments,
+    Upsert,
+    FindOneAndUpdate,
+    GetById,
+    GetByIds,
+    UpdateById,
+    DeleteById,
+    Compact
+};
+
+/**
+ * @brief A request sent by `Client::Pipeline`.
+ */
+struct RemoteRequest {
+    /**
+     * @brief The operation to run.
+     */
+    RemoteCommand command = RemoteCommand::Ping;
+
+    /**
+     * @brief The table it runs on.
+     */
+    std::string table;
+
+    /**
+     * @brief The arguments of the `Table` method, in order.
+     */
+    nlohmann::json arguments = nlohmann::json::array();
+};
+
+/**
+ * @brief The reply to a `RemoteRequest`.
+ */
+struct RemoteReply {
+    /**
+     * @brief False when the server could not run the request.
+     */
+    bool ok = false;
+
+    /**
+     * @brief What the `Table` method returned, or the error message.
+     */
+    nlohmann::json value;
+};
+
+/**
+ * @brief Serves the tables of one database to local processes over a Unix
+ * domain socket, so that they share its caches and indexes instead of
+ * loading the tables each.
+ *
+ * Every frame is a 4 byte length of the rest of the frame, a 4 byte
+ * request id and a 1 byte code, all little-endian, then a MessagePack
+ * body. A request has a `RemoteCommand` code and the table name followed
+ * by the arguments as body; a reply has the id of its request, 0 or 1 for
+ * an error as code, and the result or the error message as body. Clients
+ * may send any number of requests before reading the replies, which come
+ * back in order on each connection. A request longer than the maximum
+ * frame size gets an error reply and closes its connection. The socket is
+ * only accessible to the user running the server.
+ */
+class Server {
+   public:
+    /**
+     * @brief Constructor for Server class.
+     * @param db The database to serve, which must outlive the server.
+     * @param socketPath Path of the socket, replaced when it exists.
+     */
+    Server(const JsonDB &db, const std::string &socketPath);
+
+    /**
+     * @brief Destructor for Server class, stops it if running.
+     */
+    ~Server();
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    /**
+     * @brief Set the largest request frame accepted, 64 MiB by default.
+     * @param bytes The maximum size of a frame after its length, in bytes.
+     */
+    void SetMaxFrameSize(std::size_t bytes);
+
+    /**
+     * @brief Listen on the socket and serve each connection on its own thread.
+     * @return True if the server is listening, false otherwise.
+     */
+    bool Start();
+
+    /**
+     * @brief Close the socket and every connection, waiting for their threads.
+     */
+    void Stop();
+
+    /**
+     * @brief Run a request against the database.
+     * @param request The request.
+     * @return The result of the `Table` method.
+     * @throws std::exception if the request is invalid.
+     */
+    nlohmann::json Execute(const RemoteRequest &request) const;
+
+   private:
+    struct Connection {
+        int fd;
+        std::atomic<bool> done{false};
+        std::thread thread;
+    };
+
+    const JsonDB &db;
+    std::string socketPath;
+    std::atomic<std::size_t> maxFrame{64 << 20};
+    int listenFd = -1;
+    std::atomic<bool> running{false};
+    std::thread acceptor;
+    std::mutex connectionsMutex;
+    std::list<Connection> connections;
+
+    void Accept();
+    void Serve(Connection &connection) const;
+};
+
+/**
+ * @brief Connection to a `Server`, opened on first use and reopened after
+ * an error. Requests of concurrent threads are serialized.
+ */
+class Client {
+   public:
+    /**
+     * @brief Constructor for Client class.
+     * @param socketPath Path of the socket of the server.
+     */
+    explicit Client(const std::string &socketPath);
+
+    /**
+     * @brief Destructor for Client class, closes the connection.
+     */
+    ~Client();
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    /**
+     * @brief Open the connection if it is not open yet.
+     * @return True if connected, false otherwise.
+     */
+    bool Connect();
 
-   public:
     /**
-     * @brief Constructor for JsonDB class.
-     * @param dbName The name of the database.
-     * @param dbPath The path to the database (default is "./data").
+     * @brief Close the connection.
      */
-    JsonDB(const std::string &dbName,
-           const std::string &dbPath = DEFAULT_DBPATH);
+    void Close();
 
     /**
-     * @brief Destructor for JsonDB class.
+     * @brief Send every request before reading any reply, in one write.
+     * @param requests The requests, run in order by the server.
+     * @return The replies, in the order of the requests.
+     * @throws std::runtime_error if the connection fails.
      */
-    ~JsonDB();
+    std::vector<RemoteReply> Pipeline(const std::vector<RemoteRequest> &requests);
 
     /**
-     * @brief Get the name of the database.
-     * @return The name of the database.
+     * @brief Run one request.
+     * @param request The request.
+     * @return The result of the `Table` method.
+     * @throws std::runtime_error if the connection fails or the server
+     * could not run the request.
      */
-    std::string GetName() const;
+    nlohmann::json Call(const RemoteRequest &request);
+
+   private:
+    std::string socketPath;
+    int fd = -1;
+    std::uint32_t nextId = 0;
+    std::mutex mutex;
+
+    bool Open();
+    void Disconnect();
+};
 
+/**
+ * @brief A table of the database of a `Server`, with the methods of
+ * `Table`. Errors, including connection failures, are reported on
+ * std::cerr and the methods return false or an empty result, as the
+ * local ones do.
+ */
+class RemoteTable {
+   public:
     /**
-     * @brief Get the path to the database.
-     * @return The path to the database.
+     * @brief Constructor for RemoteTable class.
+     * @param tableName The name of the table.
+     * @param client The connection to the server.
      */
-    std::string GetPath() const;
+    RemoteTable(const std::string &tableName, Client &client);
 
     /**
-     * @brief Get the filename of the database.
-     * @return The filename of the database.
+     * @brief Get the name of the table.
+     * @return The name of the table.
      */
-    std::string GetFile() const;
+    std::string GetName() const;
 
     /**
-     * @brief Get the path of tables files.
-     * @return The path of the tables files.
+     * @brief See `Table::Create`.
      */
-    std::string GetTablesPath() const;
+    bool Create(const TableOptions &options = {});
 
     /**
-     * @brief Create a new database.
-     * @return True if the database is created successfully, false otherwise.
+     * @brief See `Table::GetOptions`.
      */
-    bool Create();
+    TableOptions GetOptions();
 
     /**
-     * @brief Check if the database exists.
-     * @return True if the database exists, false otherwise.
+     * @brief See `Table::CreateTextIndex`.
+     */
+    bool CreateTextIndex(const std::string &field);
+
+    /**
+     * @brief See `Table::Exists`.
      */
     bool Exists();
 
     /**
-     * @brief Drop (delete) the database.
-     * @return True if the database is successfully dropped, false otherwise.
+     * @brief See `Table::Drop`.
      */
     bool Drop();
 
     /**
-     * @brief Get a vector of tables in the database.
-     * @return A vector of table in the database.
+     * @brief See `Table::InsertDocument`.
      */
-    std::vector<std::unordered_map<std::string, std::string>> Tables();
+    bool InsertDocument(const nlohmann::json &document);
+
+    /**
+     * @brief See `Table::InsertDocument`.
+     */
+    bool InsertDocument(const nlohmann::json &document, nlohmann::json &id);
+
+    /**
+     * @brief See `Table::FindDocument`.
+     */
+    nlohmann::json FindDocument(const nlohmann::json &query = {});
+
+    /**
+     * @brief See `Table::FindDocuments`.
+     */
+    nlohmann::json FindDocuments(const nlohmann::json &query = {});
+
+    /**
+     * @brief See `Table::Explain`.
+     */
+    nlohmann::json Explain(const nlohmann::json &query, const ExplainOptions &options = {});
+
+    /**
+     * @brief See `Table::UpdateDocument`.
+     */
+    bool UpdateDocument(const nlohmann::json &valuesToUpdate, const nlohmann::json &query);
+
+    /**
+     * @brief See `Table::UpdateDocuments`.
+     */
+    bool UpdateDocuments(const nlohmann::json &valuesToUpdate, const nlohmann::json &query);
+
+    /**
+     * @brief See `Table::DeleteDocument`.
+     */
+    bool DeleteDocument(const nlohmann::json &query);
+
+    /**
+     * @brief See `Table::DeleteDocuments`.
+     */
+    bool DeleteDocuments(const nlohmann::json &query);
+
+    /**
+     * @brief See `Table::Upsert`.
+     */
+    nlohmann::json Upsert(const nlohmann::json &query, const nlohmann::json &valuesToUpdate);
+
+    /**
+     * @brief See `Table::FindOneAndUpdate`.
+     */
+    nlohmann::json FindOneAndUpdate(const nlohmann::json &query, const nlohmann::json &valuesToUpdate,
+                                    bool returnNew = true);
+
+    /**
+     * @brief See `Table::GetById`.
+     */
+    nlohmann::json GetById(const nlohmann::json &id);
+
+    /**
+     * @brief See `Table::GetByIds`.
+     */
+    nlohmann::json GetByIds(const nlohmann::json &ids);
+
+    /**
+     * @brief See `Table::UpdateById`.
+     */
+    bool UpdateById(const nlohmann::json &id, const nlohmann::json &valuesToUpdate);
+
+    /**
+     * @brief See `Table::DeleteById`.
+     */
+    bool DeleteById(const nlohmann::json &id);
+
+    /**
+     * @brief See `Table::Compact`.
+     */
+    bool Compact();
+
+   private:
+    std::string name;
+    Client &client;
+
+    nlohmann::json Call(RemoteCommand command, nlohmann::json arguments, nlohmann::json fallback);
 };
+#endif
 
 /**
- * @brief Class for managing database tables.
+ * @brief A member of a record type stored under a field name.
+ * @tparam T The record type.
+ * @tparam M The type of the member: bool, an arithmetic type or std::string.
  */
-class Table {
-   private:
-    std::string name;
-    const JsonDB &db;
-    std::string file;
+template <class T, class M>
+struct Field {
+    const char *name;
+    M T::*member;
+};
+
+/**
+ * @brief Describe a member of a record type.
+ * @param name The name of the field in the documents.
+ * @param member The member.
+ * @return The field descriptor.
+ */
+template <class T, class M>
+constexpr Field<T, M> make_field(const char *name, M T::*member) {
+    return {name, member};
+}
+
+/**
+ * @brief Describe a member stored under its own name.
+ */
+#define JSONDB_FIELD(Type, member) ::jsondb::make_field(#member, &Type::member)
+
+/**
+ * @brief Fields of a record type, to specialize for every type of a `TypedTable`.
+ *
+ * A specialization holds the field descriptors in a constexpr tuple:
+ * @code
+ * template <>
+ * struct jsondb::TableFields<User> {
+ *     static constexpr auto value = std::make_tuple(JSONDB_FIELD(User, name), JSONDB_FIELD(User, age));
+ * };
+ * @endcode
+ */
+template <class T>
+struct TableFields;
+
+/**
+ * @brief A member of a record type in a `TypedTable` predicate.
+ *
+ * Comparing it to a value, as in `member(&User::age) >= 28`, gives a
+ * predicate reading the member directly.
+ */
+template <class T, class M>
+struct Member {
+    M T::*pointer;
+};
+
+/**
+ * @brief Refer to a member of a record type in a predicate.
+ * @param pointer The member.
+ * @return The member, to compare with a value.
+ */
+template <class T, class M>
+constexpr Member<T, M> member(M T::*pointer) {
+    return {pointer};
+}
+
+/**
+ * @brief Predicate over records, combined with `&&`, `||` and `!`.
+ * @tparam F The callable evaluating a record.
+ */
+template <class F>
+struct RecordPredicate {
+    F test;
+
+    template <class T>
+    bool operator()(const T &record) const {
+        return test(record);
+    }
+};
+
+/**
+ * @brief Wrap a callable taking a record into a combinable predicate.
+ * @param test The callable.
+ * @return The predicate.
+ */
+template <class F>
+RecordPredicate<F> make_record_predicate(F test) {
+    return {std::move(test)};
+}
 
+#define JSONDB_MEMBER_COMPARISON(op)                                                     \
+    template <class T, class M, class V>                                                 \
+    auto operator op(Member<T, M> member, V value) {                                     \
+        return make_record_predicate([pointer = member.pointer, value](const T &record) { \
+            return record.*pointer op value;                                             \
+        });                                                                              \
+    }
+JSONDB_MEMBER_COMPARISON(==)
+JSONDB_MEMBER_COMPARISON(!=)
+JSONDB_MEMBER_COMPARISON(<)
+JSONDB_MEMBER_COMPARISON(<=)
+JSONDB_MEMBER_COMPARISON(>)
+JSONDB_MEMBER_COMPARISON(>=)
+#undef JSONDB_MEMBER_COMPARISON
+
+template <class A, class B>
+auto operator&&(RecordPredicate<A> a, RecordPredicate<B> b) {
+    return make_record_predicate(
+        [a = std::move(a), b = std::move(b)](const auto &record) { return a(record) && b(record); });
+}
+
+template <class A, class B>
+auto operator||(RecordPredicate<A> a, RecordPredicate<B> b) {
+    return make_record_predicate(
+        [a = std::move(a), b = std::move(b)](const auto &record) { return a(record) || b(record); });
+}
+
+template <class A>
+auto operator!(RecordPredicate<A> a) {
+    return make_record_predicate([a = std::move(a)](const auto &record) { return !a(record); });
+}
+
+/**
+ * @brief A table of records of type T, mapped to documents by `TableFields<T>`.
+ *
+ * Records are written through a `Table`, so they are stored, journaled
+ * and published like any document. For reads, the records of the current
+ * table version are decoded once, straight from the resident documents,
+ * into a contiguous vector of T. Queries then run compiled predicates over
+ * it and return T without building any JSON value. Writes made through the
+ * TypedTable update that vector in place; it is decoded again only when the
+ * table is changed some other way. Fields missing from a document, or of
+ * another type, keep the default value of the member.
+ *
+ * @tparam T A default-constructible, copyable record type.
+ */
+template <class T>
+class TypedTable {
    public:
     /**
-     * @brief Constructor for Table class.
+     * @brief Constructor for TypedTable class.
      * @param tableName The name of the table.
      * @param db A reference to the associated JsonDB instance.
      */
-    Table(const std::string &tableName, const JsonDB &db);
+    TypedTable(const std::string &tableName, const JsonDB &db) : table(tableName, db) {}
 
     /**
-     * @brief Destructor for Table class.
+     * @brief Get the underlying table.
+     * @return The table holding the records.
      */
-    ~Table();
+    Table &GetTable() { return table; }
 
     /**
-     * @brief Get the name of the table.
-     * @return The name of the table.
+     * @brief Insert a record.
+     * @param record The record.
+     * @return True if the record is inserted, false otherwise.
      */
-    std::string GetName() const;
+    bool Insert(const T &record) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const std::uint64_t before = table.SyncVersion();
+        if (!table.InsertDocument(Encode(record))) {
+            return false;
+        }
+        if (records && version == before && table.GetVersion() == before + 1) {
+            Writable().push_back(record);
+            version = before + 1;
+        }
+        return true;
+    }
 
     /**
-     * @brief Create a new table.
-     * @return True if the table is created successfully, false otherwise.
+     * @brief Change the records matching a predicate.
+     * @param predicate Callable taking a `const T &`, such as `member(&T::age) >= 28`.
+     * @param change Callable taking a `T &` to modify; every field of the
+     *               modified record is written back.
+     * @return True if the matching records are updated, false otherwise.
      */
-    bool Create();
+    template <class Predicate, class Change>
+    bool Update(const Predicate &predicate, const Change &change) {
+        return Write(predicate, &change);
+    }
 
     /**
-     * @brief Check if the table exists.
-     * @return True if the table exists, false otherwise.
+     * @brief Delete the records matching a predicate.
+     * @param predicate Callable taking a `const T &`.
+     * @return True if the matching records are deleted, false otherwise.
      */
-    bool Exists();
+    template <class Predicate>
+    bool Delete(const Predicate &predicate) {
+        return Write(predicate, static_cast<const std::nullptr_t *>(nullptr));
+    }
 
     /**
-     * @brief Drop (delete) the table.
-     * @return True if the table is successfully dropped, false otherwise.
+     * @brief Get every record of the table.
+     * @return The records, in table order.
      */
-    bool Drop();
+    std::vector<T> FindAll() { return *Records(); }
 
     /**
-     * @brief Insert a JSON document into the table.
-     * @param document The JSON document to insert.
-     * @return True if the document is inserted successfully, false otherwise.
+     * @brief Find the records matching a predicate.
+     * @param predicate Callable taking a `const T &`, such as `member(&T::age) >= 28`.
+     * @return The matching records, in table order.
      */
-    bool InsertDocument(const nlohmann::json &document);
+    template <class Predicate>
+    std::vector<T> Find(const Predicate &predicate) {
+        std::vector<T> result;
+        for (const T &record : *Records()) {
+            if (predicate(record)) {
+                result.push_back(record);
+            }
+        }
+        return result;
+    }
 
     /**
-     * @brief Find the first JSON document in the table.
-     * @return The found JSON document or an empty JSON object if not found.
+     * @brief Find the first record matching a predicate.
+     * @param predicate Callable taking a `const T &`.
+     * @return The first matching record, if any.
      */
-    nlohmann::json FindDocument();
+    template <class Predicate>
+    std::optional<T> FindOne(const Predicate &predicate) {
+        auto records = Records();
+        for (const T &record : *records) {
+            if (predicate(record)) {
+                return record;
+            }
+        }
+        return std::nullopt;
+    }
+
+   private:
+    Table table;
+    std::mutex mutex;
+    // version of the table the records were decoded at, kept up to date by
+    // the writes made through this TypedTable
+    std::uint64_t version = 0;
+    std::shared_ptr<std::vector<T>> records;
+
+    static nlohmann::json Encode(const T &record) {
+        nlohmann::json document = nlohmann::json::object();
+        std::apply([&](const auto &...fields) { ((document[fields.name] = record.*(fields.member)), ...); },
+                   TableFields<T>::value);
+        return document;
+    }
+
+    // The cached records, copied first if a reader still holds them.
+    std::vector<T> &Writable() {
+        if (records.use_count() > 1) {
+            records = std::make_shared<std::vector<T>>(*records);
+        }
+        return *records;
+    }
+
+    // Writes the matching records back, changed by `change`, or deletes them
+    // when it is null. The rows are those of the decoded records, so the
+    // write is retried on fresh records if the table changed meanwhile.
+    template <class Predicate, class Change>
+    bool Write(const Predicate &predicate, const Change *change) {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (true) {
+            std::shared_ptr<const std::vector<T>> current = Decode();
+            if (!current) {
+                return false;
+            }
+            std::vector<std::size_t> rows;
+            std::vector<T> changed;
+            std::vector<nlohmann::json> values;
+            for (std::size_t i = 0; i < current->size(); i++) {
+                if (!predicate((*current)[i])) {
+                    continue;
+                }
+                rows.push_back(i);
+                if constexpr (!std::is_same_v<Change, std::nullptr_t>) {
+                    T &record = changed.emplace_back((*current)[i]);
+                    (*change)(record);
+                    values.push_back(Encode(record));
+                }
+            }
+            if (rows.empty()) {
+                return true;
+            }
+            const std::uint64_t before = version;
+            if (!table.WriteRows(before, rows, values)) {
+                if (table.GetVersion() == before) {
+                    return false;
+                }
+                continue;
+            }
+            current.reset();
+            if (table.GetVersion() == before + 1) {
+                std::vector<T> &writable = Writable();
+                if constexpr (std::is_same_v<Change, std::nullptr_t>) {
+                    for (std::size_t i = rows.size(); i-- > 0;) {
+                        writable.erase(writable.begin() + rows[i]);
+                    }
+                } else {
+                    for (std::size_t i = 0; i < rows.size(); i++) {
+                        writable[rows[i]] = std::move(changed[i]);
+                    }
+                }
+                version = before + 1;
+            }
+            return true;
+        }
+    }
+
+    template <class M>
+    static void Assign(M &member, const FieldValue &value) {
+        if constexpr (std::is_same_v<M, bool>) {
+            if (value.kind == FieldValue::Boolean) {
+                member = value.boolean;
+            }
+        } else if constexpr (std::is_arithmetic_v<M>) {
+            if (value.kind == FieldValue::Integer) {
+                member = static_cast<M>(value.integer);
+            } else if (value.kind == FieldValue::Unsigned) {
+                member = static_cast<M>(value.unsignedValue);
+            } else if (value.kind == FieldValue::Float) {
+                member = static_cast<M>(value.number);
+            }
+        } else {
+            static_assert(std::is_same_v<M, std::string>, "TypedTable fields are bool, arithmetic or std::string");
+            if (value.kind == FieldValue::String) {
+                member.assign(value.string.data(), value.string.size());
+            }
+        }
+    }
+
+    // Records of the current table version, decoded on first use.
+    std::shared_ptr<const std::vector<T>> Records() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<const std::vector<T>> current = Decode();
+        return current ? current : std::make_shared<const std::vector<T>>();
+    }
+
+    // Same as Records, with the mutex held; null if the table could not be read.
+    std::shared_ptr<const std::vector<T>> Decode() {
+        const std::uint64_t current = table.SyncVersion();
+        if (records && version == current) {
+            return records;
+        }
+        std::vector<std::string> names;
+        std::apply([&](const auto &...fields) { (names.push_back(fields.name), ...); }, TableFields<T>::value);
+        auto decoded = std::make_shared<std::vector<T>>();
+        bool ok = table.ReadFields(names, [&](const FieldValue *values) {
+            T &record = decoded->emplace_back();
+            std::size_t i = 0;
+            std::apply([&](const auto &...fields) { (Assign(record.*(fields.member), values[i++]), ...); },
+                       TableFields<T>::value);
+        });
+        if (!ok) {
+            return nullptr;
+        }
+        version = current;
+        records = std::move(decoded);
+        return records;
+    }
+};
+
+/**
+ * @brief Comparison of a query expression, named after its JSON operator.
+ */
+enum class QueryOp { Eq, Gt, Gte, Lt, Lte, In, Nin };
+
+/**
+ * @brief Type a value of a query expression is kept as: strings as
+ * std::string, anything else as is.
+ */
+template <class V>
+using query_value_t =
+    std::conditional_t<std::is_convertible_v<V, std::string> && !std::is_same_v<std::decay_t<V>, std::nullptr_t>,
+                       std::string, std::decay_t<V>>;
+
+/**
+ * @brief Read a top-level field of a JSON document as a `FieldValue`.
+ * @param document The document.
+ * @param name The name of the field.
+ * @return The value, `Missing` when the document has no such field.
+ */
+inline FieldValue json_field(const nlohmann::json &document, const std::string &name) {
+    FieldValue value;
+    auto it = document.is_object() ? document.find(name) : document.end();
+    if (it == document.end()) {
+        return value;
+    }
+    switch (it->type()) {
+        case nlohmann::json::value_t::null:
+            value.kind = FieldValue::Null;
+            break;
+        case nlohmann::json::value_t::boolean:
+            value.kind = FieldValue::Boolean;
+            value.boolean = it->get<bool>();
+            break;
+        case nlohmann::json::value_t::number_integer:
+            value.kind = FieldValue::Integer;
+            value.integer = it->get<std::int64_t>();
+            break;
+        case nlohmann::json::value_t::number_unsigned:
+            value.kind = FieldValue::Unsigned;
+            value.unsignedValue = it->get<std::uint64_t>();
+            break;
+        case nlohmann::json::value_t::number_float:
+            value.kind = FieldValue::Float;
+            value.number = it->get<double>();
+            break;
+        case nlohmann::json::value_t::string:
+            value.kind = FieldValue::String;
+            value.string = it->get_ref<const std::string &>();
+            break;
+        default:
+            value.kind = FieldValue::Other;
+    }
+    return value;
+}
+
+/**
+ * @brief Leaf of a query expression: one field compared with a value or a list.
+ *
+ * Values are compared like `generic_comparator` does: numbers as float,
+ * and a field of another type than the value never matches.
+ */
+template <QueryOp Op, class V>
+struct FieldComparison {
+    static constexpr std::size_t fields = 1;
+    using Operand = std::conditional_t<Op == QueryOp::In || Op == QueryOp::Nin, std::vector<V>, V>;
+
+    std::string name;
+    Operand value;
+
+    void Names(std::vector<std::string> &names) const { names.push_back(name); }
+
+    void Json(nlohmann::json &query, bool exact) const {
+        static const char *const operators[] = {"$eq", "$gt", "$gte", "$lt", "$lte", "$in", "$ne"};
+        nlohmann::json &statements = query[name];
+        const char *op = operators[static_cast<int>(Op)];
+        nlohmann::json operand = value;
+        auto existing = statements.find(op);
+        if (existing == statements.end()) {
+            statements[op] = std::move(operand);
+            return;
+        }
+        // two bounds of the same kind merge into the tighter one
+        bool comparable = operand.type() == existing->type() || (operand.is_number() && existing->is_number());
+        if constexpr (Op == QueryOp::Gt || Op == QueryOp::Gte) {
+            if (comparable) {
+                *existing = std::max(*existing, operand);
+                return;
+            }
+        } else if constexpr (Op == QueryOp::Lt || Op == QueryOp::Lte) {
+            if (comparable) {
+                *existing = std::min(*existing, operand);
+                return;
+            }
+        }
+        if (exact) {
+            throw std::invalid_argument("Query compares " + name + " twice with " + op);
+        }
+    }
+
+    bool Evaluate(const FieldValue *values) const {
+        if constexpr (Op == QueryOp::In || Op == QueryOp::Nin) {
+            if (!Comparable(values[0])) {
+                return false;
+            }
+            bool found = false;
+            for (const auto &item : value) {
+                found = found || Compare<QueryOp::Eq>(values[0], item);
+            }
+            return Op == QueryOp::In ? found : !found;
+        } else {
+            return Compare<Op>(values[0], value);
+        }
+    }
+
+   private:
+    static bool Comparable(const FieldValue &field) {
+        if constexpr (std::is_same_v<V, bool>) {
+            return field.kind == FieldValue::Boolean;
+        } else if constexpr (std::is_arithmetic_v<V>) {
+            return field.kind == FieldValue::Integer || field.kind == FieldValue::Unsigned ||
+                   field.kind == FieldValue::Float;
+        } else if constexpr (std::is_same_v<V, std::nullptr_t>) {
+            return field.kind == FieldValue::Null;
+        } else {
+            return field.kind == FieldValue::String;
+        }
+    }
+
+    template <QueryOp Compared, class T>
+    static bool Apply(const T &a, const T &b) {
+        if constexpr (Compared == QueryOp::Eq) {
+            return a == b;
+        } else if constexpr (Compared == QueryOp::Gt) {
+            return a > b;
+        } else if constexpr (Compared == QueryOp::Gte) {
+            return a >= b;
+        } else if constexpr (Compared == QueryOp::Lt) {
+            return a < b;
+        } else {
+            return a <= b;
+        }
+    }
+
+    template <QueryOp Compared>
+    static bool Compare(const FieldValue &field, const V &operand) {
+        if (!Comparable(field)) {
+            return false;
+        }
+        if constexpr (std::is_same_v<V, bool>) {
+            return Apply<Compared>(field.boolean, operand);
+        } else if constexpr (std::is_arithmetic_v<V>) {
+            float number = field.kind == FieldValue::Integer    ? static_cast<float>(field.integer)
+                           : field.kind == FieldValue::Unsigned ? static_cast<float>(field.unsignedValue)
+                                                                : static_cast<float>(field.number);
+            return Apply<Compared>(number, static_cast<float>(operand));
+        } else if constexpr (std::is_same_v<V, std::nullptr_t>) {
+            return Apply<Compared>(0, 0);
+        } else {
+            return Apply<Compared>(field.string, std::string_view(operand));
+        }
+    }
+};
+
+/**
+ * @brief Conjunction of two query expressions.
+ */
+template <class A, class B>
+struct FieldAnd {
+    static constexpr std::size_t fields = A::fields + B::fields;
+
+    A a;
+    B b;
+
+    void Names(std::vector<std::string> &names) const {
+        a.Names(names);
+        b.Names(names);
+    }
+
+    void Json(nlohmann::json &query, bool exact) const {
+        a.Json(query, exact);
+        b.Json(query, exact);
+    }
+
+    bool Evaluate(const FieldValue *values) const { return a.Evaluate(values) && b.Evaluate(values + A::fields); }
+};
+
+/**
+ * @brief A query built from C++ expressions rather than a JSON literal.
+ *
+ * Every comparison and its operator are resolved at compile time, so
+ * evaluating the query is a chain of inlined comparisons on the fields it
+ * reads. It converts to the equivalent JSON query with `ToJson`.
+ *
+ * @tparam E The expression tree, made of `FieldComparison` and `FieldAnd`.
+ */
+template <class E>
+class Query {
+   public:
+    explicit Query(E expression) : expression(std::move(expression)) {}
 
     /**
-     * @brief Find the first JSON document in the table that match the filter.
-     * @return The found JSON document or an empty JSON object if not found.
+     * @brief Get the JSON form of the query.
+     *
+     * Repeated bounds on a field merge into the tighter one, as in
+     * `field("a") > 1 && field("a") > 2`.
+     *
+     * @return The query as accepted by `Table::FindDocuments`.
+     * @throws std::invalid_argument If a field is compared twice with an
+     * operator whose comparisons do not merge, such as two `==`.
      */
-    nlohmann::json FindDocument(const nlohmann::json &query);
+    nlohmann::json ToJson() const {
+        nlohmann::json query = nlohmann::json::object();
+        expression.Json(query, true);
+        return query;
+    }
 
     /**
-     * @brief Find multiple JSON documents in the table.
-     * @return A JSON array containing the found documents.
+     * @brief Get a JSON query matching every document this one matches.
+     *
+     * Same as `ToJson`, except that a comparison which does not merge is
+     * left out instead of throwing. Used to plan and log scans whose
+     * documents are then checked with `Evaluate`.
+     *
+     * @return The query as accepted by `Table::FindDocuments`.
      */
-    nlohmann::json FindDocuments();
+    nlohmann::json PlanJson() const {
+        nlohmann::json query = nlohmann::json::object();
+        expression.Json(query, false);
+        return query;
+    }
 
-   /**
-     * @brief Find multiple JSON documents in the table.
-     * @return A JSON array containing the found documents.
+    /**
+     * @brief Get the fields the query reads, one per comparison.
+     * @return The names of the fields, in the order `Evaluate` expects them.
      */
-    nlohmann::json FindDocuments(const nlohmann::json &query);
+    std::vector<std::string> Fields() const {
+        std::vector<std::string> names;
+        expression.Names(names);
+        return names;
+    }
 
     /**
-     * @brief Update a JSON document in the table.
-     * @return True if the document is updated successfully, false otherwise.
+     * @brief Evaluate the query on field values.
+     * @param values One value per entry of `Fields()`.
+     * @return True if the values match.
      */
-    bool UpdateDocument(const nlohmann::json &valuesToUpdate, const nlohmann::json &query);
+    bool Evaluate(const FieldValue *values) const { return expression.Evaluate(values); }
 
     /**
-     * @brief Update a JSON document in the table.
-     * @return True if the document is updated successfully, false otherwise.
+     * @brief Evaluate the query on a JSON document.
+     * @param document The document.
+     * @return True if the document matches.
      */
-    bool UpdateDocuments(const nlohmann::json &valuesToUpdate, const nlohmann::json &query);
+    bool operator()(const nlohmann::json &document) const {
+        std::vector<std::string> names = Fields();
+        std::vector<FieldValue> values;
+        for (const auto &name : names) {
+            values.push_back(json_field(document, name));
+        }
+        return Evaluate(values.data());
+    }
+
+    template <class A, class B>
+    friend Query<FieldAnd<A, B>> operator&&(const Query<A> &a, const Query<B> &b);
+
+   private:
+    E expression;
+};
+
+/**
+ * @brief Match documents matching both queries.
+ */
+template <class A, class B>
+Query<FieldAnd<A, B>> operator&&(const Query<A> &a, const Query<B> &b) {
+    return Query<FieldAnd<A, B>>(FieldAnd<A, B>{a.expression, b.expression});
+}
+
+/**
+ * @brief A field named in a query expression.
+ */
+class QueryField {
+   public:
+    explicit QueryField(std::string name) : name(std::move(name)) {}
 
     /**
-     * @brief Delete a JSON document from the table.
-     * @return True if the document is deleted successfully, false otherwise.
+     * @brief Match documents whose field is one of the values.
      */
-    bool DeleteDocument(const nlohmann::json &query);
+    template <class V>
+    Query<FieldComparison<QueryOp::In, query_value_t<V>>> in(std::initializer_list<V> values) const {
+        static_assert(std::is_arithmetic_v<V> || std::is_same_v<query_value_t<V>, std::string>,
+                      "lists hold numbers or strings");
+        return Query<FieldComparison<QueryOp::In, query_value_t<V>>>(
+            {name, std::vector<query_value_t<V>>(values.begin(), values.end())});
+    }
 
     /**
-     * @brief Delete a JSON document from the table.
-     * @return True if the document is deleted successfully, false otherwise.
+     * @brief Match documents whose field is none of the values.
      */
-    bool DeleteDocuments(const nlohmann::json &query);
+    template <class V>
+    Query<FieldComparison<QueryOp::Nin, query_value_t<V>>> not_in(std::initializer_list<V> values) const {
+        static_assert(std::is_arithmetic_v<V> || std::is_same_v<query_value_t<V>, std::string>,
+                      "lists hold numbers or strings");
+        return Query<FieldComparison<QueryOp::Nin, query_value_t<V>>>(
+            {name, std::vector<query_value_t<V>>(values.begin(), values.end())});
+    }
 
+    std::string name;
 };
 
+/**
+ * @brief Name a field in a query expression, as in `field("age") >= 28`.
+ * @param name The name of a top-level field.
+ * @return The field, to compare with a value.
+ */
+inline QueryField field(std::string name) {
+    return QueryField(std::move(name));
+}
+
+#define JSONDB_FIELD_COMPARISON(op, queryOp)                                                 \
+    template <class V>                                                                        \
+    Query<FieldComparison<queryOp, query_value_t<V>>> operator op(const QueryField &f, V value) { \
+        return Query<FieldComparison<queryOp, query_value_t<V>>>({f.name, query_value_t<V>(value)}); \
+    }
+JSONDB_FIELD_COMPARISON(==, QueryOp::Eq)
+JSONDB_FIELD_COMPARISON(>, QueryOp::Gt)
+JSONDB_FIELD_COMPARISON(>=, QueryOp::Gte)
+JSONDB_FIELD_COMPARISON(<, QueryOp::Lt)
+JSONDB_FIELD_COMPARISON(<=, QueryOp::Lte)
+#undef JSONDB_FIELD_COMPARISON
+
+template <class E>
+nlohmann::json Table::FindDocuments(const Query<E> &query) {
+    try {
+        return FindDocuments(query.PlanJson(), query.Fields(),
+                             [&query](const FieldValue *values) { return query.Evaluate(values); });
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return nlohmann::json::array();
+    }
+}
+
 /**
  * @brief A utility class for performing various comparison operations on generic types.
  * 
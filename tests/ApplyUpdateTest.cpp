@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include "jsondb.h"
+
+using namespace jsondb;
+
+TEST(ApplyUpdateTest, PlainFieldsAreAssigned) {
+    nlohmann::json document = {{"name", "Alice"}, {"age", 25}};
+    apply_update(document, {{"age", 26}, {"city", "bogota"}});
+    EXPECT_EQ(document["age"], 26);
+    EXPECT_EQ(document["city"], "bogota");
+}
+
+TEST(ApplyUpdateTest, SetAndUnset) {
+    nlohmann::json document = {{"name", "Alice"}, {"age", 25}};
+    apply_update(document, R"({"$set": {"city": "caracas"}, "$unset": {"age": ""}})"_json);
+    EXPECT_EQ(document["city"], "caracas");
+    EXPECT_EQ(document.find("age"), document.end());
+}
+
+TEST(ApplyUpdateTest, Inc) {
+    nlohmann::json document = {{"visits", 1}, {"score", 1.5}};
+    apply_update(document, R"({"$inc": {"visits": 2, "score": 1, "missing": 3}})"_json);
+    EXPECT_EQ(document["visits"], 3);
+    EXPECT_TRUE(document["visits"].is_number_integer());
+    EXPECT_DOUBLE_EQ(document["score"].get<double>(), 2.5);
+    EXPECT_EQ(document["missing"], 3);
+}
+
+TEST(ApplyUpdateTest, Push) {
+    nlohmann::json document = {{"tags", {"a"}}};
+    apply_update(document, R"({"$push": {"tags": "b", "other": 1}})"_json);
+    EXPECT_EQ(document["tags"], nlohmann::json({"a", "b"}));
+    EXPECT_EQ(document["other"], nlohmann::json({1}));
+}
+
+TEST(ApplyUpdateTest, InvalidUpdates) {
+    nlohmann::json document = {{"name", "Alice"}, {"tags", "a"}};
+    EXPECT_THROW(apply_update(document, R"({"$inc": {"name": 1}})"_json), std::invalid_argument);
+    EXPECT_THROW(apply_update(document, R"({"$inc": {"age": "1"}})"_json), std::invalid_argument);
+    EXPECT_THROW(apply_update(document, R"({"$push": {"tags": "b"}})"_json), std::invalid_argument);
+    EXPECT_THROW(apply_update(document, R"({"$rename": {"name": "n"}})"_json), std::invalid_argument);
+    EXPECT_THROW(apply_update(document, R"({"$set": {"a": 1}, "b": 2})"_json), std::invalid_argument);
+}
+
+TEST(ApplyUpdateTest, NormalizeUpdate) {
+    EXPECT_EQ(normalize_update({{"a", 1}}), R"({"$set": {"a": 1}})"_json);
+    EXPECT_EQ(normalize_update(R"({"$inc": {"a": 1}})"_json), R"({"$inc": {"a": 1}})"_json);
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include "jsondb.h"
+
+using namespace jsondb;
+
+class IoBackendTest : public ::testing::TestWithParam<std::string>
+{
+protected:
+    std::shared_ptr<IoBackend> io;
+    std::string dir = "io_backend_test";
+
+    void SetUp() override
+    {
+        io = GetParam() == "posix" ? make_posix_io_backend() : make_io_uring_backend(4);
+        if (!io) {
+            GTEST_SKIP() << "io_uring is not available";
+        }
+        std::filesystem::create_directory(dir);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove_all(dir);
+    }
+};
+
+TEST_P(IoBackendTest, WriteAndRead)
+{
+    EXPECT_EQ(io->GetName(), GetParam());
+    io->WriteFile(dir + "/a", "first", false);
+    io->WriteFile(dir + "/a", "second", true);
+    io->AppendFile(dir + "/b", "1\n", false);
+    io->AppendFile(dir + "/b", "2\n", true);
+    std::vector<std::string> contents = io->ReadFiles({dir + "/a", dir + "/missing", dir + "/b"});
+    ASSERT_EQ(contents.size(), 3);
+    EXPECT_EQ(contents[0], "second");
+    EXPECT_EQ(contents[1], "");
+    EXPECT_EQ(contents[2], "1\n2\n");
+    EXPECT_NO_THROW(io->SyncFiles({dir + "/a", dir + "/missing"}));
+}
+
+TEST_P(IoBackendTest, ManyFiles)
+{
+    // more files than the queue depth of the io_uring backend
+    std::vector<std::string> paths;
+    for (int i = 0; i < 10; i++) {
+        paths.push_back(dir + "/" + std::to_string(i));
+        io->WriteFile(paths.back(), std::string(1000 * i, 'x'), false);
+    }
+    std::vector<std::string> contents = io->ReadFiles(paths);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(contents[i].size(), 1000 * i);
+    }
+}
+
+TEST_P(IoBackendTest, Table)
+{
+    JsonDB db("io_backend_db", dir);
+    db.SetIoBackend(io);
+    db.Create();
+    Table table("items", db);
+    table.Create({"_id", IdGenerator::Monotonic});
+    table.InsertDocument({{"name", "a"}});
+    table.InsertDocument({{"name", "b"}});
+    table.Compact();
+    table.DeleteDocument({{"name", {{"$eq", "a"}}}});
+    EXPECT_EQ(db.GetIoBackend(), io);
+    JsonDB reopened("io_backend_db", dir);
+    Table again("items", reopened);
+    EXPECT_EQ(again.FindDocuments().size(), 1);
+    EXPECT_EQ(again.GetById(2)["name"], "b");
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, IoBackendTest, ::testing::Values("posix", "io_uring"));
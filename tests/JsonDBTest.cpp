@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
 #include "jsondb.h"
+#include <filesystem>
 #include <fstream>
+#include <thread>
 
 using namespace jsondb;
 
@@ -69,6 +73,35 @@ TEST_F(JsonDBTest, ReturnsTables)
     EXPECT_EQ(tables[1]["name"], "cars");
 }
 
+TEST_F(JsonDBTest, ReturnsTextIndexedTables)
+{
+    db.Create();
+    Table notes("notes", db);
+    notes.Create({"", IdGenerator::None, {"body"}});
+
+    auto tables = db.Tables();
+
+    ASSERT_EQ(tables.size(), 1);
+    EXPECT_EQ(tables[0]["name"], "notes");
+    EXPECT_EQ(tables[0].count("indexes"), 0);
+}
+
+TEST_F(JsonDBTest, ReturnsKeyedTables)
+{
+    db.Create();
+    Table users("users", db);
+    ASSERT_TRUE(users.Create({"id", IdGenerator::Monotonic, {"name"}}));
+    ASSERT_TRUE(users.InsertDocument({{"name", "ann"}}));
+
+    std::vector<std::unordered_map<std::string, std::string>> tables;
+    ASSERT_NO_THROW(tables = db.Tables());
+
+    ASSERT_EQ(tables.size(), 1);
+    EXPECT_EQ(tables[0]["name"], "users");
+    EXPECT_EQ(tables[0]["primaryKey"], "id");
+    EXPECT_EQ(tables[0]["idGenerator"], "monotonic");
+}
+
 TEST_F(JsonDBTest, ErrorReturnsTables)
 {
     db.Create();
@@ -93,3 +126,165 @@ TEST_F(JsonDBTest, HandlesInvalidDatabaseFormat)
     dbFile.close();
     ASSERT_THROW(db.Tables(), std::runtime_error);
 }
+
+TEST_F(JsonDBTest, TestStats)
+{
+    db.Create();
+    Table table("stats_table", db);
+    table.Create();
+    table.SetQueryCacheCapacity(1 << 20);
+    table.InsertDocument({{"key", "value1"}});
+    table.InsertDocument({{"key", "value2"}});
+    nlohmann::json query = {{"key", {{"$eq", "value1"}}}};
+    table.FindDocuments(query);
+    table.FindDocuments(query);
+    db.Tables();
+
+    nlohmann::json stats = db.Stats();
+    if (!stats["enabled"]) {
+        GTEST_SKIP() << "metrics are compiled out";
+    }
+    EXPECT_EQ(stats["operations"]["Table::InsertDocument"]["calls"], 2);
+    EXPECT_EQ(stats["operations"]["Table::FindDocuments"]["calls"], 2);
+    EXPECT_EQ(stats["operations"]["JsonDB::Tables"]["calls"], 1);
+    const auto &latency = stats["operations"]["Table::FindDocuments"]["latencyUs"];
+    EXPECT_LE(latency["p50"].get<double>(), latency["max"].get<double>());
+    EXPECT_GT(stats["io"]["bytesWritten"].get<std::uint64_t>(), 0);
+    EXPECT_EQ(stats["documents"]["scanned"], 2);
+    EXPECT_EQ(stats["documents"]["returned"], 1);
+    EXPECT_EQ(stats["cache"]["hits"], 1);
+    EXPECT_EQ(stats["cache"]["misses"], 1);
+    EXPECT_DOUBLE_EQ(stats["cache"]["hitRate"].get<double>(), 0.5);
+}
+
+TEST_F(JsonDBTest, TestSnapshot)
+{
+    const std::string backupPath = "test_backup";
+    std::filesystem::remove_all(backupPath);
+    db.Create();
+    Table users("users", db);
+    Table events("events", db);
+    users.Create({"_id", IdGenerator::Monotonic});
+    events.Create();
+    for (int i = 0; i < 10; i++) {
+        users.InsertDocument({{"n", i}});
+        events.InsertDocument({{"n", i}});
+    }
+    users.Compact();
+    users.UpdateDocuments({{"seen", true}}, R"({"n": {"$lt": 3}})"_json);
+    nlohmann::json expectedUsers = users.FindDocuments();
+    nlohmann::json expectedEvents = events.FindDocuments();
+
+    ASSERT_TRUE(db.Snapshot(backupPath));
+    // the compacted table file is shared with the database, not copied
+    EXPECT_EQ(std::filesystem::hard_link_count(backupPath + "/test_db/users.json"), 2);
+    EXPECT_FALSE(db.Snapshot(backupPath));
+    users.InsertDocument({{"n", 10}});
+    events.DeleteDocuments(nullptr);
+    users.Compact();
+
+    JsonDB backup("test_db", backupPath);
+    Table backupUsers("users", backup);
+    Table backupEvents("events", backup);
+    EXPECT_EQ(backupUsers.FindDocuments(), expectedUsers);
+    EXPECT_EQ(backupEvents.FindDocuments(), expectedEvents);
+    EXPECT_EQ(backupUsers.GetOptions().primaryKey, "_id");
+    EXPECT_EQ(users.FindDocuments().size(), 11);
+    EXPECT_TRUE(events.FindDocuments().empty());
+    std::filesystem::remove_all(backupPath);
+}
+
+TEST_F(JsonDBTest, TestSnapshotConsistentCatalog)
+{
+    const std::string backupPath = "test_backup";
+    std::filesystem::remove_all(backupPath);
+    db.Create();
+    Table users("users", db);
+    users.Create();
+    users.InsertDocument({{"n", 1}});
+
+    // tables created and dropped during the snapshots are in both the
+    // catalog and the files of a snapshot, or in neither
+    std::atomic<bool> done{false};
+    std::thread churn([&] {
+        Table scratch("scratch", db);
+        while (!done) {
+            scratch.Create();
+            scratch.Drop();
+        }
+    });
+    for (int i = 0; i < 20; i++) {
+        const std::string path = backupPath + "/" + std::to_string(i);
+        ASSERT_TRUE(db.Snapshot(path));
+        JsonDB backup("test_db", path);
+        for (const auto &table : backup.Tables()) {
+            EXPECT_TRUE(std::filesystem::exists(path + "/test_db/" + table.at("name") + ".json"));
+        }
+    }
+    done = true;
+    churn.join();
+    std::filesystem::remove_all(backupPath);
+
+    // a table file missing from the database fails the snapshot
+    std::filesystem::remove(db.GetTablesPath() + "/users.json");
+    EXPECT_FALSE(db.Snapshot(backupPath));
+    EXPECT_FALSE(std::filesystem::exists(backupPath + "/test_db.json"));
+    EXPECT_FALSE(std::filesystem::exists(backupPath + "/test_db"));
+    std::filesystem::remove_all(backupPath);
+}
+
+TEST_F(JsonDBTest, TestJoin)
+{
+    db.Create();
+    Table users("users", db);
+    Table orders("orders", db);
+    users.Create({"_id", IdGenerator::Monotonic});
+    orders.Create();
+    for (int i = 0; i < 5; i++) {
+        users.InsertDocument({{"name", "user" + std::to_string(i)}, {"team", i % 2}});
+    }
+    for (int i = 0; i < 20; i++) {
+        orders.InsertDocument({{"order", i}, {"userId", i % 7}});
+    }
+
+    // primary key of the right table
+    nlohmann::json joined = db.Join("orders", "users", {"userId", "_id", "user"});
+    ASSERT_EQ(joined.size(), 20);
+    EXPECT_EQ(joined[3]["user"], nlohmann::json::array({users.GetById(3)}));
+    EXPECT_TRUE(joined[0]["user"].empty());
+    EXPECT_TRUE(joined[6]["user"].empty());
+
+    // hash join, the smaller left side is built, in one or several passes
+    for (std::size_t maxBuildBytes : {std::size_t(64) << 20, std::size_t(1)}) {
+        joined = db.Join("users", "orders", {"_id", "userId", "", maxBuildBytes});
+        ASSERT_EQ(joined.size(), 5);
+        nlohmann::json expected = nlohmann::json::array();
+        for (const auto &order : orders.FindDocuments()) {
+            if (order["userId"] == 2) {
+                expected.push_back(order);
+            }
+        }
+        // several passes pass the users on partition by partition
+        auto user = std::find_if(joined.begin(), joined.end(), [](const nlohmann::json &document) {
+            return document["_id"] == 2;
+        });
+        ASSERT_NE(user, joined.end());
+        EXPECT_EQ((*user)["orders"], expected);
+        EXPECT_EQ((*user)["name"], "user1");
+        if (maxBuildBytes > 1) {
+            EXPECT_EQ(joined[1], *user);
+        }
+    }
+
+    // the larger left side is streamed against the smaller right one
+    for (std::size_t maxBuildBytes : {std::size_t(64) << 20, std::size_t(1)}) {
+        std::size_t count = 0;
+        EXPECT_TRUE(db.Join("orders", "users", {"userId", "team", "", maxBuildBytes}, [&count](nlohmann::json &&order) {
+            std::size_t expected = order["userId"] == 0 || order["userId"] == 1 ? (order["userId"] == 0 ? 3 : 2) : 0;
+            EXPECT_EQ(order["users"].size(), expected) << order.dump();
+            count++;
+        }));
+        EXPECT_EQ(count, 20);
+    }
+    EXPECT_FALSE(db.Join("orders", "missing", {"userId", "_id"}, [](nlohmann::json &&) {}));
+}
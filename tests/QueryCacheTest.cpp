@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include "jsondb.h"
+
+using namespace jsondb;
+
+TEST(QueryCacheTest, DisabledByDefault) {
+    QueryCache cache;
+    nlohmann::json result;
+    cache.Put("key", 0, {{"a", 1}});
+    EXPECT_FALSE(cache.Get("key", 0, result));
+    EXPECT_EQ(cache.Stats().entries, 0);
+    EXPECT_EQ(cache.Stats().misses, 0);
+}
+
+TEST(QueryCacheTest, HitAndMiss) {
+    QueryCache cache(1 << 20);
+    nlohmann::json result;
+    EXPECT_FALSE(cache.Get("key", 0, result));
+    cache.Put("key", 0, {{"a", 1}});
+    ASSERT_TRUE(cache.Get("key", 0, result));
+    EXPECT_EQ(result["a"], 1);
+    EXPECT_EQ(cache.Stats().hits, 1);
+    EXPECT_EQ(cache.Stats().misses, 1);
+}
+
+TEST(QueryCacheTest, StaleVersionIsMiss) {
+    QueryCache cache(1 << 20);
+    nlohmann::json result;
+    cache.Put("key", 1, {{"a", 1}});
+    EXPECT_FALSE(cache.Get("key", 2, result));
+    EXPECT_EQ(cache.Stats().entries, 0);
+    EXPECT_EQ(cache.Stats().bytes, 0);
+}
+
+TEST(QueryCacheTest, EvictsLeastRecentlyUsed) {
+    QueryCache probe(1 << 20);
+    probe.Put("a", 0, "value");
+    std::size_t entryBytes = probe.Stats().bytes;
+
+    QueryCache cache(entryBytes * 2 + entryBytes / 2);
+    nlohmann::json result;
+    cache.Put("a", 0, "value");
+    cache.Put("b", 0, "value");
+    ASSERT_TRUE(cache.Get("a", 0, result));
+    cache.Put("c", 0, "value");
+    EXPECT_TRUE(cache.Get("a", 0, result));
+    EXPECT_FALSE(cache.Get("b", 0, result));
+    EXPECT_TRUE(cache.Get("c", 0, result));
+    EXPECT_EQ(cache.Stats().evictions, 1);
+    EXPECT_LE(cache.Stats().bytes, cache.Stats().capacity);
+}
+
+TEST(QueryCacheTest, CanonicalKey) {
+    nlohmann::json query1 = R"({"age": {"$eq": 28}, "city": {"$in": ["NY"]}})"_json;
+    nlohmann::json query2 = R"({"city": {"$in": ["NY"]}, "age": {"$eq": 28}})"_json;
+    EXPECT_EQ(QueryCache::MakeKey("FindDocuments", query1),
+              QueryCache::MakeKey("FindDocuments", query2));
+    EXPECT_NE(QueryCache::MakeKey("FindDocuments", query1),
+              QueryCache::MakeKey("FindDocument", query1));
+}
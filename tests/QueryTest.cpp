@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include "jsondb.h"
+#include "nlohmann/json.hpp"
+
+using namespace jsondb;
+
+class QueryTestFixture : public ::testing::Test
+{
+protected:
+    JsonDB db;
+    Table table;
+    nlohmann::json documents = R"([
+        {"name": "ann", "age": 30, "city": "NY", "active": true},
+        {"name": "bob", "age": 25, "city": "LA", "active": false},
+        {"name": "carl", "age": "30", "city": "SF"},
+        {"name": "dana", "age": 41.5, "city": "LA", "active": true, "tag": null}
+    ])"_json;
+
+    QueryTestFixture() : db("test_db"), table("test_table", db)
+    {
+        db.Create();
+        table.Create();
+        for (const auto &document : documents) {
+            table.InsertDocument(document);
+        }
+    }
+
+    ~QueryTestFixture()
+    {
+        db.Drop();
+    }
+};
+
+TEST_F(QueryTestFixture, TestToJson)
+{
+    auto query = field("age") >= 28 && field("city").in({"NY", "LA"}) && field("age") < 40.5;
+    EXPECT_EQ(query.ToJson(), R"({"age": {"$gte": 28, "$lt": 40.5}, "city": {"$in": ["NY", "LA"]}})"_json);
+    EXPECT_EQ((field("tag") == nullptr).ToJson(), R"({"tag": {"$eq": null}})"_json);
+    EXPECT_EQ(field("n").not_in({1, 2}).ToJson(), R"({"n": {"$ne": [1, 2]}})"_json);
+    EXPECT_EQ((field("a") > 1 && field("a") > 2.5).ToJson(), R"({"a": {"$gt": 2.5}})"_json);
+    EXPECT_EQ((field("a") <= "b" && field("a") <= "a").ToJson(), R"({"a": {"$lte": "a"}})"_json);
+    EXPECT_THROW((field("a") == 1 && field("a") == 2).ToJson(), std::invalid_argument);
+    EXPECT_THROW((field("a") > 1 && field("a") > "b").ToJson(), std::invalid_argument);
+    EXPECT_EQ((field("a") == 1 && field("a") == 2).PlanJson(), R"({"a": {"$eq": 1}})"_json);
+    EXPECT_EQ(query.Fields(), (std::vector<std::string>{"age", "city", "age"}));
+}
+
+TEST_F(QueryTestFixture, TestMatchesJsonQuery)
+{
+    auto check = [&](const auto &query) {
+        nlohmann::json expected = nlohmann::json::array();
+        for (const auto &document : documents) {
+            EXPECT_EQ(query(document), match_query(document, query.ToJson())) << document.dump();
+            if (match_query(document, query.ToJson())) {
+                expected.push_back(document);
+            }
+        }
+        EXPECT_EQ(table.FindDocuments(query), expected) << query.ToJson().dump();
+        EXPECT_EQ(table.FindDocuments(query.ToJson()), expected) << query.ToJson().dump();
+    };
+    check(field("age") >= 28 && field("city").in({"NY", "LA"}));
+    check(field("age") == 30);
+    check(field("age") == "30");
+    check(field("name") > "bob" && field("active") == true);
+    check(field("city").not_in({"LA"}));
+    check(field("tag") == nullptr);
+    check(field("active") <= false);
+    check(field("missing") == 1);
+    check(field("age").in({25, 41}));
+}
+
+TEST_F(QueryTestFixture, TestRepeatedComparisons)
+{
+    EXPECT_EQ(table.FindDocuments(field("age") > 20 && field("age") > 28), R"([
+        {"name": "ann", "age": 30, "city": "NY", "active": true},
+        {"name": "dana", "age": 41.5, "city": "LA", "active": true, "tag": null}
+    ])"_json);
+    EXPECT_EQ(table.FindDocuments(field("age") == 30 && field("age") == 25), nlohmann::json::array());
+    EXPECT_EQ(table.FindDocuments(field("city").not_in({"LA"}) && field("city").not_in({"SF"})), R"([
+        {"name": "ann", "age": 30, "city": "NY", "active": true}
+    ])"_json);
+    EXPECT_EQ(table.FindDocuments(field("age") >= 25 && field("age") >= "30"), nlohmann::json::array());
+}
@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "jsondb.h"
+
+using namespace jsondb;
+
+class ServerTest : public ::testing::Test
+{
+protected:
+    JsonDB db;
+    Server server;
+    Client client;
+
+    ServerTest() : db("server_db"), server(db, "./data/server_db.sock"), client("./data/server_db.sock")
+    {
+        db.Create();
+    }
+
+    ~ServerTest()
+    {
+        client.Close();
+        server.Stop();
+        db.Drop();
+    }
+};
+
+// Appends a frame: length, id and code, little-endian, then the body.
+static void append_raw_frame(std::string &out, std::uint32_t id, std::uint8_t code, const std::string &body,
+                             std::uint32_t length = 0)
+{
+    length = length != 0 ? length : static_cast<std::uint32_t>(body.size() + 5);
+    for (std::uint32_t value : {length, id}) {
+        for (int i = 0; i < 4; i++) {
+            out += static_cast<char>(value >> (8 * i) & 0xff);
+        }
+    }
+    out += static_cast<char>(code);
+    out += body;
+}
+
+TEST_F(ServerTest, TestRemoteTable)
+{
+    EXPECT_FALSE(client.Connect());
+    ASSERT_TRUE(server.Start());
+    ASSERT_TRUE(client.Connect());
+
+    RemoteTable users("users", client);
+    EXPECT_FALSE(users.Exists());
+    ASSERT_TRUE(users.Create({"_id", IdGenerator::Monotonic, {"name"}}));
+    EXPECT_TRUE(users.Exists());
+    EXPECT_EQ(users.GetOptions().textIndexes, std::vector<std::string>{"name"});
+
+    nlohmann::json id;
+    EXPECT_TRUE(users.InsertDocument({{"name", "ada"}, {"age", 36}}, id));
+    EXPECT_EQ(id, 1);
+    EXPECT_TRUE(users.InsertDocument({{"name", "alan"}, {"age", 41}}));
+    EXPECT_FALSE(users.InsertDocument({{"_id", 1}}));
+
+    // the server tables are the local ones
+    Table local("users", db);
+    EXPECT_EQ(users.FindDocuments(), local.FindDocuments());
+    EXPECT_EQ(users.FindDocument(R"({"age": {"$gt": 40}})"_json)["name"], "alan");
+    EXPECT_EQ(users.GetById(1)["name"], "ada");
+    EXPECT_EQ(users.GetByIds({2, 3}).size(), 1);
+    EXPECT_EQ(users.Explain(R"({"name": {"$prefix": "ala"}})"_json)["plan"]["type"], "textSeek");
+
+    EXPECT_TRUE(users.UpdateById(1, {{"$set", {{"age", 37}}}}));
+    EXPECT_TRUE(users.UpdateDocuments({{"$set", {{"team", "a"}}}}, nullptr));
+    EXPECT_EQ(users.FindOneAndUpdate(R"({"name": {"$eq": "alan"}})"_json, {{"$set", {{"age", 42}}}})["age"], 42);
+    EXPECT_EQ(users.Upsert(R"({"name": {"$eq": "grace"}})"_json, {{"$set", {{"age", 85}}}})["_id"], 3);
+    EXPECT_EQ(local.FindDocuments(R"({"team": {"$eq": "a"}})"_json).size(), 2);
+    EXPECT_TRUE(users.DeleteById(3));
+    EXPECT_TRUE(users.DeleteDocuments(R"({"age": {"$lt": 40}})"_json));
+    EXPECT_TRUE(users.Compact());
+    EXPECT_EQ(local.FindDocuments(), R"([{"_id": 2, "name": "alan", "age": 42, "team": "a"}])"_json);
+    EXPECT_TRUE(users.Drop());
+    EXPECT_FALSE(local.Exists());
+}
+
+TEST_F(ServerTest, TestPipeline)
+{
+    ASSERT_TRUE(server.Start());
+    Table("items", db).Create();
+
+    std::vector<RemoteRequest> requests;
+    for (int i = 0; i < 100; i++) {
+        requests.push_back({RemoteCommand::InsertDocument, "items", nlohmann::json::array({{{"n", i}}})});
+    }
+    requests.push_back({RemoteCommand::FindDocuments, "items", nlohmann::json::array({R"({"n": {"$gte": 90}})"_json})});
+    requests.push_back({static_cast<RemoteCommand>(200), "items", nlohmann::json::array()});
+    requests.push_back({RemoteCommand::Ping, "", nlohmann::json::array()});
+    std::vector<RemoteReply> replies = client.Pipeline(requests);
+    ASSERT_EQ(replies.size(), requests.size());
+    EXPECT_EQ(replies[0].value, R"([true, null])"_json);
+    EXPECT_EQ(replies[100].value.size(), 10);
+    EXPECT_FALSE(replies[101].ok);
+    EXPECT_TRUE(replies[102].ok);
+
+    // concurrent clients each get their own replies
+    std::vector<std::thread> workers;
+    for (int w = 0; w < 4; w++) {
+        workers.emplace_back([w] {
+            Client own("./data/server_db.sock");
+            RemoteTable items("items", own);
+            for (int i = 0; i < 25; i++) {
+                EXPECT_TRUE(items.InsertDocument({{"worker", w}, {"i", i}}));
+            }
+            EXPECT_EQ(items.FindDocuments({{"worker", {{"$eq", w}}}}).size(), 25);
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    EXPECT_EQ(Table("items", db).FindDocuments().size(), 200);
+
+    // a stopped server makes the calls fail, a restarted one serves again
+    server.Stop();
+    RemoteTable items("items", client);
+    EXPECT_EQ(items.FindDocuments(), nlohmann::json::array());
+    ASSERT_TRUE(server.Start());
+    EXPECT_EQ(items.FindDocuments().size(), 200);
+}
+
+TEST_F(ServerTest, TestMalformedFrames)
+{
+    server.SetMaxFrameSize(1024);
+    ASSERT_TRUE(server.Start());
+    EXPECT_EQ(std::filesystem::status("./data/server_db.sock").permissions() & std::filesystem::perms::all,
+              std::filesystem::perms::owner_read | std::filesystem::perms::owner_write);
+    Table("items", db).Create();
+
+    std::string insert;
+    nlohmann::json::to_msgpack(nlohmann::json::array({"items", {{"n", 1}}}), insert);
+    std::string out;
+    append_raw_frame(out, 1, static_cast<std::uint8_t>(RemoteCommand::InsertDocument), insert);
+    append_raw_frame(out, 2, static_cast<std::uint8_t>(RemoteCommand::InsertDocument), "\xc1\xc1");
+    append_raw_frame(out, 3, static_cast<std::uint8_t>(RemoteCommand::InsertDocument), insert);
+    append_raw_frame(out, 4, static_cast<std::uint8_t>(RemoteCommand::Ping), "", 1 << 20);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, "./data/server_db.sock");
+    ASSERT_EQ(::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)), 0);
+    ASSERT_EQ(::send(fd, out.data(), out.size(), 0), static_cast<ssize_t>(out.size()));
+
+    // every request before the oversized frame is answered, then the
+    // connection is closed
+    std::string in;
+    char chunk[4096];
+    for (ssize_t count; (count = ::recv(fd, chunk, sizeof(chunk), 0)) > 0;) {
+        in.append(chunk, static_cast<std::size_t>(count));
+    }
+    ::close(fd);
+    std::vector<std::pair<std::uint32_t, std::uint8_t>> replies;
+    for (std::size_t offset = 0; offset + 9 <= in.size();) {
+        std::uint32_t length = 0;
+        std::uint32_t id = 0;
+        for (int i = 0; i < 4; i++) {
+            length |= static_cast<std::uint32_t>(static_cast<unsigned char>(in[offset + i])) << (8 * i);
+            id |= static_cast<std::uint32_t>(static_cast<unsigned char>(in[offset + 4 + i])) << (8 * i);
+        }
+        replies.emplace_back(id, static_cast<std::uint8_t>(in[offset + 8]));
+        offset += 4 + length;
+    }
+    std::vector<std::pair<std::uint32_t, std::uint8_t>> expected = {{1, 0}, {2, 1}, {3, 0}, {4, 1}};
+    EXPECT_EQ(replies, expected);
+    EXPECT_EQ(Table("items", db).FindDocuments().size(), 2);
+    EXPECT_TRUE(client.Connect());
+}
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 #include <iostream>
+#include <filesystem>
 #include <fstream>
+#include <thread>
 #include "jsondb.h"
 #include "nlohmann/json.hpp"
 
@@ -237,3 +239,832 @@ TEST_F(TableTestFixture, TestDeleteDocuments)
     EXPECT_TRUE(table.DeleteDocuments(query1));
     EXPECT_EQ(table.FindDocuments({{"filterkey", {{"$eq", 5}}}}).size(), 0);
 }
+
+TEST_F(TableTestFixture, TestQueryCache)
+{
+    db.Create();
+    table.Create();
+    table.SetQueryCacheCapacity(1 << 20);
+    nlohmann::json query = {{"filterkey", {{"$eq", 5}}}};
+    table.InsertDocument({{"key", "value1"},{"filterkey", 5}});
+    EXPECT_EQ(table.FindDocuments(query).size(), 1);
+    EXPECT_EQ(table.FindDocuments(query).size(), 1);
+    EXPECT_EQ(table.GetQueryCacheStats().hits, 1);
+    EXPECT_EQ(table.GetQueryCacheStats().misses, 1);
+
+    Table other("test_table", db);
+    std::uint64_t version = table.GetVersion();
+    other.InsertDocument({{"key", "value2"},{"filterkey", 5}});
+    EXPECT_GT(table.GetVersion(), version);
+    EXPECT_EQ(table.FindDocuments(query).size(), 2);
+    EXPECT_EQ(table.GetQueryCacheStats().misses, 2);
+
+    // writes of another instance on the same files invalidate the cache too
+    JsonDB otherDb("test_db");
+    Table external("test_table", otherDb);
+    EXPECT_TRUE(external.InsertDocument({{"key", "value3"},{"filterkey", 5}}));
+    EXPECT_EQ(table.FindDocuments(query).size(), 3);
+    EXPECT_EQ(table.FindDocument({{"key", {{"$eq", "value3"}}}})["filterkey"], 5);
+}
+
+TEST_F(TableTestFixture, TestUpdateOperators)
+{
+    db.Create();
+    table.Create();
+    table.InsertDocument({{"key", "value1"},{"visits", 1}});
+    table.InsertDocument({{"key", "value2"},{"visits", 1}});
+    nlohmann::json query = {{"key", {{"$eq", "value1"}}}};
+    EXPECT_TRUE(table.UpdateDocument(R"({"$inc": {"visits": 1}})"_json, query));
+    EXPECT_TRUE(table.UpdateDocuments(R"({"$inc": {"visits": 10}, "$push": {"log": "x"}})"_json, {}));
+    EXPECT_EQ(table.FindDocument(query)["visits"], 12);
+    EXPECT_EQ(table.FindDocuments()[1]["visits"], 11);
+    EXPECT_EQ(table.FindDocuments()[1]["log"], nlohmann::json({"x"}));
+    EXPECT_FALSE(table.UpdateDocument(R"({"$inc": {"key": 1}})"_json, query));
+    EXPECT_EQ(table.FindDocument(query)["key"], "value1");
+}
+
+TEST_F(TableTestFixture, TestUpdateIsJournaled)
+{
+    db.Create();
+    table.Create();
+    table.InsertDocument({{"key", "value1"},{"filterkey", 4}});
+    std::string tableFile = db.GetTablesPath() + "/test_table.json";
+    auto tableSize = std::filesystem::file_size(tableFile);
+    table.UpdateDocument(R"({"$set": {"filterkey": 123456}})"_json, {});
+    EXPECT_EQ(std::filesystem::file_size(tableFile), tableSize);
+    EXPECT_TRUE(std::filesystem::exists(db.GetTablesPath() + "/test_table.log"));
+    EXPECT_EQ(table.FindDocument()["filterkey"], 123456);
+
+    table.Compact();
+    EXPECT_FALSE(std::filesystem::exists(db.GetTablesPath() + "/test_table.log"));
+    EXPECT_EQ(table.FindDocument()["filterkey"], 123456);
+}
+
+TEST_F(TableTestFixture, TestDeleteDocumentsNonContiguous)
+{
+    db.Create();
+    table.Create();
+    table.SetCompactionThreshold(1);
+    for (int i = 0; i < 6; i++) {
+        table.InsertDocument({{"key", i}, {"filterkey", i % 2}});
+    }
+    std::string tableFile = db.GetTablesPath() + "/test_table.json";
+    auto tableSize = std::filesystem::file_size(tableFile);
+    EXPECT_TRUE(table.DeleteDocuments({{"filterkey", {{"$eq", 0}}}}));
+    EXPECT_EQ(std::filesystem::file_size(tableFile), tableSize);
+    nlohmann::json result = table.FindDocuments();
+    ASSERT_EQ(result.size(), 3);
+    EXPECT_EQ(result[0]["key"], 1);
+    EXPECT_EQ(result[1]["key"], 3);
+    EXPECT_EQ(result[2]["key"], 5);
+    EXPECT_TRUE(table.DeleteDocument({{"key", {{"$gt", 2}}}}));
+    EXPECT_EQ(table.FindDocument({{"key", {{"$gt", 2}}}})["key"], 5);
+}
+
+TEST_F(TableTestFixture, TestCompact)
+{
+    db.Create();
+    table.Create();
+    table.SetCompactionThreshold(1);
+    for (int i = 0; i < 4; i++) {
+        table.InsertDocument({{"key", i}});
+    }
+    table.DeleteDocuments({{"key", {{"$lt", 3}}}});
+    table.UpdateDocument(R"({"$inc": {"key": 10}})"_json, {});
+    EXPECT_TRUE(table.Compact());
+    EXPECT_FALSE(std::filesystem::exists(db.GetTablesPath() + "/test_table.log"));
+    EXPECT_EQ(table.FindDocuments(), nlohmann::json::parse(R"([{"key": 13}])"));
+}
+
+TEST_F(TableTestFixture, TestCompactInterrupted)
+{
+    db.Create();
+    table.Create();
+    for (int i = 0; i < 4; i++) {
+        table.InsertDocument({{"key", i}});
+    }
+    table.DeleteDocument({{"key", {{"$eq", 0}}}});
+    const std::string journal = db.GetTablesPath() + "/test_table.log";
+    std::ifstream journalIn(journal, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(journalIn)), std::istreambuf_iterator<char>());
+    journalIn.close();
+    ASSERT_TRUE(table.Compact());
+
+    // a crash between the rename of the table file and the removal of the
+    // journal leaves the journal of the old file behind
+    std::ofstream(journal, std::ios::binary) << content;
+    JsonDB otherDb("test_db");
+    Table other("test_table", otherDb);
+    EXPECT_EQ(other.FindDocuments(), nlohmann::json::parse(R"([{"key": 1}, {"key": 2}, {"key": 3}])"));
+    EXPECT_TRUE(other.InsertDocument({{"key", 4}}));
+    EXPECT_TRUE(other.DeleteDocument({{"key", {{"$eq", 1}}}}));
+
+    JsonDB thirdDb("test_db");
+    Table third("test_table", thirdDb);
+    EXPECT_EQ(third.FindDocuments(), nlohmann::json::parse(R"([{"key": 2}, {"key": 3}, {"key": 4}])"));
+}
+
+TEST_F(TableTestFixture, TestAutomaticCompaction)
+{
+    db.Create();
+    table.Create();
+    table.SetCompactionThreshold(0.5);
+    for (int i = 0; i < 4; i++) {
+        table.InsertDocument({{"key", i}});
+    }
+    table.DeleteDocuments({{"key", {{"$lt", 2}}}});
+    EXPECT_TRUE(std::filesystem::exists(db.GetTablesPath() + "/test_table.log"));
+    table.DeleteDocument({{"key", {{"$eq", 2}}}});
+    // the compaction runs on the executor, after the delete returned
+    for (int i = 0; i < 500 && std::filesystem::exists(db.GetTablesPath() + "/test_table.log"); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_FALSE(std::filesystem::exists(db.GetTablesPath() + "/test_table.log"));
+    EXPECT_EQ(table.FindDocuments().size(), 1);
+}
+
+TEST_F(TableTestFixture, TestWritesAcrossChunks)
+{
+    db.Create();
+    table.Create({"_id", IdGenerator::Monotonic, {}});
+    table.SetCompactionThreshold(1);
+    for (int i = 1; i <= 3000; i++) {
+        table.InsertDocument({{"n", i}});
+    }
+    // the transaction keeps the snapshot it started from
+    Transaction transaction(db);
+    EXPECT_EQ(transaction.FindDocuments("test_table", R"({"_id": {"$in": [1500, 2500]}})"_json).size(), 2);
+    EXPECT_TRUE(table.DeleteById(1500));
+    EXPECT_TRUE(table.UpdateById(2500, {{"n", -1}}));
+    EXPECT_TRUE(table.InsertDocument({{"n", 3001}}));
+
+    EXPECT_EQ(table.GetById(1500), nlohmann::json::object());
+    EXPECT_EQ(table.GetById(2500)["n"], -1);
+    EXPECT_EQ(table.GetById(1499)["n"], 1499);
+    EXPECT_EQ(table.GetById(3001)["n"], 3001);
+    nlohmann::json before = transaction.FindDocuments("test_table", R"({"_id": {"$in": [1500, 2500, 3001]}})"_json);
+    ASSERT_EQ(before.size(), 2);
+    EXPECT_EQ(before[0]["n"], 1500);
+    EXPECT_EQ(before[1]["n"], 2500);
+
+    JsonDB otherDb("test_db");
+    Table other("test_table", otherDb);
+    EXPECT_EQ(other.FindDocuments(), table.FindDocuments());
+    EXPECT_EQ(other.FindDocuments().size(), 3000);
+}
+
+TEST_F(TableTestFixture, TestInsertIsJournaled)
+{
+    db.Create();
+    table.Create();
+    std::string tableFile = db.GetTablesPath() + "/test_table.json";
+    table.InsertDocument({{"key", "value1"}});
+    table.InsertDocument({{"key", "value2"}});
+    EXPECT_EQ(std::filesystem::file_size(tableFile), 2);
+
+    JsonDB otherDb("test_db");
+    Table other("test_table", otherDb);
+    EXPECT_EQ(other.FindDocuments().size(), 2);
+    other.InsertDocument({{"key", "value3"}});
+    EXPECT_EQ(table.FindDocuments().size(), 3);
+}
+
+TEST_F(TableTestFixture, TestPrimaryKeyMonotonic)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create({"_id", IdGenerator::Monotonic}));
+    EXPECT_EQ(table.GetOptions().primaryKey, "_id");
+    nlohmann::json id;
+    ASSERT_TRUE(table.InsertDocument({{"key", "value1"}}, id));
+    EXPECT_EQ(id, 1);
+    ASSERT_TRUE(table.InsertDocument({{"key", "value2"}}, id));
+    EXPECT_EQ(id, 2);
+    ASSERT_TRUE(table.InsertDocument({{"_id", 10}, {"key", "value3"}}, id));
+    EXPECT_FALSE(table.InsertDocument({{"_id", 10}, {"key", "value4"}}));
+    ASSERT_TRUE(table.InsertDocument({{"key", "value5"}}, id));
+    EXPECT_EQ(id, 11);
+
+    EXPECT_EQ(table.GetById(2)["key"], "value2");
+    EXPECT_TRUE(table.GetById(3).empty());
+    nlohmann::json found = table.GetByIds({10, 3, 1});
+    ASSERT_EQ(found.size(), 2);
+    EXPECT_EQ(found[0]["key"], "value3");
+    EXPECT_EQ(found[1]["key"], "value1");
+
+    EXPECT_TRUE(table.UpdateById(2, R"({"$set": {"key": "updated"}})"_json));
+    EXPECT_EQ(table.GetById(2)["key"], "updated");
+    EXPECT_FALSE(table.UpdateById(2, R"({"$set": {"_id": 3}})"_json));
+    EXPECT_FALSE(table.UpdateById(3, R"({"$set": {"key": "missing"}})"_json));
+
+    EXPECT_TRUE(table.DeleteById(1));
+    EXPECT_FALSE(table.DeleteById(1));
+    EXPECT_TRUE(table.GetById(1).empty());
+    EXPECT_TRUE(table.Compact());
+    EXPECT_EQ(table.GetById(10)["key"], "value3");
+    EXPECT_EQ(table.FindDocuments().size(), 3);
+}
+
+TEST_F(TableTestFixture, TestPrimaryKeyPersisted)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create({"email", IdGenerator::None}));
+    EXPECT_FALSE(table.InsertDocument({{"key", "value1"}}));
+    EXPECT_TRUE(table.InsertDocument({{"email", "a@x.com"}, {"key", "value1"}}));
+    EXPECT_TRUE(table.InsertDocument({{"email", "b@x.com"}, {"key", "value2"}}));
+    table.Compact();
+    EXPECT_TRUE(std::filesystem::exists(db.GetTablesPath() + "/test_table.pk"));
+
+    JsonDB otherDb("test_db");
+    Table other("test_table", otherDb);
+    EXPECT_EQ(other.GetOptions().primaryKey, "email");
+    EXPECT_EQ(other.GetById("b@x.com")["key"], "value2");
+    EXPECT_FALSE(other.InsertDocument({{"email", "a@x.com"}}));
+}
+
+TEST_F(TableTestFixture, TestIndexFiles)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create({"_id", IdGenerator::Monotonic, {"name"}}));
+    for (int i = 0; i < 50; i++) {
+        table.InsertDocument({{"name", "item" + std::to_string(i)}});
+    }
+    ASSERT_TRUE(table.Compact());
+
+    nlohmann::json catalog;
+    std::ifstream(db.GetFile()) >> catalog;
+    EXPECT_EQ(catalog["tables"][0]["indexes"],
+              R"([{"type": "primary", "field": "_id", "file": "test_table.pk"},
+                  {"type": "text", "field": "name", "file": "test_table.text1.idx"}])"_json);
+    const std::string ids = db.GetTablesPath() + "/test_table.pk";
+    const std::string text = db.GetTablesPath() + "/test_table.text1.idx";
+    ASSERT_TRUE(std::filesystem::exists(ids));
+    ASSERT_TRUE(std::filesystem::exists(text));
+    auto written = std::filesystem::last_write_time(text);
+
+    // the files of the current table file are mapped, not rebuilt, and
+    // the journal extends them in memory
+    table.InsertDocument({{"name", "item50"}});
+    {
+        JsonDB reopened("test_db");
+        Table other("test_table", reopened);
+        EXPECT_EQ(other.GetById(50)["name"], "item49");
+        EXPECT_EQ(other.GetById(51)["name"], "item50");
+        EXPECT_EQ(other.FindDocuments(R"({"name": {"$prefix": "item4"}})"_json).size(), 11);
+        EXPECT_EQ(other.Explain(R"({"name": {"$contains": "em50"}})"_json)["actual"]["documentsReturned"], 1);
+        EXPECT_FALSE(other.InsertDocument({{"_id", 7}}));
+        EXPECT_EQ(std::filesystem::last_write_time(text), written);
+    }
+
+    // a corrupt file is rebuilt
+    {
+        std::fstream file(text, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-1, std::ios::end);
+        file.put('\xff');
+    }
+    {
+        std::ofstream file(ids, std::ios::trunc);
+        file << "{}";
+    }
+    JsonDB reopened("test_db");
+    Table other("test_table", reopened);
+    EXPECT_EQ(other.FindDocuments(R"({"name": {"$contains": "tem1"}})"_json).size(), 11);
+    EXPECT_EQ(other.GetById(11)["name"], "item10");
+    EXPECT_NE(std::filesystem::file_size(ids), 2);
+}
+
+TEST_F(TableTestFixture, TestIndexFilesConcurrentRebuild)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create({"_id", IdGenerator::Monotonic, {"name"}}));
+    for (int i = 0; i < 200; i++) {
+        table.InsertDocument({{"name", "item" + std::to_string(i)}});
+    }
+    ASSERT_TRUE(table.Compact());
+    std::filesystem::remove(db.GetTablesPath() + "/test_table.pk");
+    std::filesystem::remove(db.GetTablesPath() + "/test_table.text1.idx");
+
+    // readers of a fresh instance rebuild the missing files once
+    JsonDB reopened("test_db");
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 8; r++) {
+        readers.emplace_back([&reopened, r] {
+            Table other("test_table", reopened);
+            EXPECT_EQ(other.GetById(r + 1)["name"], "item" + std::to_string(r));
+        });
+    }
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    for (const auto &entry : std::filesystem::directory_iterator(db.GetTablesPath())) {
+        EXPECT_NE(entry.path().extension(), ".tmp") << entry.path();
+    }
+    JsonDB third("test_db");
+    Table other("test_table", third);
+    EXPECT_EQ(other.FindDocuments(R"({"name": {"$contains": "em19"}})"_json).size(), 11);
+    EXPECT_EQ(other.GetById(200)["name"], "item199");
+}
+
+TEST_F(TableTestFixture, TestPrimaryKeyObjectId)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create({"_id", IdGenerator::ObjectId}));
+    nlohmann::json id1, id2;
+    ASSERT_TRUE(table.InsertDocument({{"key", "value1"}}, id1));
+    ASSERT_TRUE(table.InsertDocument({{"key", "value2"}}, id2));
+    ASSERT_TRUE(id1.is_string());
+    EXPECT_EQ(id1.get<std::string>().size(), 24);
+    EXPECT_NE(id1, id2);
+    EXPECT_EQ(table.GetById(id2)["key"], "value2");
+}
+
+TEST_F(TableTestFixture, TestUpsert)
+{
+    db.Create();
+    table.Create();
+    nlohmann::json query = {{"key", {{"$eq", "counter"}}}};
+    nlohmann::json result = table.Upsert(query, R"({"$inc": {"hits": 1}})"_json);
+    EXPECT_EQ(result, R"({"key": "counter", "hits": 1})"_json);
+    result = table.Upsert(query, R"({"$inc": {"hits": 1}})"_json);
+    EXPECT_EQ(result["hits"], 2);
+    EXPECT_EQ(table.FindDocuments().size(), 1);
+    EXPECT_TRUE(table.Upsert(query, R"({"$inc": {"key": 1}})"_json).empty());
+}
+
+TEST_F(TableTestFixture, TestUpsertPrimaryKey)
+{
+    db.Create();
+    table.Create({"_id", IdGenerator::Monotonic});
+    nlohmann::json result = table.Upsert({{"name", {{"$eq", "john"}}}}, {{"age", 30}});
+    EXPECT_EQ(result["_id"], 1);
+    EXPECT_EQ(table.GetById(1)["age"], 30);
+}
+
+TEST_F(TableTestFixture, TestFindOneAndUpdate)
+{
+    db.Create();
+    table.Create();
+    table.InsertDocument({{"key", "value1"}, {"visits", 1}});
+    nlohmann::json query = {{"key", {{"$eq", "value1"}}}};
+    EXPECT_EQ(table.FindOneAndUpdate(query, R"({"$inc": {"visits": 1}})"_json)["visits"], 2);
+    EXPECT_EQ(table.FindOneAndUpdate(query, R"({"$inc": {"visits": 1}})"_json, false)["visits"], 2);
+    EXPECT_EQ(table.FindDocument(query)["visits"], 3);
+    EXPECT_TRUE(table.FindOneAndUpdate({{"key", {{"$eq", "none"}}}}, {{"a", 1}}).empty());
+}
+
+TEST_F(TableTestFixture, TestWatch)
+{
+    db.Create();
+    table.Create();
+    std::vector<ChangeEvent> seen;
+    int watchId = table.Watch({{"key", {{"$eq", "value1"}}}},
+                              [&seen](const ChangeEvent &event) { seen.push_back(event); });
+    table.InsertDocument({{"key", "value1"}});
+    table.InsertDocument({{"key", "value2"}});
+    table.UpdateDocument({{"$set", {{"visits", 1}}}}, {{"key", {{"$eq", "value1"}}}});
+    table.DeleteDocument({{"key", {{"$eq", "value1"}}}});
+    ASSERT_EQ(seen.size(), 3);
+    EXPECT_EQ(seen[0].operation, "insert");
+    EXPECT_EQ(seen[0].sequence, 1);
+    EXPECT_EQ(seen[1].operation, "update");
+    EXPECT_EQ(seen[1].document["visits"], 1);
+    EXPECT_EQ(seen[2].operation, "delete");
+    EXPECT_EQ(seen[2].sequence, 4);
+    EXPECT_TRUE(table.Unwatch(watchId));
+    EXPECT_FALSE(table.Unwatch(watchId));
+    table.InsertDocument({{"key", "value1"}});
+    EXPECT_EQ(seen.size(), 3);
+}
+
+TEST_F(TableTestFixture, TestReadChanges)
+{
+    db.Create();
+    table.Create();
+    table.SetChangeFeedCapacity(4);
+    for (int i = 0; i < 3; i++) {
+        table.InsertDocument({{"n", i}});
+    }
+    std::vector<ChangeEvent> events;
+    EXPECT_TRUE(table.ReadChanges(0, events));
+    ASSERT_EQ(events.size(), 3);
+    EXPECT_EQ(events[2].document["n"], 2);
+    for (int i = 3; i < 6; i++) {
+        table.InsertDocument({{"n", i}});
+    }
+    EXPECT_EQ(table.GetLastSequence(), 6);
+    events.clear();
+    EXPECT_FALSE(table.ReadChanges(1, events));
+    ASSERT_EQ(events.size(), 4);
+    EXPECT_EQ(events[0].sequence, 3);
+    events.clear();
+    EXPECT_TRUE(table.ReadChanges(4, events, 1));
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_EQ(events[0].document["n"], 4);
+}
+
+TEST_F(TableTestFixture, TestReadChangesWhileWriting)
+{
+    db.Create();
+    table.Create();
+    table.SetChangeFeedCapacity(8);
+    std::thread writer([this] {
+        for (int i = 0; i < 200; i++) {
+            table.InsertDocument({{"n", i}});
+        }
+    });
+    // whatever a reader gets is in order and matches its sequence number
+    std::uint64_t after = 0;
+    while (after < 200) {
+        std::vector<ChangeEvent> events;
+        table.ReadChanges(after, events);
+        for (const auto &event : events) {
+            ASSERT_GT(event.sequence, after);
+            EXPECT_EQ(event.document["n"], event.sequence - 1);
+            after = event.sequence;
+        }
+    }
+    writer.join();
+}
+
+TEST_F(TableTestFixture, TestAsync)
+{
+    db.Create();
+    table.Create();
+    db.SetExecutor(std::make_shared<Executor>(2));
+    EXPECT_EQ(db.GetExecutor()->GetThreadCount(), 2);
+    std::vector<std::future<bool>> inserts;
+    for (int i = 0; i < 10; i++) {
+        inserts.push_back(table.InsertDocumentAsync({{"n", i}}));
+    }
+    for (auto &insert : inserts) {
+        EXPECT_TRUE(insert.get());
+    }
+    nlohmann::json query = {{"n", {{"$gte", 5}}}};
+    auto first = table.FindDocumentsAsync(query);
+    auto second = table.FindDocumentsAsync(query);
+    // an event loop polls the futures instead of blocking on them
+    EXPECT_EQ(second.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    EXPECT_EQ(first.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    EXPECT_EQ(first.get().size(), 5);
+    EXPECT_EQ(second.get().size(), 5);
+    EXPECT_TRUE(table.UpdateDocumentsAsync(R"({"$inc": {"n": 10}})"_json, query).get());
+    EXPECT_EQ(table.FindDocumentAsync({{"n", {{"$eq", 15}}}}).get()["n"], 15);
+    EXPECT_TRUE(table.DeleteDocumentsAsync(query).get());
+    EXPECT_EQ(table.FindDocumentsAsync(query).get().size(), 0);
+}
+
+TEST_F(TableTestFixture, TestFindDocumentsInArena)
+{
+    db.Create();
+    table.Create();
+    for (int i = 0; i < 20; i++) {
+        table.InsertDocument({{"key", "a fairly long string value " + std::to_string(i)}, {"n", i}});
+    }
+    std::pmr::monotonic_buffer_resource arena;
+    {
+        ArenaScope scope(&arena);
+        ArenaJson results;
+        EXPECT_TRUE(table.FindDocuments({{"n", {{"$lt", 10}}}}, results));
+        ASSERT_EQ(results.size(), 10);
+        EXPECT_EQ(results[3]["n"], 3);
+        EXPECT_EQ(results[3]["key"], "a fairly long string value 3");
+        EXPECT_EQ(results[3]["key"].get_ref<const ArenaString &>().get_allocator().GetResource(), &arena);
+    }
+    ArenaJson heap;
+    EXPECT_TRUE(table.FindDocuments({}, heap));
+    EXPECT_EQ(heap.size(), 20);
+}
+
+TEST_F(TableTestFixture, TestInternedKeys)
+{
+    db.Create();
+    table.Create();
+    table.InsertDocument({{"name", "john"}, {"city", "paris"}, {"age", 30}});
+    table.InsertDocument({{"name", "jane"}, {"age", 25}});
+    table.InsertDocument(R"([1, 2])"_json);
+    EXPECT_TRUE(table.FindDocuments({{"unknown", {{"$eq", 1}}}}).empty());
+    EXPECT_EQ(table.FindDocuments({{"age", {{"$gt", 20}}}}).size(), 2);
+    EXPECT_EQ(table.FindDocuments({{"city", {{"$eq", "paris"}}}, {"age", {{"$lt", 40}}}}).size(), 1);
+    EXPECT_EQ(table.FindDocuments().size(), 3);
+    EXPECT_EQ(table.FindDocument({{"name", {{"$eq", "john"}}}}),
+              R"({"name": "john", "city": "paris", "age": 30})"_json);
+    // a key first seen in an update is interned too
+    table.UpdateDocument({{"$set", {{"email", "jane@example.com"}}}}, {{"name", {{"$eq", "jane"}}}});
+    EXPECT_EQ(table.FindDocument({{"email", {{"$eq", "jane@example.com"}}}})["name"], "jane");
+    EXPECT_TRUE(table.FindDocuments({{"age", 30}}).empty());
+}
+
+TEST_F(TableTestFixture, TestTapeRoundTrip)
+{
+    db.Create();
+    table.Create();
+    nlohmann::json documents = R"([
+        {"s": "", "long": "a string longer than one tape word", "n": null, "t": true, "f": false,
+         "i": -42, "u": 18446744073709551615, "d": 2.5,
+         "nested": {"b": [1, "two", {"c": []}], "a": {}}},
+        "plain string",
+        [1, 2, 3],
+        7
+    ])"_json;
+    for (const auto &document : documents) {
+        table.InsertDocument(document);
+    }
+    EXPECT_EQ(table.FindDocuments(), documents);
+}
+
+TEST_F(TableTestFixture, TestTapeMatchesMatchQuery)
+{
+    db.Create();
+    table.Create();
+    nlohmann::json documents = R"([
+        {"name": "ann", "age": 30, "score": 1.5, "active": true, "tag": null},
+        {"name": "bob", "age": 25, "score": 3, "active": false, "tags": ["x"]},
+        {"name": "carl", "age": "30", "active": true},
+        {"name": "dana", "age": 41, "score": -2, "tag": "vip"}
+    ])"_json;
+    for (const auto &document : documents) {
+        table.InsertDocument(document);
+    }
+    std::vector<nlohmann::json> queries = {
+        R"({"age": {"$gte": 30}})"_json,
+        R"({"age": {"$eq": "30"}})"_json,
+        R"({"name": {"$gt": "bob"}, "active": {"$eq": true}})"_json,
+        R"({"name": {"$in": ["ann", "dana"]}})"_json,
+        R"({"age": {"$ne": [25, 41]}})"_json,
+        R"({"score": {"$lt": 2}})"_json,
+        R"({"tag": {"$eq": null}})"_json,
+        R"({"tags": {"$eq": ["x"]}})"_json,
+        R"({"active": {"$lte": false}})"_json,
+        R"({"age": {"$between": 30}})"_json,
+        R"({"age": 30})"_json,
+    };
+    for (const auto &query : queries) {
+        nlohmann::json expected = nlohmann::json::array();
+        for (const auto &document : documents) {
+            if (match_query(document, query)) {
+                expected.push_back(document);
+            }
+        }
+        EXPECT_EQ(table.FindDocuments(query), expected) << query.dump();
+    }
+}
+
+TEST_F(TableTestFixture, TestExplain)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create({"_id", IdGenerator::Monotonic}));
+    for (int i = 0; i < 10; i++) {
+        table.InsertDocument({{"n", i}});
+    }
+
+    nlohmann::json plan = table.Explain(R"({"n": {"$gte": 5}})"_json);
+    EXPECT_EQ(plan["plan"]["type"], "fullScan");
+    EXPECT_EQ(plan["estimated"]["documentsExamined"], 10);
+    EXPECT_EQ(plan["actual"]["documentsExamined"], 10);
+    EXPECT_EQ(plan["actual"]["documentsReturned"], 5);
+    EXPECT_TRUE(plan["timeUs"].contains("match"));
+
+    plan = table.Explain(R"({"_id": {"$in": [3, 7, 42]}, "n": {"$gt": 3}})"_json);
+    EXPECT_EQ(plan["plan"]["type"], "idSeek");
+    EXPECT_EQ(plan["plan"]["index"], "_id");
+    EXPECT_EQ(plan["estimated"]["documentsExamined"], 2);
+    EXPECT_EQ(plan["actual"]["documentsReturned"], 1);
+    EXPECT_EQ(table.FindDocuments(R"({"_id": {"$in": [3, 7, 42]}, "n": {"$gt": 3}})"_json),
+              R"([{"_id": 7, "n": 6}])"_json);
+    EXPECT_EQ(table.FindDocument(R"({"_id": {"$eq": 4}})"_json), R"({"_id": 4, "n": 3})"_json);
+
+    plan = table.Explain(R"({"missing": {"$eq": 1}})"_json, {false, false});
+    EXPECT_EQ(plan["plan"]["type"], "empty");
+    EXPECT_EQ(plan["segments"]["pruned"], 1);
+    EXPECT_EQ(plan["estimated"]["documentsExamined"], 0);
+    EXPECT_FALSE(plan.contains("actual"));
+
+    plan = table.Explain(nullptr, {true, true});
+    EXPECT_EQ(plan["operation"], "FindDocument");
+    EXPECT_EQ(plan["actual"]["documentsExamined"], 1);
+
+    EXPECT_TRUE(table.DeleteDocuments(R"({"_id": {"$eq": 2}})"_json));
+    EXPECT_EQ(table.FindDocuments().size(), 9);
+    EXPECT_TRUE(table.UpdateDocuments({{"n", 100}}, R"({"_id": {"$in": [1, 10]}})"_json));
+    EXPECT_EQ(table.FindDocuments(R"({"n": {"$eq": 100}})"_json).size(), 2);
+}
+
+TEST_F(TableTestFixture, TestSlowLog)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create({"_id", IdGenerator::Monotonic}));
+    std::vector<SlowOperation> logged;
+    SlowLogOptions options;
+    options.thresholdUs = 0;
+    options.callback = [&logged](const SlowOperation &operation) { logged.push_back(operation); };
+    table.SetSlowLog(options);
+
+    table.InsertDocument({{"name", "ann"}, {"age", 30}});
+    table.FindDocuments(R"({"name": {"$eq": "ann"}, "age": {"$in": [30, 31]}})"_json);
+    table.GetById(1);
+    ASSERT_EQ(logged.size(), 3);
+    EXPECT_EQ(logged[0].operation, "Table::InsertDocument");
+    EXPECT_EQ(logged[0].plan, "none");
+    EXPECT_EQ(logged[1].operation, "Table::FindDocuments");
+    EXPECT_EQ(logged[1].table, "test_table");
+    EXPECT_EQ(logged[1].query, R"({"name": {"$eq": "?"}, "age": {"$in": "?"}})"_json);
+    EXPECT_EQ(logged[1].plan, "fullScan");
+    EXPECT_EQ(logged[1].documentsScanned, 1);
+    EXPECT_FALSE(logged[1].sampled);
+    EXPECT_EQ(logged[2].plan, "idSeek");
+
+    // fast operations are only recorded by sampling
+    options.thresholdUs = 1e12;
+    options.sampleRate = 1;
+    table.SetSlowLog(options);
+    table.DeleteDocuments(R"({"_id": {"$eq": 1}})"_json);
+    ASSERT_EQ(logged.size(), 4);
+    EXPECT_TRUE(logged[3].sampled);
+    EXPECT_EQ(logged[3].plan, "idSeek");
+
+    table.DisableSlowLog();
+    table.FindDocuments();
+    EXPECT_EQ(logged.size(), 4);
+}
+
+TEST_F(TableTestFixture, TestSlowLogRotation)
+{
+    db.Create();
+    table.Create();
+    const std::string path = "test_slow.log";
+    SlowLogOptions options;
+    options.thresholdUs = 0;
+    options.path = path;
+    options.maxFileBytes = 512;
+    options.maxFiles = 2;
+    table.SetSlowLog(options);
+    for (int i = 0; i < 20; i++) {
+        table.InsertDocument({{"n", i}});
+    }
+    table.DisableSlowLog();
+
+    EXPECT_TRUE(std::filesystem::exists(path + ".1"));
+    EXPECT_TRUE(std::filesystem::exists(path + ".2"));
+    EXPECT_FALSE(std::filesystem::exists(path + ".3"));
+    EXPECT_LE(std::filesystem::file_size(path), 512);
+    std::ifstream log(path);
+    std::string line;
+    ASSERT_TRUE(std::getline(log, line));
+    nlohmann::json entry = nlohmann::json::parse(line);
+    EXPECT_EQ(entry["operation"], "Table::InsertDocument");
+    EXPECT_EQ(entry["table"], "test_table");
+    for (const auto &file : {path, path + ".1", path + ".2"}) {
+        std::filesystem::remove(file);
+    }
+}
+
+TEST_F(TableTestFixture, TestImportExport)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create({"_id", IdGenerator::Monotonic}));
+    table.InsertDocument({{"n", -1}});
+    const std::string ndjson = "test_import.ndjson";
+    {
+        std::ofstream out(ndjson);
+        for (int i = 0; i < 5000; i++) {
+            out << nlohmann::json({{"n", i}, {"s", "a,b]\"{"}}).dump() << "\n";
+            if (i % 1000 == 0) {
+                out << "\n";
+            }
+        }
+    }
+    ASSERT_TRUE(table.Import(ndjson));
+    EXPECT_EQ(table.FindDocuments().size(), 5001);
+    EXPECT_EQ(table.GetById(5001), R"({"_id": 5001, "n": 4999, "s": "a,b]\"{"})"_json);
+    EXPECT_EQ(table.FindDocuments(R"({"n": {"$lt": 10}})"_json).size(), 11);
+
+    const std::string array = "test_export.json";
+    ASSERT_TRUE(table.Export(array, FileFormat::JsonArray));
+    nlohmann::json exported;
+    std::ifstream(array) >> exported;
+    EXPECT_EQ(exported, table.FindDocuments());
+
+    // an import is all or nothing
+    EXPECT_FALSE(table.Import(array, FileFormat::JsonArray));
+    EXPECT_EQ(table.FindDocuments().size(), 5001);
+    EXPECT_FALSE(table.Import("missing.ndjson"));
+
+    Table other("other_table", db);
+    other.Create();
+    ASSERT_TRUE(other.Import(array, FileFormat::JsonArray));
+    EXPECT_EQ(other.FindDocuments(), exported);
+    ASSERT_TRUE(other.Export(ndjson));
+    Table copy("copy_table", db);
+    copy.Create();
+    ASSERT_TRUE(copy.Import(ndjson));
+    EXPECT_EQ(copy.FindDocuments(), exported);
+
+    std::ofstream(array) << " [ ] ";
+    EXPECT_TRUE(copy.Import(array, FileFormat::JsonArray));
+    std::ofstream(array) << "[{\"n\": 1}] x";
+    EXPECT_FALSE(copy.Import(array, FileFormat::JsonArray));
+    EXPECT_EQ(copy.FindDocuments().size(), 5001);
+    std::filesystem::remove(ndjson);
+    std::filesystem::remove(array);
+}
+
+TEST_F(TableTestFixture, TestFindRawDocuments)
+{
+    db.Create();
+    table.Create();
+    nlohmann::json documents = R"([
+        {"z": 1, "a": {"y": [1, -2.5, 1e300, 0.1], "b": null}, "m": true},
+        {"text": "quote \" slash \\ tab \t bell \u0007 é 😀", "n": 18446744073709551615, "f": 3.0},
+        {"z": -9223372036854775808, "empty": {}, "list": [], "s": ""}
+    ])"_json;
+    for (const auto &document : documents) {
+        table.InsertDocument(document);
+    }
+    RawDocuments raw;
+    ASSERT_TRUE(table.FindDocuments(nullptr, raw));
+    EXPECT_EQ(raw.Text(), table.FindDocuments().dump());
+    ASSERT_EQ(raw.Size(), 3);
+    for (std::size_t i = 0; i < raw.Size(); i++) {
+        EXPECT_EQ(raw.Json(i), documents[i]);
+        EXPECT_EQ(raw.Text().substr(raw.Offset(i).first, raw.Offset(i).second), raw.Text(i));
+    }
+
+    ASSERT_TRUE(table.FindDocuments(R"({"z": {"$lt": 0}})"_json, raw));
+    EXPECT_EQ(raw.Size(), 1);
+    EXPECT_EQ(raw.Text(), "[" + documents[2].dump() + "]");
+    ASSERT_TRUE(table.FindDocuments(R"({"missing": {"$eq": 0}})"_json, raw));
+    EXPECT_EQ(raw.Text(), "[]");
+}
+
+TEST_F(TableTestFixture, TestTextIndex)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create());
+    const char *names[] = {"alpha centauri", "alphabet", "beta", "gamma ray", "alpine lake", "delta alpha"};
+    for (const char *name : names) {
+        table.InsertDocument({{"name", name}});
+    }
+    table.InsertDocument({{"name", 42}});
+
+    // the operators work without an index
+    EXPECT_EQ(table.FindDocuments(R"({"name": {"$prefix": "alp"}})"_json).size(), 3);
+    EXPECT_EQ(table.Explain(R"({"name": {"$prefix": "alp"}})"_json)["plan"]["type"], "fullScan");
+
+    ASSERT_TRUE(table.CreateTextIndex("name"));
+    ASSERT_TRUE(table.CreateTextIndex("name"));
+    EXPECT_EQ(table.GetOptions().textIndexes, std::vector<std::string>{"name"});
+
+    nlohmann::json plan = table.Explain(R"({"name": {"$contains": "alpha"}})"_json);
+    EXPECT_EQ(plan["plan"]["type"], "textSeek");
+    EXPECT_EQ(plan["plan"]["index"], "name");
+    EXPECT_EQ(plan["estimated"]["documentsExamined"], 3);
+    EXPECT_EQ(plan["actual"]["documentsReturned"], 3);
+
+    EXPECT_EQ(table.FindDocuments(R"({"name": {"$prefix": "alpha"}})"_json),
+              R"([{"name": "alpha centauri"}, {"name": "alphabet"}])"_json);
+    EXPECT_EQ(table.FindDocuments(R"({"name": {"$regex": "^al.*a$"}})"_json), R"([])"_json);
+    EXPECT_EQ(table.FindDocuments(R"({"name": {"$regex": "a (ray|lake)$"}})"_json),
+              R"([{"name": "gamma ray"}])"_json);
+    EXPECT_EQ(table.FindDocuments(R"({"name": {"$contains": "zzz"}})"_json), R"([])"_json);
+
+    // literals the regex requires narrow the candidates, alternations do not
+    plan = table.Explain(R"({"name": {"$regex": "^del?ta\\s+alp"}})"_json);
+    EXPECT_EQ(plan["plan"]["type"], "textSeek");
+    EXPECT_EQ(plan["estimated"]["documentsExamined"], 4);
+    EXPECT_EQ(plan["actual"]["documentsReturned"], 1);
+    EXPECT_EQ(table.Explain(R"({"name": {"$regex": "beta|gamma"}})"_json)["plan"]["type"], "fullScan");
+    EXPECT_EQ(table.Explain(R"({"name": {"$contains": "al"}})"_json)["plan"]["type"], "fullScan");
+
+    // writes keep the index up to date, in memory and after a compaction
+    EXPECT_TRUE(table.UpdateDocuments({{"name", "beta alpha"}}, R"({"name": {"$eq": "beta"}})"_json));
+    EXPECT_TRUE(table.DeleteDocuments(R"({"name": {"$eq": "alphabet"}})"_json));
+    table.InsertDocument({{"name", "omega alpha"}});
+    EXPECT_EQ(table.FindDocuments(R"({"name": {"$contains": "alpha"}})"_json).size(), 4);
+    EXPECT_TRUE(table.Compact());
+    EXPECT_EQ(table.FindDocuments(R"({"name": {"$contains": "alpha"}})"_json).size(), 4);
+
+    JsonDB reopened("test_db");
+    Table other("test_table", reopened);
+    EXPECT_EQ(other.Explain(R"({"name": {"$contains": "alpha"}})"_json)["actual"]["documentsReturned"], 4);
+}
+
+TEST_F(TableTestFixture, TestTextIndexEscapes)
+{
+    db.Create();
+    ASSERT_TRUE(table.Create());
+    for (const char *name : {"Abcd", "x12yzw", "bcbcq", "tab\tsep", "zzzz"}) {
+        table.InsertDocument({{"name", name}});
+    }
+    const std::vector<std::string> patterns = {"\\x41bc", "\\u0041bcd", "x\\d\\dyz", "(bc)\\1q", "tab\\tsep",
+                                               "\\x62cbc", "^\\x7a{2}zz"};
+    std::vector<nlohmann::json> scanned;
+    for (const auto &pattern : patterns) {
+        scanned.push_back(table.FindDocuments({{"name", {{"$regex", pattern}}}}));
+        EXPECT_EQ(scanned.back().size(), 1) << pattern;
+    }
+
+    // the escapes must not make the index demand trigrams of their text
+    ASSERT_TRUE(table.CreateTextIndex("name"));
+    for (std::size_t i = 0; i < patterns.size(); i++) {
+        EXPECT_EQ(table.FindDocuments({{"name", {{"$regex", patterns[i]}}}}), scanned[i]) << patterns[i];
+    }
+}
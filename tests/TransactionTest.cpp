@@ -0,0 +1,184 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include "jsondb.h"
+
+using namespace jsondb;
+
+// Fails every write to the files whose path contains `failing`.
+class FailingIoBackend : public IoBackend
+{
+public:
+    explicit FailingIoBackend(std::string failing) : failing(std::move(failing)) {}
+
+    std::string GetName() const override { return "failing"; }
+
+    std::vector<std::string> ReadFiles(const std::vector<std::string> &paths) override
+    {
+        return io->ReadFiles(paths);
+    }
+
+    void WriteFile(const std::string &path, const std::string &content, bool sync) override
+    {
+        Check(path);
+        io->WriteFile(path, content, sync);
+    }
+
+    void AppendFile(const std::string &path, const std::string &content, bool sync) override
+    {
+        Check(path);
+        io->AppendFile(path, content, sync);
+    }
+
+    void SyncFiles(const std::vector<std::string> &paths) override
+    {
+        io->SyncFiles(paths);
+    }
+
+private:
+    std::shared_ptr<IoBackend> io = make_posix_io_backend();
+    std::string failing;
+
+    void Check(const std::string &path)
+    {
+        if (path.find(failing) != std::string::npos) {
+            throw std::runtime_error("Error writing to: " + path);
+        }
+    }
+};
+
+class TransactionTest : public ::testing::Test
+{
+protected:
+    JsonDB db;
+    Table users;
+    Table orders;
+
+    TransactionTest() : db("test_db"), users("users", db), orders("orders", db)
+    {
+        db.Create();
+        users.Create();
+        orders.Create();
+    }
+
+    ~TransactionTest()
+    {
+        db.Drop();
+    }
+};
+
+TEST_F(TransactionTest, CommitAcrossTables)
+{
+    users.InsertDocument({{"name", "john"}, {"balance", 10}});
+    Transaction txn = db.BeginTransaction();
+    EXPECT_TRUE(txn.UpdateDocuments("users", R"({"$inc": {"balance": -5}})"_json,
+                                    {{"name", {{"$eq", "john"}}}}));
+    EXPECT_TRUE(txn.InsertDocument("orders", {{"user", "john"}, {"amount", 5}}));
+    EXPECT_EQ(txn.FindDocuments("users", {})[0]["balance"], 5);
+
+    // nothing is visible before the commit
+    EXPECT_EQ(users.FindDocument()["balance"], 10);
+    EXPECT_EQ(orders.FindDocuments().size(), 0);
+
+    EXPECT_TRUE(txn.Commit());
+    EXPECT_EQ(users.FindDocument()["balance"], 5);
+    EXPECT_EQ(orders.FindDocuments().size(), 1);
+    EXPECT_FALSE(txn.Commit());
+
+    JsonDB otherDb("test_db");
+    Table otherOrders("orders", otherDb);
+    EXPECT_EQ(otherOrders.FindDocuments().size(), 1);
+}
+
+TEST_F(TransactionTest, Rollback)
+{
+    {
+        Transaction txn = db.BeginTransaction();
+        txn.InsertDocument("users", {{"name", "john"}});
+        txn.Rollback();
+        EXPECT_FALSE(txn.InsertDocument("users", {{"name", "jane"}}));
+    }
+    {
+        Transaction txn = db.BeginTransaction();
+        txn.InsertDocument("users", {{"name", "john"}});
+    }
+    EXPECT_EQ(users.FindDocuments().size(), 0);
+}
+
+TEST_F(TransactionTest, Conflict)
+{
+    users.InsertDocument({{"name", "john"}, {"balance", 10}});
+    Transaction txn = db.BeginTransaction();
+    txn.DeleteDocuments("users", {{"name", {{"$eq", "john"}}}});
+    txn.InsertDocument("orders", {{"user", "john"}});
+    users.UpdateDocument(R"({"$inc": {"balance": 1}})"_json, {});
+    EXPECT_FALSE(txn.Commit());
+    EXPECT_EQ(users.FindDocuments().size(), 1);
+    EXPECT_EQ(orders.FindDocuments().size(), 0);
+}
+
+TEST_F(TransactionTest, MissingTable)
+{
+    Transaction txn = db.BeginTransaction();
+    EXPECT_FALSE(txn.InsertDocument("missing", {{"name", "john"}}));
+    EXPECT_TRUE(txn.Commit());
+}
+
+TEST_F(TransactionTest, RecoverLoggedTransaction)
+{
+    users.InsertDocument({{"name", "john"}});
+    {
+        // a transaction logged by a process that died before its journals
+        std::ofstream logFile(db.GetPath() + "/test_db.txn");
+        logFile << R"({"tables":{"users":[{"op":"insert","doc":{"name":"jane"}}]},"txn":"t1"})" << "\n";
+    }
+    JsonDB otherDb("test_db");
+    Table otherUsers("users", otherDb);
+    EXPECT_EQ(otherUsers.FindDocuments().size(), 2);
+    EXPECT_FALSE(std::filesystem::exists(db.GetPath() + "/test_db.txn"));
+
+    JsonDB thirdDb("test_db");
+    Table thirdUsers("users", thirdDb);
+    EXPECT_EQ(thirdUsers.FindDocuments().size(), 2);
+}
+
+TEST_F(TransactionTest, FailedAppendIsUndone)
+{
+    orders.InsertDocument({{"user", "jane"}});
+    Transaction txn = db.BeginTransaction();
+    txn.InsertDocument("orders", {{"user", "john"}});
+    txn.InsertDocument("users", {{"name", "john"}});
+    Transaction moved(std::move(txn));
+    EXPECT_FALSE(txn.Commit());
+
+    // the orders journal is written before the users one fails
+    db.SetIoBackend(std::make_shared<FailingIoBackend>("users.log"));
+    EXPECT_FALSE(moved.Commit());
+    db.SetIoBackend(make_posix_io_backend());
+    EXPECT_EQ(orders.FindDocuments().size(), 1);
+
+    JsonDB otherDb("test_db");
+    Table otherOrders("orders", otherDb);
+    Table otherUsers("users", otherDb);
+    EXPECT_EQ(otherOrders.FindDocuments().size(), 1);
+    EXPECT_EQ(otherUsers.FindDocuments().size(), 0);
+}
+
+TEST_F(TransactionTest, ChangesFollowTheBatch)
+{
+    std::vector<ChangeEvent> seen;
+    users.Watch({}, [&seen](const ChangeEvent &event) { seen.push_back(event); });
+    Transaction txn = db.BeginTransaction();
+    txn.InsertDocument("users", {{"name", "john"}});
+    txn.UpdateDocuments("users", R"({"$set": {"balance": 5}})"_json, {});
+    txn.DeleteDocuments("users", {{"name", {{"$eq", "john"}}}});
+    EXPECT_TRUE(txn.Commit());
+    EXPECT_EQ(users.FindDocuments().size(), 0);
+
+    ASSERT_EQ(seen.size(), 3);
+    EXPECT_EQ(seen[0].operation, "insert");
+    EXPECT_EQ(seen[1].operation, "update");
+    EXPECT_EQ(seen[1].document["balance"], 5);
+    EXPECT_EQ(seen[2].operation, "delete");
+    EXPECT_EQ(seen[2].document, nlohmann::json({{"name", "john"}, {"balance", 5}}));
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include "jsondb.h"
+#include "nlohmann/json.hpp"
+
+using namespace jsondb;
+
+struct User {
+    std::string name;
+    int age = 0;
+    double score = 0;
+    bool active = false;
+};
+
+template <>
+struct jsondb::TableFields<User> {
+    static constexpr auto value = std::make_tuple(JSONDB_FIELD(User, name), JSONDB_FIELD(User, age),
+                                                  make_field("points", &User::score), JSONDB_FIELD(User, active));
+};
+
+class TypedTableTestFixture : public ::testing::Test
+{
+protected:
+    JsonDB db;
+    TypedTable<User> users;
+
+    TypedTableTestFixture() : db("test_db"), users("users", db)
+    {
+        db.Create();
+        users.GetTable().Create();
+    }
+
+    ~TypedTableTestFixture()
+    {
+        db.Drop();
+    }
+};
+
+TEST_F(TypedTableTestFixture, TestInsertAndFindAll)
+{
+    EXPECT_TRUE(users.Insert({"ann", 30, 1.5, true}));
+    EXPECT_TRUE(users.Insert({"bob", 25, 3, false}));
+    EXPECT_EQ(users.GetTable().FindDocument(R"({"name": {"$eq": "ann"}})"_json),
+              R"({"name": "ann", "age": 30, "points": 1.5, "active": true})"_json);
+
+    std::vector<User> all = users.FindAll();
+    ASSERT_EQ(all.size(), 2);
+    EXPECT_EQ(all[1].name, "bob");
+    EXPECT_EQ(all[1].age, 25);
+    EXPECT_EQ(all[1].score, 3);
+    EXPECT_FALSE(all[1].active);
+}
+
+TEST_F(TypedTableTestFixture, TestFind)
+{
+    users.Insert({"ann", 30, 1.5, true});
+    users.Insert({"bob", 25, 3, false});
+    users.Insert({"carl", 41, 2, true});
+
+    std::vector<User> found = users.Find(member(&User::age) >= 28 && member(&User::active) == true);
+    ASSERT_EQ(found.size(), 2);
+    EXPECT_EQ(found[0].name, "ann");
+    EXPECT_EQ(found[1].name, "carl");
+
+    found = users.Find(!(member(&User::name) == std::string("ann")) || member(&User::score) < 2.0);
+    EXPECT_EQ(found.size(), 3);
+    EXPECT_EQ(users.Find([](const User &user) { return user.name.size() == 3; }).size(), 2);
+
+    std::optional<User> one = users.FindOne(member(&User::score) > 2.5);
+    ASSERT_TRUE(one.has_value());
+    EXPECT_EQ(one->name, "bob");
+    EXPECT_FALSE(users.FindOne(member(&User::age) > 100).has_value());
+}
+
+TEST_F(TypedTableTestFixture, TestSeesTableChanges)
+{
+    users.Insert({"ann", 30, 1.5, true});
+    EXPECT_EQ(users.FindAll().size(), 1);
+
+    // written through the untyped table, with a missing and a mistyped field
+    users.GetTable().InsertDocument(R"({"name": "dana", "age": "old"})"_json);
+    std::vector<User> all = users.FindAll();
+    ASSERT_EQ(all.size(), 2);
+    EXPECT_EQ(all[1].name, "dana");
+    EXPECT_EQ(all[1].age, 0);
+
+    users.GetTable().DeleteDocuments(R"({"name": {"$eq": "ann"}})"_json);
+    EXPECT_EQ(users.FindAll().size(), 1);
+}
+
+TEST_F(TypedTableTestFixture, TestUpdateAndDelete)
+{
+    users.Insert({"ann", 30, 1.5, true});
+    users.Insert({"bob", 25, 3, false});
+    users.Insert({"carl", 41, 2, true});
+    EXPECT_EQ(users.FindAll().size(), 3);
+
+    std::uint64_t version = users.GetTable().GetVersion();
+    EXPECT_TRUE(users.Update(member(&User::active) == true, [](User &user) { user.age++; }));
+    EXPECT_EQ(users.GetTable().GetVersion(), version + 1);
+    EXPECT_EQ(users.GetTable().FindDocument(R"({"name": {"$eq": "carl"}})"_json),
+              R"({"name": "carl", "age": 42, "points": 2.0, "active": true})"_json);
+
+    // a record held by a reader is not changed by later writes
+    std::vector<User> before = users.FindAll();
+    EXPECT_TRUE(users.Delete(member(&User::name) == std::string("bob")));
+    EXPECT_TRUE(users.Insert({"dana", 19, 0.5, false}));
+    EXPECT_TRUE(users.Update(member(&User::age) < 20, [](User &user) { user.active = true; }));
+    ASSERT_EQ(before.size(), 3);
+    EXPECT_EQ(before[1].name, "bob");
+
+    // the records kept up to date match a fresh decode of the table
+    TypedTable<User> fresh("users", db);
+    std::vector<User> all = users.FindAll();
+    std::vector<User> decoded = fresh.FindAll();
+    ASSERT_EQ(all.size(), 3);
+    ASSERT_EQ(decoded.size(), 3);
+    for (std::size_t i = 0; i < all.size(); i++) {
+        EXPECT_EQ(all[i].name, decoded[i].name);
+        EXPECT_EQ(all[i].age, decoded[i].age);
+        EXPECT_EQ(all[i].score, decoded[i].score);
+        EXPECT_EQ(all[i].active, decoded[i].active);
+    }
+    EXPECT_EQ(all[0].age, 31);
+    EXPECT_EQ(all[1].name, "carl");
+    EXPECT_EQ(all[2].name, "dana");
+    EXPECT_TRUE(all[2].active);
+
+    EXPECT_TRUE(users.Update(member(&User::age) > 100, [](User &user) { user.age = 0; }));
+    EXPECT_TRUE(users.Delete(member(&User::age) > 100));
+}
+
+TEST_F(TypedTableTestFixture, TestWritesAfterOtherChanges)
+{
+    users.Insert({"ann", 30, 1.5, true});
+    users.Insert({"bob", 25, 3, false});
+    EXPECT_EQ(users.FindAll().size(), 2);
+
+    // another TypedTable moves the rows under the records of this one
+    TypedTable<User> other("users", db);
+    EXPECT_TRUE(other.Delete(member(&User::name) == std::string("ann")));
+    EXPECT_TRUE(users.Update(member(&User::name) == std::string("bob"), [](User &user) { user.score = 4; }));
+    std::vector<User> all = users.FindAll();
+    ASSERT_EQ(all.size(), 1);
+    EXPECT_EQ(all[0].score, 4);
+    EXPECT_EQ(other.FindAll()[0].score, 4);
+
+    // stale rows are refused by the table
+    std::uint64_t version = users.GetTable().GetVersion();
+    users.GetTable().InsertDocument(R"({"name": "carl"})"_json);
+    EXPECT_FALSE(users.GetTable().WriteRows(version, {0}, {}));
+    EXPECT_TRUE(users.GetTable().WriteRows(version + 1, {1}, {R"({"age": 50})"_json}));
+    EXPECT_EQ(users.FindAll()[1].age, 50);
+    EXPECT_FALSE(users.GetTable().WriteRows(version + 2, {2}, {}));
+    EXPECT_EQ(users.FindAll().size(), 2);
+}